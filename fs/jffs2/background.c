@@ -16,26 +16,150 @@
 #include "vfs_jffs2.h"
 #include "mtd_partition.h"
 
-#define GC_THREAD_FLAG_TRIG 1
-#define GC_THREAD_FLAG_STOP 2
 #define GC_THREAD_FLAG_HAS_EXIT 4
 
-extern struct MtdNorDev jffs2_dev_list[CONFIG_MTD_PATTITION_NUM];
-static void jffs2_garbage_collect_thread(unsigned long data);
+#define GC_POOL_FLAG_WORK 1
+
+/* c->gc_state */
+#define GC_STATE_BUSY 1		/* A worker is collecting on this mount */
+#define GC_STATE_STOP 2		/* Being unmounted; don't pick it again */
+#define GC_STATE_DEAD 4		/* Out of space for GC, leave it alone */
+
+/*
+ * Garbage collection workers.
+ *
+ * Rather than a GC thread of its own for every mount, which costs a stack
+ * apiece and leaves each partition to the one core it was pinned to, all
+ * mounts share a small pool of JFFS2_GC_WORKERS workers. Each time a
+ * worker is free it picks the mount which needs it most: one that is
+ * short of free blocks, counting blocks already on their way through
+ * erase as free, ahead of one that is merely due its idle tick. Mounts
+ * which lose out get a little more deserving every time, so none is
+ * starved however busy the others are. A worker serves a mount for one
+ * pass, or one idle batch, and then chooses again.
+ *
+ * A mount is only ever collected by one worker at a time. Starting and
+ * stopping it is serialised by the mount code; pool.lock covers the list
+ * of mounts and their gc_state, and pool.ctl the workers themselves.
+ */
+struct jffs2_gc_pool {
+	struct pthread_mutex lock;
+	struct pthread_mutex ctl;
+	LOS_DL_LIST mounts;
+	unsigned int nr_mounts;
+	EVENT_CB_S work;		/* GC_POOL_FLAG_WORK: some mount wants GC */
+	EVENT_CB_S exit;		/* Worker n sets bit n on exit */
+	unsigned int task[JFFS2_GC_WORKERS_MAX];
+	unsigned int workers;		/* How many are running */
+	unsigned int target;		/* ... and how many there should be */
+	unsigned int size;		/* Workers to run while anything is mounted */
+	bool ready;
+};
+
+static struct jffs2_gc_pool jffs2_gc_pool;
+
+static void jffs2_gc_worker(unsigned long n);
 
 void jffs2_garbage_collect_trigger(struct jffs2_sb_info *c)
 {
-	struct super_block *sb = OFNI_BS_2SFFJ(c);
-	/* Wake up the thread */
+	/* Wake up a worker. We may be under erase_completion_lock, so
+	   nothing here may sleep */
 	jffs2_dbg(1, "jffs2_garbage_collect_trigger\n");
-	LOS_EventWrite(&sb->s_gc_thread_flags, GC_THREAD_FLAG_TRIG);
+	LOS_AtomicSet(&c->gc_trig, 1);
+	LOS_EventWrite(&jffs2_gc_pool.work, GC_POOL_FLAG_WORK);
+}
+
+/* Is this a GC worker, rather than a writer collecting inline? */
+int jffs2_gc_thread_is_current(struct jffs2_sb_info *c)
+{
+	return (c->gc_state & GC_STATE_BUSY) && c->gc_worker == LOS_CurTaskIDGet();
+}
+
+/* The first call comes from the first mount, or from setting the pool size
+   before that, so there is nobody to race with */
+static void jffs2_gc_pool_init(void)
+{
+	struct jffs2_gc_pool *pool = &jffs2_gc_pool;
+
+	if (pool->ready)
+		return;
+	mutex_init(&pool->lock);
+	mutex_init(&pool->ctl);
+	LOS_ListInit(&pool->mounts);
+	LOS_EventInit(&pool->work);
+	LOS_EventInit(&pool->exit);
+	if (!pool->size)
+		pool->size = JFFS2_GC_WORKERS;
+	pool->ready = true;
+}
+
+/* Start or stop workers until there are @n. Called with pool->ctl held */
+static void jffs2_gc_pool_resize(unsigned int n)
+{
+	struct jffs2_gc_pool *pool = &jffs2_gc_pool;
+	TSK_INIT_PARAM_S stGcTask;
+	unsigned int i;
+
+	pool->target = n;
+	if (n < pool->workers) {
+		/* Each finishes what it's doing and then leaves */
+		LOS_EventWrite(&pool->work, GC_POOL_FLAG_WORK);
+		for (i = n; i < pool->workers; i++) {
+			(void)LOS_EventRead(&pool->exit, 1U << i,
+					LOS_WAITMODE_OR | LOS_WAITMODE_CLR,
+					LOS_WAIT_FOREVER);
+			(void)LOS_TaskDelete(pool->task[i]);
+		}
+		pool->workers = n;
+		return;
+	}
+
+	/* Doesn't matter if this fails -- writers will collect for
+	 * themselves when they have to. They aren't pinned, so a busy
+	 * partition can have any core that's idle */
+	for (i = pool->workers; i < n; i++) {
+		(void)memset_s(&stGcTask, sizeof(TSK_INIT_PARAM_S), 0, sizeof(TSK_INIT_PARAM_S));
+
+		stGcTask.pfnTaskEntry = (TSK_ENTRY_FUNC)jffs2_gc_worker;
+		stGcTask.auwArgs[0] = (UINTPTR)i;
+		stGcTask.uwStackSize  = LOSCFG_BASE_CORE_TSK_DEFAULT_STACK_SIZE;
+		stGcTask.pcName = "jffs2_gc_thread";
+		stGcTask.usTaskPrio = JFFS2_GC_THREAD_PRIORITY;
+
+		if (LOS_TaskCreate(&pool->task[i], &stGcTask)) {
+			JFFS2_ERROR("Create gc task failed!!!\n");
+			break;
+		}
+	}
+	pool->workers = i;
+	pool->target = i;
+}
+
+/*
+ * Change the number of GC workers shared by all mounts. Before anything
+ * is mounted this just sets how many will be started.
+ */
+int jffs2_set_gc_workers(unsigned int n)
+{
+	struct jffs2_gc_pool *pool = &jffs2_gc_pool;
+
+	if (n == 0 || n > JFFS2_GC_WORKERS_MAX)
+		return -EINVAL;
+
+	jffs2_gc_pool_init();
+	mutex_lock(&pool->ctl);
+	pool->size = n;
+	if (pool->nr_mounts)
+		jffs2_gc_pool_resize(n);
+	mutex_unlock(&pool->ctl);
+	return 0;
 }
 
-/* This must only ever be called when no GC thread is currently running */
+/* This must only ever be called when the mount isn't already in the pool */
 void jffs2_start_garbage_collect_thread(struct jffs2_sb_info *c)
 {
+	struct jffs2_gc_pool *pool = &jffs2_gc_pool;
 	struct super_block *sb = OFNI_BS_2SFFJ(c);
-	TSK_INIT_PARAM_S stGcTask;
 
 	if (c == NULL)
 		return;
@@ -44,79 +168,945 @@ void jffs2_start_garbage_collect_thread(struct jffs2_sb_info *c)
 		return;
 
 	LOS_EventInit(&sb->s_gc_thread_flags);
+	c->gc_state = 0;
+	c->gc_worker = 0;
+	c->gc_waited = 0;
+	c->gc_served = 0;
+	c->gc_last_ns = jffs2_now_ns();
+	LOS_AtomicSet(&c->gc_trig, 0);
 
-	/* Start the thread. Doesn't matter if it fails -- it's only an
-	 * optimisation anyway */
-	(void)memset_s(&stGcTask, sizeof(TSK_INIT_PARAM_S), 0, sizeof(TSK_INIT_PARAM_S));
+	jffs2_gc_pool_init();
+	mutex_lock(&pool->ctl);
+	mutex_lock(&pool->lock);
+	LOS_ListTailInsert(&pool->mounts, &c->gc_list);
+	mutex_unlock(&pool->lock);
+	if (pool->nr_mounts++ == 0)
+		jffs2_gc_pool_resize(pool->size);
+	mutex_unlock(&pool->ctl);
+}
 
-	stGcTask.pfnTaskEntry = (TSK_ENTRY_FUNC)jffs2_garbage_collect_thread;
-	stGcTask.auwArgs[0] = (UINTPTR)c;
-	stGcTask.uwStackSize  = LOSCFG_BASE_CORE_TSK_DEFAULT_STACK_SIZE;
-	stGcTask.pcName = "jffs2_gc_thread";
-#ifdef LOSCFG_KERNEL_SMP
-	unsigned int i;
-	for (i = 0; i < CONFIG_MTD_PATTITION_NUM; i++) {
-		if (sb->s_dev == &jffs2_dev_list[i])
+void jffs2_stop_garbage_collect_thread(struct jffs2_sb_info *c)
+{
+	struct jffs2_gc_pool *pool = &jffs2_gc_pool;
+	struct super_block *sb = OFNI_BS_2SFFJ(c);
+	uint32_t busy;
+
+	JFFS2_DEBUG("jffs2_stop_garbage_collect_thread\n");
+
+	/* Take it out of the running, and wait for whoever has it now */
+	mutex_lock(&pool->lock);
+	c->gc_state |= GC_STATE_STOP;
+	busy = c->gc_state & GC_STATE_BUSY;
+	mutex_unlock(&pool->lock);
+
+	JFFS2_DEBUG("jffs2_stop_garbage_collect_thread wait\n");
+	if (busy)
+		(void)LOS_EventRead(&sb->s_gc_thread_flags,
+				GC_THREAD_FLAG_HAS_EXIT,
+				LOS_WAITMODE_OR | LOS_WAITMODE_CLR,
+				LOS_WAIT_FOREVER);
+
+	mutex_lock(&pool->ctl);
+	mutex_lock(&pool->lock);
+	LOS_ListDelete(&c->gc_list);
+	mutex_unlock(&pool->lock);
+	/* Nothing left to collect, so give the stacks back */
+	if (--pool->nr_mounts == 0)
+		jffs2_gc_pool_resize(0);
+	mutex_unlock(&pool->ctl);
+
+	JFFS2_DEBUG("jffs2 GC: %u turns, %u idle passes (%llu ms), "
+		    "%u inline passes (%llu ms), ~%llu ms of writer stalls avoided\n",
+		    c->gc_served, c->gc_idle_passes, c->gc_idle_pass_ns / 1000000,
+		    c->gc_fg_passes, c->gc_fg_pass_ns / 1000000,
+		    c->gc_stall_avoided_ns / 1000000);
+	if (LOS_AtomicRead(&c->stats.recompr_nodes))
+		JFFS2_DEBUG("jffs2: recompressed %d cold nodes, %llu bytes down to %llu\n",
+			    LOS_AtomicRead(&c->stats.recompr_nodes),
+			    LOS_Atomic64Read(&c->stats.recompr_in),
+			    LOS_Atomic64Read(&c->stats.recompr_out));
+}
+
+/*
+ * Decide how many GC passes to run ahead of demand at this idle tick.
+ * We stay out of the way while writers are busy, and otherwise keep
+ * collecting until gc_idle_watermark blocks are free. If free space is
+ * shrinking between ticks we run a full batch rather than a single pass,
+ * so that we catch up before the writers get down to resv_blocks_write.
+ */
+static int jffs2_gc_idle_budget(struct jffs2_sb_info *c)
+{
+	uint32_t nr_free, dirty, reserves;
+	int budget = 0;
+
+	spin_lock(&c->erase_completion_lock);
+	nr_free = c->nr_free_blocks + c->nr_erasing_blocks;
+	dirty = c->dirty_size + c->erasing_size - c->nr_erasing_blocks * c->sector_size;
+	reserves = c->gc_fg_reserves;
+	c->gc_fg_reserves = 0;
+
+	if (c->unchecked_size) {
+		/* Nodes still need CRC checking; that's cheap and it has to
+		   happen before anything can be collected */
+		budget = JFFS2_GC_IDLE_BATCH;
+	} else if (nr_free < c->gc_idle_watermark && dirty >= c->nospc_dirty_size) {
+		if (reserves >= JFFS2_GC_IDLE_BUSY_RESERVES)
+			budget = 0;
+		else if (!reserves || nr_free < c->gc_idle_last_free)
+			budget = JFFS2_GC_IDLE_BATCH;
+		else
+			budget = 1;
+	}
+	c->gc_idle_last_free = nr_free;
+	spin_unlock(&c->erase_completion_lock);
+
+	jffs2_dbg(1, "%s(): %u free blocks (target %u), %u reservations, budget %d\n",
+		  __func__, nr_free, c->gc_idle_watermark, reserves, budget);
+	return budget;
+}
+
+static int jffs2_gc_idle_done(struct jffs2_sb_info *c)
+{
+	int done;
+
+	spin_lock(&c->erase_completion_lock);
+	done = !c->unchecked_size &&
+		c->nr_free_blocks + c->nr_erasing_blocks >= c->gc_idle_watermark;
+	spin_unlock(&c->erase_completion_lock);
+	return done;
+}
+
+/* Run up to @budget passes, giving up as soon as a writer turns up */
+static int jffs2_gc_idle_batch(struct jffs2_sb_info *c, int budget)
+{
+	uint64_t start, elapsed, cost;
+	uint32_t nr_free;
+	int ret;
+
+	while (budget-- > 0 && !jffs2_gc_idle_done(c)) {
+		spin_lock(&c->erase_completion_lock);
+		nr_free = c->nr_free_blocks + c->nr_erasing_blocks;
+		spin_unlock(&c->erase_completion_lock);
+
+		start = jffs2_now_ns();
+		ret = jffs2_garbage_collect_pass(c);
+		elapsed = jffs2_now_ns() - start;
+		if (ret)
+			return ret;
+
+		c->gc_idle_passes++;
+		c->gc_idle_pass_ns += elapsed;
+
+		/* Below resv_blocks_write a writer would have had to do this
+		   pass itself before it got its space, at roughly the cost
+		   writers have been seeing so far */
+		if (nr_free < c->resv_blocks_write) {
+			cost = c->gc_fg_passes ? c->gc_fg_pass_ns / c->gc_fg_passes : elapsed;
+			c->gc_stall_avoided_ns += cost;
+		}
+
+		if (c->gc_fg_reserves)
 			break;
 	}
-	stGcTask.usCpuAffiMask = CPUID_TO_AFFI_MASK(i % LOSCFG_KERNEL_CORE_NUM);
-#endif
-	stGcTask.usTaskPrio = JFFS2_GC_THREAD_PRIORITY;
+	return 0;
+}
+
+/*
+ * How badly does this mount need a worker? Blocks short of the idle
+ * watermark count once, and those short of what a writer needs count
+ * several times over, since someone is about to stall on them. Blocks
+ * being erased will be free soon without any help from GC, so they
+ * count as free for the first, but not for the second.
+ */
+static uint32_t jffs2_gc_urgency(struct jffs2_sb_info *c)
+{
+	uint32_t nr_free, urgency = 0;
 
-	if (LOS_TaskCreate(&sb->s_gc_thread, &stGcTask))
-		JFFS2_ERROR("Create gc task failed!!!\n");
+	spin_lock(&c->erase_completion_lock);
+	nr_free = c->nr_free_blocks + c->nr_erasing_blocks;
+	if (nr_free < c->gc_idle_watermark)
+		urgency += c->gc_idle_watermark - nr_free;
+	if (c->nr_free_blocks < c->resv_blocks_write)
+		urgency += JFFS2_GC_POOL_STALL_WEIGHT *
+			(c->resv_blocks_write - c->nr_free_blocks);
+	if (c->unchecked_size)
+		urgency++;
+	spin_unlock(&c->erase_completion_lock);
+	return urgency;
 }
 
-void jffs2_stop_garbage_collect_thread(struct jffs2_sb_info *c)
+/*
+ * Choose the mount to serve next, of those which have been triggered or
+ * are due their idle tick, and mark it busy. *trig says which it was.
+ */
+static struct jffs2_sb_info *jffs2_gc_pick(int *trig)
 {
+	struct jffs2_gc_pool *pool = &jffs2_gc_pool;
+	struct jffs2_sb_info *c, *best = NULL;
+	uint64_t now = jffs2_now_ns();
+	uint32_t score, best_score = 0;
+	int due;
+
+	mutex_lock(&pool->lock);
+	LOS_DL_LIST_FOR_EACH_ENTRY(c, &pool->mounts, struct jffs2_sb_info, gc_list) {
+		if (c->gc_state)
+			continue;
+		due = LOS_AtomicRead(&c->gc_trig) != 0;
+		if (!due && now - c->gc_last_ns < (uint64_t)JFFS2_GC_IDLE_INTERVAL_MS * 1000000)
+			continue;
+
+		/* Being asked outranks an idle tick, but not a mount which
+		   is running out of space, nor one which has waited long */
+		score = jffs2_gc_urgency(c) + c->gc_waited + (due ? 1 : 0) + 1;
+		if (score > best_score) {
+			if (best)
+				best->gc_waited++;
+			best = c;
+			best_score = score;
+		} else {
+			c->gc_waited++;
+		}
+	}
+	if (best) {
+		*trig = LOS_AtomicXchg32bits(&best->gc_trig, 0) != 0;
+		best->gc_state |= GC_STATE_BUSY;
+		best->gc_worker = LOS_CurTaskIDGet();
+		best->gc_last_ns = now;
+		best->gc_waited = 0;
+		best->gc_served++;
+	}
+	mutex_unlock(&pool->lock);
+	return best;
+}
+
+static void jffs2_gc_put(struct jffs2_sb_info *c, int dead)
+{
+	struct jffs2_gc_pool *pool = &jffs2_gc_pool;
 	struct super_block *sb = OFNI_BS_2SFFJ(c);
+	uint32_t stop;
 
-	JFFS2_DEBUG("jffs2_stop_garbage_collect_thread\n");
-	/* Stop the thread and wait for it if necessary */
+	mutex_lock(&pool->lock);
+	c->gc_state &= ~GC_STATE_BUSY;
+	if (dead)
+		c->gc_state |= GC_STATE_DEAD;
+	stop = c->gc_state & GC_STATE_STOP;
+	mutex_unlock(&pool->lock);
 
-	LOS_EventWrite(&sb->s_gc_thread_flags, GC_THREAD_FLAG_STOP);
+	/* Unmount is waiting for us to let go */
+	if (stop)
+		LOS_EventWrite(&sb->s_gc_thread_flags, GC_THREAD_FLAG_HAS_EXIT);
+}
 
-	JFFS2_DEBUG("jffs2_stop_garbage_collect_thread wait\n");
+static int jffs2_gc_serve(struct jffs2_sb_info *c, int trig)
+{
+	int ret;
+
+	if (!trig) {
+		/* Nobody asked for anything: push out any writes that
+		   have been sitting around, and see if it's worth
+		   working ahead */
+		if (c->mount_opts.wb_timeout_ms)
+			(void)jffs2_wb_writeback(c, jffs2_now_ns() -
+				(uint64_t)c->mount_opts.wb_timeout_ms * 1000000);
+		jffs2_flush_obsolete(c);
+		(void)jffs2_flush_wcbuf_stale(c);
+		return jffs2_gc_idle_batch(c, jffs2_gc_idle_budget(c));
+	}
+
+	jffs2_dbg(1, "jffs2: GC THREAD GC BEGIN\n");
+	ret = jffs2_garbage_collect_pass(c);
+	jffs2_dbg(1, "jffs2: GC THREAD GC END\n");
+	/* Busy: get to these before a writer has to */
+	if (c->obs_queued >= JFFS2_OBSOLETE_QUEUE / 2)
+		jffs2_flush_obsolete(c);
+	return ret;
+}
+
+static void jffs2_gc_worker(unsigned long n)
+{
+	struct jffs2_gc_pool *pool = &jffs2_gc_pool;
+	struct jffs2_sb_info *c;
+	int trig, ret;
 
-	(void)LOS_EventRead(&sb->s_gc_thread_flags,
-			GC_THREAD_FLAG_HAS_EXIT,
+	jffs2_dbg(1, "jffs2_gc_worker %lu START\n", n);
+	while (n < pool->target) {
+		(void)LOS_EventRead(&pool->work, GC_POOL_FLAG_WORK,
 			LOS_WAITMODE_OR | LOS_WAITMODE_CLR,
-			LOS_WAIT_FOREVER);
+			LOS_MS2Tick(JFFS2_GC_IDLE_INTERVAL_MS));
+
+		while (n < pool->target && (c = jffs2_gc_pick(&trig)) != NULL) {
+			ret = jffs2_gc_serve(c, trig);
+			if (ret == -ENOSPC)
+				PRINTK("No space for garbage collection. "
+				"Aborting JFFS2 GC on this mount\n");
+			jffs2_gc_put(c, ret == -ENOSPC);
+		}
+	}
+	jffs2_dbg(1, "jffs2_gc_worker %lu EXIT\n", n);
+	LOS_EventWrite(&pool->exit, 1U << n);
+}
+
+/*
+ * Background CRC checking.
+ *
+ * After mount every node is REF_UNCHECKED, and GC has to CRC check one
+ * inode per pass until it has been through them all before it can start
+ * doing anything useful. Instead, we start a few checker threads which
+ * share out the inodes between them and check them right away.
+ *
+ * A checker owns an inode by moving it from INO_STATE_UNCHECKED to
+ * INO_STATE_CHECKING, exactly as the GC check phase does, so the two can
+ * run side by side. Anyone opening an inode checks it for themselves as
+ * part of reading it in; when they open a directory, its children are
+ * queued for the checkers ahead of the rest.
+ */
+
+static struct jffs2_inode_cache *jffs2_check_next_inode(struct jffs2_sb_info *c)
+{
+	struct jffs2_inode_cache *ic = NULL;
+	uint32_t ino;
+
+	spin_lock(&c->inocache_lock);
+	while (!c->check_stop) {
+		if (c->check_prio_tail != c->check_prio_head)
+			ino = c->check_prio[c->check_prio_tail++ % JFFS2_CHECK_PRIO_SLOTS];
+		else if (c->check_next_ino <= c->highest_ino)
+			ino = c->check_next_ino++;
+		else
+			break;
 
-	// Kill and free the resources ...  this is safe due to the flag
-	// from the thread.
-	(void)LOS_TaskDelete(sb->s_gc_thread);
-	(void)LOS_EventWrite(&sb->s_gc_thread_flags, 0xFFFFFFFF);
+		ic = jffs2_get_ino_cache(c, ino);
+		/* Unlinked ones are left to GC, which knows what to do with them */
+		if (ic && ic->pino_nlink && ic->state == INO_STATE_UNCHECKED) {
+			ic->state = INO_STATE_CHECKING;
+			break;
+		}
+		ic = NULL;
+	}
+	spin_unlock(&c->inocache_lock);
+	return ic;
 }
 
-static void jffs2_garbage_collect_thread(unsigned long data)
+void jffs2_check_hint(struct jffs2_sb_info *c, uint32_t ino)
+{
+	spin_lock(&c->inocache_lock);
+	if (c->check_threads && !c->check_stop &&
+	    c->check_prio_head - c->check_prio_tail < JFFS2_CHECK_PRIO_SLOTS)
+		c->check_prio[c->check_prio_head++ % JFFS2_CHECK_PRIO_SLOTS] = ino;
+	spin_unlock(&c->inocache_lock);
+}
+
+static void jffs2_check_progress(struct jffs2_sb_info *c)
+{
+	uint32_t left, pct;
+
+	spin_lock(&c->erase_completion_lock);
+	left = c->unchecked_size;
+	pct = 100 - (uint32_t)((uint64_t)left * 100 / c->check_total);
+	if (pct < c->check_reported + 25 && left) {
+		spin_unlock(&c->erase_completion_lock);
+		return;
+	}
+	c->check_reported = pct;
+	spin_unlock(&c->erase_completion_lock);
+
+	if (left)
+		JFFS2_NOTICE("%u%% of 0x%x bytes of nodes checked\n", pct, c->check_total);
+	else
+		JFFS2_NOTICE("all nodes checked in %llu ms\n",
+			     (jffs2_now_ns() - c->check_start) / 1000000);
+}
+
+static void jffs2_check_thread(unsigned long data, unsigned long n)
 {
 	struct jffs2_sb_info *c = (struct jffs2_sb_info *)data;
 	struct super_block *sb = OFNI_BS_2SFFJ(c);
-	unsigned int flag = 0;
+	struct jffs2_inode_cache *ic;
+	int ret;
 
-	jffs2_dbg(1, "jffs2_garbage_collect_thread START\n");
-	while(1) {
-		flag = LOS_EventRead(&sb->s_gc_thread_flags,
-			GC_THREAD_FLAG_TRIG | GC_THREAD_FLAG_STOP,
-			LOS_WAITMODE_OR | LOS_WAITMODE_CLR,
-			LOS_WAIT_FOREVER
-		);
-		if (flag & GC_THREAD_FLAG_STOP)
+	jffs2_dbg(1, "jffs2_check_thread %lu START\n", n);
+	while ((ic = jffs2_check_next_inode(c)) != NULL) {
+		ret = jffs2_do_crccheck_inode(c, ic);
+		if (ret)
+			pr_warn("Returned error for crccheck of ino #%u. Expect badness...\n",
+				ic->ino);
+
+		jffs2_set_inocache_state(c, ic, INO_STATE_CHECKEDABSENT);
+		jffs2_check_progress(c);
+	}
+	jffs2_dbg(1, "jffs2_check_thread %lu EXIT\n", n);
+	LOS_EventWrite(&sb->s_check_flags, 1U << n);
+}
+
+void jffs2_start_check_threads(struct jffs2_sb_info *c)
+{
+	struct super_block *sb = OFNI_BS_2SFFJ(c);
+	TSK_INIT_PARAM_S stCheckTask;
+	int i;
+
+	c->check_threads = 0;
+	c->check_stop = 0;
+	c->check_next_ino = 1;
+	c->check_total = c->unchecked_size;
+	c->check_reported = 0;
+	c->check_start = jffs2_now_ns();
+	if (!c->check_total)
+		return;
+
+	LOS_EventInit(&sb->s_check_flags);
+
+	/* As with GC, this is only an optimisation. If no thread can be
+	 * started the GC check phase will get round to it all anyway */
+	for (i = 0; i < JFFS2_CHECK_THREADS; i++) {
+		(void)memset_s(&stCheckTask, sizeof(TSK_INIT_PARAM_S), 0, sizeof(TSK_INIT_PARAM_S));
+
+		stCheckTask.pfnTaskEntry = (TSK_ENTRY_FUNC)jffs2_check_thread;
+		stCheckTask.auwArgs[0] = (UINTPTR)c;
+		stCheckTask.auwArgs[1] = (UINTPTR)i;
+		stCheckTask.uwStackSize  = LOSCFG_BASE_CORE_TSK_DEFAULT_STACK_SIZE;
+		stCheckTask.pcName = "jffs2_check_thread";
+#ifdef LOSCFG_KERNEL_SMP
+		stCheckTask.usCpuAffiMask = CPUID_TO_AFFI_MASK(i % LOSCFG_KERNEL_CORE_NUM);
+#endif
+		stCheckTask.usTaskPrio = JFFS2_CHECK_THREAD_PRIORITY;
+
+		if (LOS_TaskCreate(&sb->s_check_thread[i], &stCheckTask)) {
+			JFFS2_ERROR("Create check task failed!!!\n");
 			break;
+		}
+		c->check_threads++;
+	}
+}
 
-		jffs2_dbg(1, "jffs2: GC THREAD GC BEGIN\n");
+void jffs2_stop_check_threads(struct jffs2_sb_info *c)
+{
+	struct super_block *sb = OFNI_BS_2SFFJ(c);
+
+	if (!c->check_threads)
+		return;
+
+	spin_lock(&c->inocache_lock);
+	c->check_stop = 1;
+	spin_unlock(&c->inocache_lock);
+
+	/* Each of them finishes the inode it's on and then returns, which
+	   is the end of the task. Most will have gone long ago, and their
+	   IDs may have been given to someone else, so leave those be */
+	(void)LOS_EventRead(&sb->s_check_flags,
+			(1U << c->check_threads) - 1,
+			LOS_WAITMODE_AND | LOS_WAITMODE_CLR,
+			LOS_WAIT_FOREVER);
+	c->check_threads = 0;
+}
 
-		if (sb->s_root == NULL)
-			return;
+static void jffs2_ra_thread(unsigned long data)
+{
+	struct jffs2_sb_info *c = (struct jffs2_sb_info *)data;
+	struct super_block *sb = OFNI_BS_2SFFJ(c);
+	struct jffs2_inode *inode;
+	struct jffs2_inode_info *f;
+	unsigned int flag;
+	uint32_t ino, ofs;
 
-		if (jffs2_garbage_collect_pass(c) == -ENOSPC) {
-			PRINTK("No space for garbage collection. "
-			"Aborting JFFS2 GC thread\n");
+	jffs2_dbg(1, "jffs2_ra_thread START\n");
+	while (1) {
+		flag = LOS_EventRead(&sb->s_ra_flags,
+			RA_THREAD_FLAG_REQ | RA_THREAD_FLAG_STOP,
+			LOS_WAITMODE_OR | LOS_WAITMODE_CLR,
+			LOS_WAIT_FOREVER);
+		if (flag & RA_THREAD_FLAG_STOP)
 			break;
+
+		mutex_lock(&c->ra_sem);
+		ino = c->ra_req_ino;
+		ofs = c->ra_req_ofs;
+		c->ra_req_ino = 0;
+		mutex_unlock(&c->ra_sem);
+		if (!ino)
+			continue;
+
+		/* The reader may be gone by now, and the file with it. If
+		   it's unlinked, nobody will want much more of it */
+		inode = jffs2_iget(sb, ino);
+		if (IS_ERR(inode))
+			continue;
+		f = JFFS2_INODE_INFO(inode);
+		if (inode->i_nlink) {
+			jffs2_inode_lock_shared(f);
+			jffs2_ra_prefetch(c, f, ofs);
+			jffs2_inode_unlock_shared(f);
 		}
-		jffs2_dbg(1, "jffs2: GC THREAD GC END\n");
+		jffs2_iunpin(inode);
 	}
-	JFFS2_DEBUG("jffs2_garbage_collect_thread EXIT\n");
-	LOS_EventWrite(&sb->s_gc_thread_flags, GC_THREAD_FLAG_HAS_EXIT);
+	jffs2_dbg(1, "jffs2_ra_thread EXIT\n");
+	LOS_EventWrite(&sb->s_ra_flags, RA_THREAD_FLAG_HAS_EXIT);
+}
+
+void jffs2_start_ra_thread(struct jffs2_sb_info *c)
+{
+	struct super_block *sb = OFNI_BS_2SFFJ(c);
+	TSK_INIT_PARAM_S stRaTask;
+
+	c->ra_running = 0;
+	LOS_EventInit(&sb->s_ra_flags);
+
+	/* Without it reads just don't get ahead of themselves */
+	(void)memset_s(&stRaTask, sizeof(TSK_INIT_PARAM_S), 0, sizeof(TSK_INIT_PARAM_S));
+
+	stRaTask.pfnTaskEntry = (TSK_ENTRY_FUNC)jffs2_ra_thread;
+	stRaTask.auwArgs[0] = (UINTPTR)c;
+	stRaTask.uwStackSize  = LOSCFG_BASE_CORE_TSK_DEFAULT_STACK_SIZE;
+	stRaTask.pcName = "jffs2_ra_thread";
+	stRaTask.usTaskPrio = JFFS2_RA_THREAD_PRIORITY;
+
+	if (LOS_TaskCreate(&sb->s_ra_thread, &stRaTask)) {
+		JFFS2_ERROR("Create read-ahead task failed!!!\n");
+		return;
+	}
+	c->ra_running = 1;
+}
+
+void jffs2_stop_ra_thread(struct jffs2_sb_info *c)
+{
+	struct super_block *sb = OFNI_BS_2SFFJ(c);
+
+	if (!c->ra_running)
+		return;
+	c->ra_running = 0;
+
+	/* It returns once it has said so, which ends the task */
+	LOS_EventWrite(&sb->s_ra_flags, RA_THREAD_FLAG_STOP);
+	(void)LOS_EventRead(&sb->s_ra_flags,
+			RA_THREAD_FLAG_HAS_EXIT,
+			LOS_WAITMODE_OR | LOS_WAITMODE_CLR,
+			LOS_WAIT_FOREVER);
+	if (c->ra_filled)
+		JFFS2_DEBUG("jffs2: read ahead %u nodes, %u reads served from them\n",
+			    c->ra_filled, c->ra_hits);
+}
+
+/*
+ * Asynchronous writes.
+ *
+ * jffs2_write_async() takes a copy of the data and queues it, and the
+ * caller hears how it went through its callback. A request is cut into
+ * the same page-sized chunks jffs2_write_inode_range() would write. The
+ * compressor task compresses each into a slot of c->aio_ring, while the
+ * writer task reserves space for and writes out the one before, so
+ * compression of chunk N+1 overlaps programming of chunk N.
+ *
+ * At submission a request is charged the most flash its chunks could
+ * possibly take, uncompressed, in c->aio_ledger, and is refused with
+ * -ENOSPC if that isn't there, rather than failing once it's too late to
+ * tell anyone but the callback. Each chunk hands its share back once it
+ * is written. Other reservations leave the ledger alone and, if it's all
+ * that stands between them and -ENOSPC, wait for the queue to drain.
+ *
+ * Each request pins its inode until it completes. Sync writes,
+ * truncations and unlinks of an inode wait for its async writes first,
+ * so they can't land on top of each other out of order, or after the
+ * inode is gone.
+ */
+
+#define AIO_FLAG_REQ 1		/* To the compressor: a request was queued */
+#define AIO_FLAG_SLOT 2		/* ... a ring slot was freed */
+#define AIO_FLAG_CHUNK 4	/* To the writer: a chunk was compressed */
+#define AIO_FLAG_DONE 8		/* To anyone waiting: a request completed */
+#define AIO_FLAG_COMPR_EXIT 16
+#define AIO_FLAG_WRITE_EXIT 32
+
+struct jffs2_aio_req {
+	LOS_DL_LIST list;		/* On c->aio_queue until it's all compressed */
+	struct jffs2_inode *inode;
+	struct jffs2_raw_inode ri;
+	unsigned char *buf;
+	uint32_t offset;
+	uint32_t len;
+	uint32_t cut;			/* Bytes handed to the writer so far */
+	uint32_t done_len;		/* ... and that the writer is done with */
+	uint32_t written;		/* ... and that made it to the flash */
+	uint32_t resv;			/* Still held in c->aio_ledger */
+	int ret;
+	jffs2_write_done_t done;
+	void *priv;
+};
+
+/* The most a chunk of @datalen bytes could take on the flash */
+static inline uint32_t jffs2_aio_worst(uint32_t datalen)
+{
+	return PAD(sizeof(struct jffs2_raw_inode) + datalen) + JFFS2_SUMMARY_INODE_SIZE;
+}
+
+static uint32_t jffs2_aio_chunk_len(uint32_t offset, uint32_t len)
+{
+	return min_t(uint32_t, len, PAGE_CACHE_SIZE - (offset & (PAGE_CACHE_SIZE-1)));
+}
+
+static int jffs2_aio_charge(struct jffs2_sb_info *c, uint32_t resv)
+{
+	uint32_t avail, keep;
+	int ret = 0;
+
+	spin_lock(&c->erase_completion_lock);
+	avail = c->free_size + c->dirty_size + c->erasing_size + c->unchecked_size;
+	keep = c->resv_blocks_write * c->sector_size + c->aio_ledger;
+	if (avail < keep || avail - keep < resv)
+		ret = -ENOSPC;
+	else
+		c->aio_ledger += resv;
+	spin_unlock(&c->erase_completion_lock);
+	return ret;
+}
+
+static void jffs2_aio_refund(struct jffs2_sb_info *c, uint32_t resv)
+{
+	spin_lock(&c->erase_completion_lock);
+	c->aio_ledger -= resv;
+	spin_unlock(&c->erase_completion_lock);
+}
+
+int jffs2_aio_is_current(struct jffs2_sb_info *c)
+{
+	return c->aio_running && LOS_CurTaskIDGet() == OFNI_BS_2SFFJ(c)->s_aio_write_thread;
+}
+
+/* Wait until none of this inode's async writes are outstanding */
+void jffs2_aio_wait_inode(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
+{
+	struct super_block *sb = OFNI_BS_2SFFJ(c);
+
+	/* Someone else waiting may have taken the wakeup meant for us, so
+	   don't count on it */
+	while (f->aio_pending)
+		(void)LOS_EventRead(&sb->s_aio_flags, AIO_FLAG_DONE,
+				LOS_WAITMODE_OR | LOS_WAITMODE_CLR,
+				LOS_MS2Tick(JFFS2_AIO_WAIT_MS));
+}
+
+/* ... or until nothing at all is */
+void jffs2_aio_drain(struct jffs2_sb_info *c)
+{
+	struct super_block *sb = OFNI_BS_2SFFJ(c);
+
+	while (c->aio_inflight)
+		(void)LOS_EventRead(&sb->s_aio_flags, AIO_FLAG_DONE,
+				LOS_WAITMODE_OR | LOS_WAITMODE_CLR,
+				LOS_MS2Tick(JFFS2_AIO_WAIT_MS));
+}
+
+/*
+ * Queue a write of @len bytes of @buf at @offset in @inode, with the
+ * metadata in @ri as for jffs2_write_inode_range(). @buf may be reused as
+ * soon as this returns. Returns 0 if it was queued, in which case @done
+ * is called from the writer task with the result and how much was
+ * written; the inode's size is updated as data lands. Otherwise returns
+ * an error, such as -ENOSPC if there's no room for it, and @done is never
+ * called. If the async tasks aren't running the write is done there and
+ * then, the same way, except that on success @done is called before
+ * this returns, from the caller's task.
+ */
+int jffs2_write_async(struct jffs2_inode *inode, struct jffs2_raw_inode *ri,
+		      const unsigned char *buf, uint32_t offset, uint32_t len,
+		      jffs2_write_done_t done, void *priv)
+{
+	struct super_block *sb = inode->i_sb;
+	struct jffs2_sb_info *c = JFFS2_SB_INFO(sb);
+	struct jffs2_inode_info *f = JFFS2_INODE_INFO(inode);
+	struct jffs2_aio_req *req;
+	uint32_t ofs, n, resv = 0, written = 0;
+	int ret;
+
+	if (jffs2_is_readonly(c))
+		return -EROFS;
+
+	if (!c->aio_running || len == 0) {
+		/* No tasks to hand it to, or nothing to hand them, so just
+		   get on with it */
+		ret = jffs2_write_inode_range(c, f, ri, (unsigned char *)buf, offset,
+					      len, &written);
+		if (ret)
+			return ret;
+		if (done)
+			done(priv, 0, written);
+		return 0;
+	}
+
+	/* Anything in the write-back cache has to go first */
+	ret = jffs2_wb_flush(c, f);
+	if (ret)
+		return ret;
+
+	for (ofs = offset; ofs < offset + len; ofs += n) {
+		n = jffs2_aio_chunk_len(ofs, offset + len - ofs);
+		resv += jffs2_aio_worst(n);
+	}
+
+	req = kmalloc(sizeof(*req), GFP_KERNEL);
+	if (req == NULL)
+		return -ENOMEM;
+	(void)memset_s(req, sizeof(*req), 0, sizeof(*req));
+	req->buf = kmalloc(len, GFP_KERNEL);
+	if (req->buf == NULL) {
+		kfree(req);
+		return -ENOMEM;
+	}
+	if (LOS_CopyToKernel(req->buf, len, buf, len) != 0) {
+		ret = -EFAULT;
+		goto out_free;
+	}
+
+	ret = jffs2_aio_charge(c, resv);
+	if (ret)
+		goto out_free;
+
+	req->inode = jffs2_iget(sb, inode->i_ino);
+	if (IS_ERR(req->inode)) {
+		ret = PTR_ERR(req->inode);
+		jffs2_aio_refund(c, resv);
+		goto out_free;
+	}
+	req->ri = *ri;
+	req->offset = offset;
+	req->len = len;
+	req->resv = resv;
+	req->done = done;
+	req->priv = priv;
+
+	mutex_lock(&c->aio_sem);
+	LOS_ListTailInsert(&c->aio_queue, &req->list);
+	f->aio_pending++;
+	c->aio_inflight++;
+	mutex_unlock(&c->aio_sem);
+	LOS_EventWrite(&sb->s_aio_flags, AIO_FLAG_REQ);
+	return 0;
+
+out_free:
+	kfree(req->buf);
+	kfree(req);
+	return ret;
+}
+
+/* Wait for all of this inode's async writes to complete */
+int jffs2_write_async_wait(struct jffs2_inode *inode)
+{
+	jffs2_aio_wait_inode(JFFS2_SB_INFO(inode->i_sb), JFFS2_INODE_INFO(inode));
+	return 0;
+}
+
+static void jffs2_aio_compr_thread(unsigned long data)
+{
+	struct jffs2_sb_info *c = (struct jffs2_sb_info *)data;
+	struct super_block *sb = OFNI_BS_2SFFJ(c);
+	struct jffs2_aio_req *req;
+	struct jffs2_aio_chunk *ch;
+	int full;
+
+	jffs2_dbg(1, "jffs2_aio_compr_thread START\n");
+	while (1) {
+		mutex_lock(&c->aio_sem);
+		req = LOS_ListEmpty(&c->aio_queue) ? NULL :
+			LOS_DL_LIST_ENTRY(c->aio_queue.pstNext, struct jffs2_aio_req, list);
+		full = c->aio_head - c->aio_tail == JFFS2_AIO_RING;
+		mutex_unlock(&c->aio_sem);
+
+		if (req == NULL || full) {
+			if (req == NULL && c->aio_stop)
+				break;
+			(void)LOS_EventRead(&sb->s_aio_flags,
+				AIO_FLAG_REQ | AIO_FLAG_SLOT,
+				LOS_WAITMODE_OR | LOS_WAITMODE_CLR,
+				LOS_WAIT_FOREVER);
+			continue;
+		}
+
+		/* The slot is ours until aio_head moves past it */
+		ch = &c->aio_ring[c->aio_head % JFFS2_AIO_RING];
+		ch->req = req;
+		ch->offset = req->offset + req->cut;
+		ch->data = req->buf + req->cut;
+		ch->datalen = jffs2_aio_chunk_len(ch->offset, req->len - req->cut);
+		ch->cdatalen = ch->datalen;
+		ch->cbuf = NULL;
+		ch->comprtype = jffs2_compress(c, JFFS2_INODE_INFO(req->inode), ch->data,
+					       &ch->cbuf, &ch->datalen, &ch->cdatalen);
+
+		mutex_lock(&c->aio_sem);
+		req->cut += ch->datalen;
+		if (req->cut == req->len)
+			LOS_ListDelete(&req->list);
+		c->aio_head++;
+		mutex_unlock(&c->aio_sem);
+		LOS_EventWrite(&sb->s_aio_flags, AIO_FLAG_CHUNK);
+	}
+	jffs2_dbg(1, "jffs2_aio_compr_thread EXIT\n");
+	LOS_EventWrite(&sb->s_aio_flags, AIO_FLAG_COMPR_EXIT);
+}
+
+static int jffs2_aio_write_chunk(struct jffs2_sb_info *c, struct jffs2_aio_chunk *ch)
+{
+	struct jffs2_aio_req *req = ch->req;
+	struct jffs2_inode *inode = req->inode;
+	struct jffs2_inode_info *f = JFFS2_INODE_INFO(inode);
+	uint32_t alloclen;
+	int retried = 0;
+	int write_failed;
+	int ret;
+
+	do {
+		ret = jffs2_reserve_space(c, sizeof(req->ri) + ch->cdatalen, &alloclen,
+					  ALLOC_NORMAL, JFFS2_SUMMARY_INODE_SIZE);
+		if (ret)
+			return ret;
+		jffs2_inode_lock(f);
+		ret = jffs2_write_compr_node(c, f, &req->ri, ch->cbuf, ch->comprtype,
+					     ch->offset, ch->datalen, ch->cdatalen,
+					     &write_failed);
+		if (!ret && inode->i_size < ch->offset + ch->datalen)
+			inode->i_size = ch->offset + ch->datalen;
+		jffs2_inode_unlock(f);
+		jffs2_complete_reservation(c);
+	} while (ret && write_failed && !retried++);
+	return ret;
+}
+
+static void jffs2_aio_complete(struct jffs2_sb_info *c, struct jffs2_aio_req *req)
+{
+	struct super_block *sb = OFNI_BS_2SFFJ(c);
+	struct jffs2_inode_info *f = JFFS2_INODE_INFO(req->inode);
+
+	jffs2_aio_refund(c, req->resv);
+	LOS_Atomic64Add(&c->stats.write_bytes, req->written);
+	if (req->done)
+		req->done(req->priv, req->ret, req->written);
+
+	mutex_lock(&c->aio_sem);
+	f->aio_pending--;
+	c->aio_inflight--;
+	c->aio_reqs++;
+	if (req->ret)
+		c->aio_failed++;
+	mutex_unlock(&c->aio_sem);
+
+	jffs2_iunpin(req->inode);
+	kfree(req->buf);
+	kfree(req);
+	LOS_EventWrite(&sb->s_aio_flags, AIO_FLAG_DONE);
+}
+
+static void jffs2_aio_write_thread(unsigned long data)
+{
+	struct jffs2_sb_info *c = (struct jffs2_sb_info *)data;
+	struct super_block *sb = OFNI_BS_2SFFJ(c);
+	struct jffs2_aio_chunk *ch;
+	struct jffs2_aio_req *req;
+	uint32_t resv;
+	int empty, ret;
+
+	jffs2_dbg(1, "jffs2_aio_write_thread START\n");
+	while (1) {
+		mutex_lock(&c->aio_sem);
+		empty = c->aio_tail == c->aio_head;
+		mutex_unlock(&c->aio_sem);
+
+		if (empty) {
+			if (c->aio_stop)
+				break;
+			(void)LOS_EventRead(&sb->s_aio_flags, AIO_FLAG_CHUNK,
+				LOS_WAITMODE_OR | LOS_WAITMODE_CLR,
+				LOS_WAIT_FOREVER);
+			continue;
+		}
+
+		ch = &c->aio_ring[c->aio_tail % JFFS2_AIO_RING];
+		req = ch->req;
+		/* Once one chunk has failed, don't leave a hole before the next */
+		if (!req->ret) {
+			ret = jffs2_aio_write_chunk(c, ch);
+			if (ret)
+				req->ret = ret;
+			else
+				req->written += ch->datalen;
+			c->aio_chunks++;
+		}
+		jffs2_free_comprbuf(ch->cbuf, ch->data);
+
+		resv = min(req->resv, jffs2_aio_worst(ch->datalen));
+		jffs2_aio_refund(c, resv);
+		req->resv -= resv;
+		req->done_len += ch->datalen;
+
+		mutex_lock(&c->aio_sem);
+		c->aio_tail++;
+		mutex_unlock(&c->aio_sem);
+		LOS_EventWrite(&sb->s_aio_flags, AIO_FLAG_SLOT);
+
+		if (req->done_len == req->len)
+			jffs2_aio_complete(c, req);
+	}
+	jffs2_dbg(1, "jffs2_aio_write_thread EXIT\n");
+	LOS_EventWrite(&sb->s_aio_flags, AIO_FLAG_WRITE_EXIT);
+}
+
+void jffs2_start_aio_threads(struct jffs2_sb_info *c)
+{
+	struct super_block *sb = OFNI_BS_2SFFJ(c);
+	TSK_INIT_PARAM_S stAioTask;
+
+	c->aio_running = 0;
+	c->aio_stop = 0;
+	c->aio_head = 0;
+	c->aio_tail = 0;
+	LOS_EventInit(&sb->s_aio_flags);
+
+	/* Without them jffs2_write_async() just writes synchronously */
+	(void)memset_s(&stAioTask, sizeof(TSK_INIT_PARAM_S), 0, sizeof(TSK_INIT_PARAM_S));
+
+	stAioTask.pfnTaskEntry = (TSK_ENTRY_FUNC)jffs2_aio_compr_thread;
+	stAioTask.auwArgs[0] = (UINTPTR)c;
+	stAioTask.uwStackSize  = LOSCFG_BASE_CORE_TSK_DEFAULT_STACK_SIZE;
+	stAioTask.pcName = "jffs2_aio_compr";
+	stAioTask.usTaskPrio = JFFS2_AIO_THREAD_PRIORITY;
+
+	if (LOS_TaskCreate(&sb->s_aio_compr_thread, &stAioTask)) {
+		JFFS2_ERROR("Create async compressor task failed!!!\n");
+		return;
+	}
+
+	stAioTask.pfnTaskEntry = (TSK_ENTRY_FUNC)jffs2_aio_write_thread;
+	stAioTask.pcName = "jffs2_aio_write";
+
+	if (LOS_TaskCreate(&sb->s_aio_write_thread, &stAioTask)) {
+		JFFS2_ERROR("Create async writer task failed!!!\n");
+		c->aio_stop = 1;
+		LOS_EventWrite(&sb->s_aio_flags, AIO_FLAG_REQ);
+		(void)LOS_EventRead(&sb->s_aio_flags, AIO_FLAG_COMPR_EXIT,
+				LOS_WAITMODE_OR | LOS_WAITMODE_CLR,
+				LOS_WAIT_FOREVER);
+		(void)LOS_TaskDelete(sb->s_aio_compr_thread);
+		return;
+	}
+	c->aio_running = 1;
+}
+
+void jffs2_stop_aio_threads(struct jffs2_sb_info *c)
+{
+	struct super_block *sb = OFNI_BS_2SFFJ(c);
+
+	if (!c->aio_running)
+		return;
+
+	/* Everything that was queued gets written first */
+	jffs2_aio_drain(c);
+	c->aio_stop = 1;
+	LOS_EventWrite(&sb->s_aio_flags, AIO_FLAG_REQ | AIO_FLAG_CHUNK);
+	(void)LOS_EventRead(&sb->s_aio_flags,
+			AIO_FLAG_COMPR_EXIT | AIO_FLAG_WRITE_EXIT,
+			LOS_WAITMODE_AND | LOS_WAITMODE_CLR,
+			LOS_WAIT_FOREVER);
+	(void)LOS_TaskDelete(sb->s_aio_compr_thread);
+	(void)LOS_TaskDelete(sb->s_aio_write_thread);
+	c->aio_running = 0;
+	if (c->aio_reqs)
+		JFFS2_DEBUG("jffs2: %u async writes in %u nodes, %u failed\n",
+			    c->aio_reqs, c->aio_chunks, c->aio_failed);
 }
@@ -67,6 +67,7 @@ static void jffs2_build_inode_pass1(struct jffs2_sb_info *c,
 			dbg_fsbuild("child \"%s\" (ino #%u) of dir ino #%u doesn't exist!\n",
 				  fd->name, fd->ino, ic->ino);
 			jffs2_mark_node_obsolete(c, fd->raw);
+			jffs2_obsd_add_fd(c, fd);
 			continue;
 		}
 
@@ -308,6 +309,12 @@ static void jffs2_calc_trigger_levels(struct jffs2_sb_info *c)
 	   trying to GC to make more space. It'll be a fruitless task */
 	c->nospc_dirty_size = c->sector_size + (c->flash_size / 100);
 
+	/* When idle, the GC thread keeps going until this many blocks are
+	   free, so that writers rarely have to GC inline */
+	c->gc_idle_watermark = c->resv_blocks_gctrigger + JFFS2_GC_IDLE_EXTRA_BLOCKS;
+	if (c->gc_idle_watermark > c->nr_blocks / 2)
+		c->gc_idle_watermark = max_t(uint32_t, c->nr_blocks / 2, c->resv_blocks_gctrigger);
+
 	dbg_fsbuild("trigger levels (size %d KiB, block size %d KiB, %d blocks)\n",
 		    c->flash_size / 1024, c->sector_size / 1024, c->nr_blocks);
 	dbg_fsbuild("Blocks required to allow deletion:    %d (%d KiB)\n",
@@ -324,6 +331,8 @@ static void jffs2_calc_trigger_levels(struct jffs2_sb_info *c)
 		  c->nospc_dirty_size);
 	dbg_fsbuild("Very dirty blocks before GC triggered: %d\n",
 		  c->vdirty_blocks_gctrigger);
+	dbg_fsbuild("Blocks targeted by idle GC:           %d (%d KiB)\n",
+		  c->gc_idle_watermark, c->gc_idle_watermark*c->sector_size/1024);
 }
 
 int jffs2_do_mount_fs(struct jffs2_sb_info *c)
@@ -369,9 +378,12 @@ int jffs2_do_mount_fs(struct jffs2_sb_info *c)
 	c->highest_ino = 1;
 	c->summary = NULL;
 
-	ret = jffs2_sum_init(c);
-	if (ret)
-		goto out_free;
+	/* Nothing will be written, so there's nothing to summarise */
+	if (!jffs2_is_readonly(c)) {
+		ret = jffs2_sum_init(c);
+		if (ret)
+			goto out_free;
+	}
 
 	if (jffs2_build_filesystem(c)) {
 		dbg_fsbuild("build_fs failed\n");
@@ -386,6 +398,7 @@ int jffs2_do_mount_fs(struct jffs2_sb_info *c)
 	return 0;
 
  out_free:
+	jffs2_sum_exit(c);
 #ifndef __ECOS
 	if (jffs2_blocks_use_vmalloc(c))
 #ifdef LOSCFG_KERNEL_VM
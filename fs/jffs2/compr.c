@@ -30,10 +30,10 @@ static uint32_t none_stat_compr_blocks=0,none_stat_decompr_blocks=0,none_stat_co
 /*
  * Return 1 to use this compression
  */
-static int jffs2_is_best_compression(struct jffs2_compressor *this,
+static int jffs2_is_best_compression(int mode, struct jffs2_compressor *this,
 		struct jffs2_compressor *best, uint32_t size, uint32_t bestsize)
 {
-	switch (jffs2_compression_mode) {
+	switch (mode) {
 	case JFFS2_COMPR_MODE_SIZE:
 		if (bestsize > size)
 			return 1;
@@ -54,6 +54,13 @@ static int jffs2_is_best_compression(struct jffs2_compressor *this,
 	return 0;
 }
 
+/* Charge what a (de)compressor has taken since start to its type */
+static void jffs2_compr_time(Atomic64 *ns, char compr, uint64_t start)
+{
+	if ((unsigned char)compr < JFFS2_STATS_COMPR)
+		LOS_Atomic64Add(&ns[(unsigned char)compr], (INT64)(jffs2_now_ns() - start));
+}
+
 /*
  * jffs2_selected_compress:
  * @compr: Explicit compression type to use (ie, JFFS2_COMPR_ZLIB).
@@ -70,13 +77,15 @@ static int jffs2_is_best_compression(struct jffs2_compressor *this,
  * could not be compressed; probably because we couldn't find the requested
  * compression mode.
  */
-static int jffs2_selected_compress(uint8_t compr, unsigned char *data_in,
-		unsigned char **cpage_out, uint32_t *datalen, uint32_t *cdatalen)
+static int jffs2_selected_compress(struct jffs2_sb_info *c, uint8_t compr,
+		unsigned char *data_in, unsigned char **cpage_out,
+		uint32_t *datalen, uint32_t *cdatalen)
 {
 	struct jffs2_compressor *this;
 	int err, ret = JFFS2_COMPR_NONE;
 	uint32_t orig_slen, orig_dlen;
 	unsigned char *output_buf;
+	uint64_t start;
 
 	output_buf = kmalloc(*cdatalen,GFP_KERNEL);
 	if (!output_buf) {
@@ -104,7 +113,9 @@ static int jffs2_selected_compress(uint8_t compr, unsigned char *data_in,
 
 		*datalen  = orig_slen;
 		*cdatalen = orig_dlen;
+		start = jffs2_now_ns();
 		err = this->compress(data_in, output_buf, datalen, cdatalen);
+		jffs2_compr_time(c->stats.compr_ns, this->compr, start);
 
 		spin_lock(&jffs2_compressor_list_lock);
 		this->usecount--;
@@ -126,7 +137,8 @@ static int jffs2_selected_compress(uint8_t compr, unsigned char *data_in,
 	return ret;
 }
 
-/* jffs2_compress:
+/* jffs2_compress_mode:
+ * @mode: JFFS2_COMPR_MODE_XXX to compress with
  * @data_in: Pointer to uncompressed data
  * @cpage_out: Pointer to returned pointer to buffer for compressed data
  * @datalen: On entry, holds the amount of data available for compression.
@@ -144,27 +156,24 @@ static int jffs2_selected_compress(uint8_t compr, unsigned char *data_in,
  * jffs2_compress should compress as much as will fit, and should set
  * *datalen accordingly to show the amount of data which were compressed.
  */
-uint16_t jffs2_compress(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
-			unsigned char *data_in, unsigned char **cpage_out,
-			uint32_t *datalen, uint32_t *cdatalen)
+uint16_t jffs2_compress_mode(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+			     int mode, unsigned char *data_in,
+			     unsigned char **cpage_out,
+			     uint32_t *datalen, uint32_t *cdatalen)
 {
 	int ret = JFFS2_COMPR_NONE;
-	int mode, compr_ret;
+	int compr_ret;
 	struct jffs2_compressor *this, *best=NULL;
 	unsigned char *output_buf = NULL, *tmp_buf;
 	uint32_t orig_slen, orig_dlen;
 	uint32_t best_slen=0, best_dlen=0;
-
-	if (c->mount_opts.override_compr)
-		mode = c->mount_opts.compr;
-	else
-		mode = jffs2_compression_mode;
+	uint64_t start;
 
 	switch (mode) {
 	case JFFS2_COMPR_MODE_NONE:
 		break;
 	case JFFS2_COMPR_MODE_PRIORITY:
-		ret = jffs2_selected_compress(0, data_in, cpage_out, datalen,
+		ret = jffs2_selected_compress(c, 0, data_in, cpage_out, datalen,
 				cdatalen);
 		break;
 	case JFFS2_COMPR_MODE_SIZE:
@@ -202,11 +211,13 @@ uint16_t jffs2_compress(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 			spin_unlock(&jffs2_compressor_list_lock);
 			*datalen  = orig_slen;
 			*cdatalen = orig_dlen;
+			start = jffs2_now_ns();
 			compr_ret = this->compress(data_in, this->compr_buf, datalen, cdatalen);
+			jffs2_compr_time(c->stats.compr_ns, this->compr, start);
 			spin_lock(&jffs2_compressor_list_lock);
 			this->usecount--;
 			if (!compr_ret) {
-				if (((!best_dlen) || jffs2_is_best_compression(this, best, *cdatalen, best_dlen))
+				if (((!best_dlen) || jffs2_is_best_compression(mode, this, best, *cdatalen, best_dlen))
 						&& (*cdatalen < *datalen)) {
 					best_dlen = *cdatalen;
 					best_slen = *datalen;
@@ -229,11 +240,11 @@ uint16_t jffs2_compress(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 		spin_unlock(&jffs2_compressor_list_lock);
 		break;
 	case JFFS2_COMPR_MODE_FORCELZO:
-		ret = jffs2_selected_compress(JFFS2_COMPR_LZO, data_in,
+		ret = jffs2_selected_compress(c, JFFS2_COMPR_LZO, data_in,
 				cpage_out, datalen, cdatalen);
 		break;
 	case JFFS2_COMPR_MODE_FORCEZLIB:
-		ret = jffs2_selected_compress(JFFS2_COMPR_ZLIB, data_in,
+		ret = jffs2_selected_compress(c, JFFS2_COMPR_ZLIB, data_in,
 				cpage_out, datalen, cdatalen);
 		break;
 	default:
@@ -249,11 +260,31 @@ uint16_t jffs2_compress(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 	return ret;
 }
 
+/* jffs2_compress:
+ * As jffs2_compress_mode(), in the mount's compression mode, or failing
+ * that the default one.
+ */
+uint16_t jffs2_compress(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+			unsigned char *data_in, unsigned char **cpage_out,
+			uint32_t *datalen, uint32_t *cdatalen)
+{
+	int mode;
+
+	if (c->mount_opts.override_compr)
+		mode = c->mount_opts.compr;
+	else
+		mode = jffs2_compression_mode;
+
+	return jffs2_compress_mode(c, f, mode, data_in, cpage_out, datalen,
+				   cdatalen);
+}
+
 int jffs2_decompress(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 		     uint16_t comprtype, unsigned char *cdata_in,
 		     unsigned char *data_out, uint32_t cdatalen, uint32_t datalen)
 {
 	struct jffs2_compressor *this;
+	uint64_t start;
 	int ret;
 
 	/* Older code had a bug where it would write non-zero 'usercompr'
@@ -281,7 +312,9 @@ int jffs2_decompress(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 			if (comprtype == this->compr) {
 				this->usecount++;
 				spin_unlock(&jffs2_compressor_list_lock);
+				start = jffs2_now_ns();
 				ret = this->decompress(cdata_in, data_out, cdatalen, datalen);
+				jffs2_compr_time(c->stats.decompr_ns, this->compr, start);
 				spin_lock(&jffs2_compressor_list_lock);
 				if (ret) {
 					pr_warn("Decompressor \"%s\" returned %d\n",
@@ -72,6 +72,11 @@ int jffs2_unregister_compressor(struct jffs2_compressor *comp);
 int jffs2_compressors_init(void);
 int jffs2_compressors_exit(void);
 
+uint16_t jffs2_compress_mode(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+			     int mode, unsigned char *data_in,
+			     unsigned char **cpage_out,
+			     uint32_t *datalen, uint32_t *cdatalen);
+
 uint16_t jffs2_compress(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 			unsigned char *data_in, unsigned char **cpage_out,
 			uint32_t *datalen, uint32_t *cdatalen);
@@ -10,6 +10,7 @@
  *
  */
 
+#include <linux/kernel.h>
 #include <linux/string.h>
 #include <linux/types.h>
 #include <linux/errno.h>
@@ -38,6 +39,7 @@ struct rubin_state {
 	long bit_number;
 	struct pushpull pp;
 	int bit_divider;
+	int div_shift;		/* log2(bit_divider) if it's a power of 2, else -1 */
 	int bits[8];
 };
 
@@ -51,19 +53,37 @@ static inline void init_pushpull(struct pushpull *pp, char *buf,
 	pp->reserve = reserve;
 }
 
-static inline int pushbit(struct pushpull *pp, int bit, int use_reserved)
+/*
+ * Push the low n bits of v, most significant first, a byte at a time.
+ * If they don't all fit, those which do are pushed before failing, just
+ * as they would have been one by one.
+ */
+static inline int pushbits(struct pushpull *pp, unsigned long v, int n,
+			   int use_reserved)
 {
-	if (pp->ofs >= pp->buflen - (use_reserved?0:pp->reserve))
-		return -ENOSPC;
-
-	if (bit)
-		pp->buf[pp->ofs >> 3] |= (1<<(7-(pp->ofs & 7)));
-	else
-		pp->buf[pp->ofs >> 3] &= ~(1<<(7-(pp->ofs & 7)));
-
-	pp->ofs++;
+	unsigned int limit = pp->buflen - (use_reserved?0:pp->reserve);
+	unsigned int avail, take, shift;
+	unsigned char mask, *b;
+	int ret = 0;
+
+	if (pp->ofs + n > limit) {
+		take = limit > pp->ofs ? limit - pp->ofs : 0;
+		v >>= n - take;
+		n = take;
+		ret = -ENOSPC;
+	}
+	while (n) {
+		avail = 8 - (pp->ofs & 7);
+		take = min_t(unsigned int, avail, n);
+		shift = avail - take;
+		mask = ((1U << take) - 1) << shift;
+		b = &pp->buf[pp->ofs >> 3];
+		*b = (*b & ~mask) | (((v >> (n - take)) << shift) & mask);
+		pp->ofs += take;
+		n -= take;
+	}
 
-	return 0;
+	return ret;
 }
 
 static inline int pushedbits(struct pushpull *pp)
@@ -71,14 +91,22 @@ static inline int pushedbits(struct pushpull *pp)
 	return pp->ofs;
 }
 
-static inline int pullbit(struct pushpull *pp)
+/* The next n bits, most significant first */
+static inline unsigned long pullbits(struct pushpull *pp, int n)
 {
-	int bit;
-
-	bit = (pp->buf[pp->ofs >> 3] >> (7-(pp->ofs & 7))) & 1;
+	unsigned long v = 0;
+	unsigned int avail, take;
+
+	while (n) {
+		avail = 8 - (pp->ofs & 7);
+		take = min_t(unsigned int, avail, n);
+		v = (v << take) |
+		    ((pp->buf[pp->ofs >> 3] >> (avail - take)) & ((1U << take) - 1));
+		pp->ofs += take;
+		n -= take;
+	}
 
-	pp->ofs++;
-	return bit;
+	return v;
 }
 
 
@@ -90,30 +118,49 @@ static void init_rubin(struct rubin_state *rs, int div, int *bits)
 	rs->p = (long) (2 * UPPER_BIT_RUBIN);
 	rs->bit_number = (long) 0;
 	rs->bit_divider = div;
+	rs->div_shift = -1;
+	if (!(div & (div - 1)))
+		for (rs->div_shift = 0; (1 << rs->div_shift) < div; rs->div_shift++)
+			;
 
 	for (c=0; c<8; c++)
 		rs->bits[c] = bits[c];
 }
 
 
+/* A * p / (A + B), where A + B is the bit divider. For dynrubin that's 256,
+   and a shift is a lot cheaper than a divide for every bit */
+static inline long rubin_split(struct rubin_state *rs, long A, long B)
+{
+	if (rs->div_shift >= 0)
+		return (long)(((unsigned long)A * rs->p) >> rs->div_shift);
+	return A * rs->p / (A + B);
+}
+
 static int encode(struct rubin_state *rs, long A, long B, int symbol)
 {
 
+	unsigned long out = 0;
 	long i0, i1;
+	int n = 0;
 	int ret;
 
+	/* Gather up the bits which are settled and push them all at once */
 	while ((rs->q >= UPPER_BIT_RUBIN) ||
 	       ((rs->p + rs->q) <= UPPER_BIT_RUBIN)) {
-		rs->bit_number++;
-
-		ret = pushbit(&rs->pp, (rs->q & UPPER_BIT_RUBIN) ? 1 : 0, 0);
-		if (ret)
-			return ret;
+		out = (out << 1) | ((rs->q & UPPER_BIT_RUBIN) ? 1 : 0);
+		n++;
 		rs->q &= LOWER_BITS_RUBIN;
 		rs->q <<= 1;
 		rs->p <<= 1;
 	}
-	i0 = A * rs->p / (A + B);
+	if (n) {
+		rs->bit_number += n;
+		ret = pushbits(&rs->pp, out, n, 0);
+		if (ret)
+			return ret;
+	}
+	i0 = rubin_split(rs, A, B);
 	if (i0 <= 0)
 		i0 = 1;
 
@@ -134,14 +181,9 @@ static int encode(struct rubin_state *rs, long A, long B, int symbol)
 
 static void end_rubin(struct rubin_state *rs)
 {
-
-	int i;
-
-	for (i = 0; i < RUBIN_REG_SIZE; i++) {
-		pushbit(&rs->pp, (UPPER_BIT_RUBIN & rs->q) ? 1 : 0, 1);
-		rs->q &= LOWER_BITS_RUBIN;
-		rs->q <<= 1;
-	}
+	/* The register, top bit first */
+	pushbits(&rs->pp, rs->q, RUBIN_REG_SIZE, 1);
+	rs->q = 0;
 }
 
 
@@ -150,80 +192,10 @@ static void init_decode(struct rubin_state *rs, int div, int *bits)
 	init_rubin(rs, div, bits);
 
 	/* behalve lower */
-	rs->rec_q = 0;
-
-	for (rs->bit_number = 0; rs->bit_number++ < RUBIN_REG_SIZE;
-	     rs->rec_q = rs->rec_q * 2 + (long) (pullbit(&rs->pp)))
-		;
+	rs->rec_q = pullbits(&rs->pp, RUBIN_REG_SIZE);
+	rs->bit_number = RUBIN_REG_SIZE;
 }
 
-static void __do_decode(struct rubin_state *rs, unsigned long p,
-			unsigned long q)
-{
-	register unsigned long lower_bits_rubin = LOWER_BITS_RUBIN;
-	unsigned long rec_q;
-	int c, bits = 0;
-
-	/*
-	 * First, work out how many bits we need from the input stream.
-	 * Note that we have already done the initial check on this
-	 * loop prior to calling this function.
-	 */
-	do {
-		bits++;
-		q &= lower_bits_rubin;
-		q <<= 1;
-		p <<= 1;
-	} while ((q >= UPPER_BIT_RUBIN) || ((p + q) <= UPPER_BIT_RUBIN));
-
-	rs->p = p;
-	rs->q = q;
-
-	rs->bit_number += bits;
-
-	/*
-	 * Now get the bits.  We really want this to be "get n bits".
-	 */
-	rec_q = rs->rec_q;
-	do {
-		c = pullbit(&rs->pp);
-		rec_q &= lower_bits_rubin;
-		rec_q <<= 1;
-		rec_q += c;
-	} while (--bits);
-	rs->rec_q = rec_q;
-}
-
-static int decode(struct rubin_state *rs, long A, long B)
-{
-	unsigned long p = rs->p, q = rs->q;
-	long i0, threshold;
-	int symbol;
-
-	if (q >= UPPER_BIT_RUBIN || ((p + q) <= UPPER_BIT_RUBIN))
-		__do_decode(rs, p, q);
-
-	i0 = A * rs->p / (A + B);
-	if (i0 <= 0)
-		i0 = 1;
-
-	if (i0 >= rs->p)
-		i0 = rs->p - 1;
-
-	threshold = rs->q + i0;
-	symbol = rs->rec_q >= threshold;
-	if (rs->rec_q >= threshold) {
-		rs->q += i0;
-		i0 = rs->p - i0;
-	}
-
-	rs->p = i0;
-
-	return symbol;
-}
-
-
-
 static int out_byte(struct rubin_state *rs, unsigned char byte)
 {
 	int i, ret;
@@ -243,13 +215,57 @@ static int out_byte(struct rubin_state *rs, unsigned char byte)
 	return 0;
 }
 
+/*
+ * Decode a byte, least significant bit first. The coder state lives in
+ * registers for the whole byte, and whenever the interval has narrowed
+ * far enough for bits to be settled, all the input bits that takes are
+ * pulled in one go.
+ */
 static int in_byte(struct rubin_state *rs)
 {
-	int i, result = 0, bit_divider = rs->bit_divider;
+	unsigned long p = rs->p, q = rs->q, rec_q = rs->rec_q;
+	int i, bits, result = 0;
+	long A, i0;
+
+	for (i = 0; i < 8; i++) {
+		if (q >= UPPER_BIT_RUBIN || ((p + q) <= UPPER_BIT_RUBIN)) {
+			bits = 0;
+			do {
+				bits++;
+				q &= LOWER_BITS_RUBIN;
+				q <<= 1;
+				p <<= 1;
+			} while ((q >= UPPER_BIT_RUBIN) || ((p + q) <= UPPER_BIT_RUBIN));
+
+			/* Shifting them in one at a time would keep the
+			   register at RUBIN_REG_SIZE bits */
+			rec_q = ((rec_q << bits) | pullbits(&rs->pp, bits)) &
+				(2 * UPPER_BIT_RUBIN - 1);
+			rs->bit_number += bits;
+		}
+
+		A = rs->bit_divider - rs->bits[i];
+		if (rs->div_shift >= 0)
+			i0 = (long)(((unsigned long)A * p) >> rs->div_shift);
+		else
+			i0 = A * p / rs->bit_divider;
+		if (i0 <= 0)
+			i0 = 1;
+
+		if (i0 >= p)
+			i0 = p - 1;
+
+		if (rec_q >= q + i0) {
+			q += i0;
+			i0 = p - i0;
+			result |= 1 << i;
+		}
+		p = i0;
+	}
 
-	for (i = 0; i < 8; i++)
-		result |= decode(rs, bit_divider - rs->bits[i],
-				 rs->bits[i]) << i;
+	rs->p = p;
+	rs->q = q;
+	rs->rec_q = rec_q;
 
 	return result;
 }
@@ -16,6 +16,7 @@
 #include <linux/slab.h>
 #include <mtd_dev.h>
 #include "los_crc32.h"
+#include "los_task.h"
 #include "nodelist.h"
 #include "debug.h"
 
@@ -63,9 +64,9 @@ __jffs2_dbg_acct_sanity_check(struct jffs2_sb_info *c,
 void
 __jffs2_dbg_fragtree_paranoia_check(struct jffs2_inode_info *f)
 {
-	mutex_lock(&f->sem);
+	jffs2_inode_lock_shared(f);
 	__jffs2_dbg_fragtree_paranoia_check_nolock(f);
-	mutex_unlock(&f->sem);
+	jffs2_inode_unlock_shared(f);
 }
 
 void
@@ -691,9 +692,9 @@ __jffs2_dbg_dump_block_lists_nolock(struct jffs2_sb_info *c)
 void
 __jffs2_dbg_dump_fragtree(struct jffs2_inode_info *f)
 {
-	mutex_lock(&f->sem);
+	jffs2_inode_lock_shared(f);
 	jffs2_dbg_dump_fragtree_nolock(f);
-	mutex_unlock(&f->sem);
+	jffs2_inode_unlock_shared(f);
 }
 
 void
@@ -861,3 +862,147 @@ __jffs2_dbg_dump_node(struct jffs2_sb_info *c, uint32_t ofs)
 	}
 }
 #endif /* JFFS2_DBG_DUMPS || JFFS2_DBG_PARANOIA_CHECKS */
+
+void jffs2_dump_lat_hist(const char *name, const struct jffs2_lat_hist *h)
+{
+	uint32_t count[JFFS2_LAT_HIST_BUCKETS];
+	uint32_t samples = 0;
+	uint64_t total_ns = (uint64_t)LOS_Atomic64Read((Atomic64 *)&h->total_ns);
+	uint64_t max_ns = (uint64_t)LOS_Atomic64Read((Atomic64 *)&h->max_ns);
+	int i;
+
+	for (i = 0; i < JFFS2_LAT_HIST_BUCKETS; i++) {
+		count[i] = (uint32_t)LOS_AtomicRead((Atomic *)&h->count[i]);
+		samples += count[i];
+	}
+
+	PRINTK("%s: %u samples, avg %llu us, max %llu us\n", name, samples,
+	       samples ? total_ns / samples / 1000 : 0, max_ns / 1000);
+	for (i = 0; i < JFFS2_LAT_HIST_BUCKETS; i++) {
+		if (!count[i])
+			continue;
+		if (i == JFFS2_LAT_HIST_BUCKETS - 1)
+			PRINTK("  >= %8u us: %u\n", 1U << i, count[i]);
+		else
+			PRINTK("  < %9u us: %u\n", 2U << i, count[i]);
+	}
+}
+
+#if JFFS2_TRACE_ENTRIES
+/* Log an event in the mount's trace ring. Nothing is locked: each event
+   gets its own slot from the atomic trace_seq, and whoever reads the ring
+   can tell an entry that's being written, or has been overwritten, by
+   its seq */
+void jffs2_trace(struct jffs2_sb_info *c, uint16_t event, uint32_t a, uint32_t b)
+{
+	struct jffs2_trace_ent *e;
+	uint32_t seq;
+
+	if (!c->trace)
+		return;
+
+	seq = (uint32_t)LOS_AtomicIncRet(&c->trace_seq);
+	e = &c->trace[(seq - 1) & (JFFS2_TRACE_ENTRIES - 1)];
+	e->seq = 0;
+	__sync_synchronize();
+	e->ns = jffs2_now_ns();
+	e->event = event;
+	e->task = (uint16_t)LOS_CurTaskIDGet();
+	e->a = a;
+	e->b = b;
+	__sync_synchronize();
+	e->seq = seq;
+}
+#endif
+
+static const char *jffs2_trace_names[] = {
+	[JFFS2_TR_GC_BLOCK] = "gc_block",
+	[JFFS2_TR_GC_NODE] = "gc_node",
+	[JFFS2_TR_ERASE] = "erase",
+	[JFFS2_TR_ERASE_FAIL] = "erase_fail",
+	[JFFS2_TR_NEXTBLOCK] = "nextblock",
+	[JFFS2_TR_OBSOLETE] = "obsolete",
+	[JFFS2_TR_RESERVE] = "reserve",
+};
+
+/* Copy one slot of the trace ring, the way a seqlock is read: if its seq
+   isn't the same after the copy as before, a writer had it meanwhile and
+   the copy may be half one event and half another. Returns the seq of
+   what was copied, or 0 if it's no good */
+uint32_t jffs2_trace_copy(struct jffs2_sb_info *c, uint32_t slot, struct jffs2_trace_ent *e)
+{
+	volatile struct jffs2_trace_ent *t = &c->trace[slot];
+	uint32_t seq;
+
+	seq = t->seq;
+	__sync_synchronize();
+	e->ns = t->ns;
+	e->event = t->event;
+	e->task = t->task;
+	e->a = t->a;
+	e->b = t->b;
+	__sync_synchronize();
+	if (t->seq != seq)
+		seq = 0;
+	e->seq = seq;
+	return seq;
+}
+
+/* Print what's in the trace ring, oldest first */
+void jffs2_dump_trace(struct jffs2_sb_info *c)
+{
+	struct jffs2_trace_ent e;
+	uint32_t seq, s;
+
+	if (!c->trace) {
+		PRINTK("no trace\n");
+		return;
+	}
+
+	seq = (uint32_t)LOS_AtomicRead(&c->trace_seq);
+	s = seq > JFFS2_TRACE_ENTRIES ? seq - JFFS2_TRACE_ENTRIES + 1 : 1;
+	for (; s && s <= seq; s++) {
+		if (jffs2_trace_copy(c, (s - 1) & (JFFS2_TRACE_ENTRIES - 1), &e) != s)
+			continue;
+		PRINTK("%llu.%06llu task %u %s 0x%08x %u\n", e.ns / 1000000000,
+		       e.ns / 1000 % 1000000, e.task,
+		       e.event < ARRAY_SIZE(jffs2_trace_names) && jffs2_trace_names[e.event] ?
+		       jffs2_trace_names[e.event] : "?", e.a, e.b);
+	}
+}
+
+void jffs2_dump_stats(struct jffs2_sb_info *c)
+{
+	struct jffs2_stats *st = &c->stats;
+	uint32_t hits = (uint32_t)LOS_AtomicRead(&st->icache_hits);
+	uint32_t misses = (uint32_t)LOS_AtomicRead(&st->icache_misses);
+	int i;
+
+	PRINTK("mounted%s in %llu us, %u bytes of nodes not CRC-checked yet\n",
+	       jffs2_is_readonly(c) ? " read-only" : "", st->mount_ns / 1000, c->unchecked_size);
+	jffs2_dump_lat_hist("reserve_space", &st->resv_lat);
+	jffs2_dump_lat_hist("gc_pass", &st->gc_lat);
+	jffs2_dump_lat_hist("erase", &st->erase_lat);
+	jffs2_dump_lat_hist("read_inode_range", &st->read_lat);
+	jffs2_dump_lat_hist("write_inode_range", &st->write_lat);
+	jffs2_dump_lat_hist("read_inode", &st->iread_lat);
+
+	PRINTK("read %llu bytes, written %llu bytes, GC moved %llu bytes\n",
+	       LOS_Atomic64Read(&st->read_bytes), LOS_Atomic64Read(&st->write_bytes),
+	       LOS_Atomic64Read(&st->gc_bytes));
+	PRINTK("%d erase failures\n", LOS_AtomicRead(&st->erase_failures));
+	PRINTK("inode cache: %u hits, %u misses (%u%%), %u evictions, %u rereads\n",
+	       hits, misses, (hits + misses) ? (uint32_t)((uint64_t)hits * 100 / (hits + misses)) : 0,
+	       c->icache_evictions, c->icache_rereads);
+	PRINTK("read-ahead: %u hits\n", c->ra_hits);
+	for (i = 0; i < JFFS2_STATS_COMPR; i++) {
+		if (!LOS_Atomic64Read(&st->compr_ns[i]) && !LOS_Atomic64Read(&st->decompr_ns[i]))
+			continue;
+		PRINTK("compression type %d: compress %llu us, decompress %llu us\n", i,
+		       LOS_Atomic64Read(&st->compr_ns[i]) / 1000,
+		       LOS_Atomic64Read(&st->decompr_ns[i]) / 1000);
+	}
+	PRINTK("GC recompressed %d cold nodes, %llu bytes down to %llu\n",
+	       LOS_AtomicRead(&st->recompr_nodes), LOS_Atomic64Read(&st->recompr_in),
+	       LOS_Atomic64Read(&st->recompr_out));
+}
@@ -278,6 +278,11 @@ __jffs2_dbg_dump_node(struct jffs2_sb_info *c, uint32_t ofs);
 #define jffs2_dbg_acct_sanity_check_nolock(c, jeb)
 #endif /* !JFFS2_DBG_SANITY_CHECKS */
 
+void jffs2_dump_lat_hist(const char *name, const struct jffs2_lat_hist *h);
+void jffs2_dump_stats(struct jffs2_sb_info *c);
+uint32_t jffs2_trace_copy(struct jffs2_sb_info *c, uint32_t slot, struct jffs2_trace_ent *e);
+void jffs2_dump_trace(struct jffs2_sb_info *c);
+
 #ifdef __cplusplus
 #if __cplusplus
 }
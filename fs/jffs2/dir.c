@@ -38,7 +38,7 @@ struct jffs2_inode *jffs2_lookup(struct jffs2_inode *dir_i, const unsigned char
 
 	dir_f = JFFS2_INODE_INFO(dir_i);
 
-	mutex_lock(&dir_f->sem);
+	jffs2_inode_lock_shared(dir_f);
 
 	/* NB: The 2.2 backport will need to explicitly check for '.' and '..' here */
 	for (fd_list = dir_f->dents; fd_list && fd_list->nhash <= hash; fd_list = fd_list->next) {
@@ -51,7 +51,7 @@ struct jffs2_inode *jffs2_lookup(struct jffs2_inode *dir_i, const unsigned char
 	}
 	if (fd)
 		ino = fd->ino;
-	mutex_unlock(&dir_f->sem);
+	jffs2_inode_unlock_shared(dir_f);
 	if (ino) {
 		inode = jffs2_iget(dir_i->i_sb, ino);
 		if (IS_ERR(inode))
@@ -69,12 +69,20 @@ int jffs2_unlink(struct jffs2_inode *dir_i, struct jffs2_inode *d_inode, const u
 	int ret;
 	uint32_t now = Jffs2CurSec();
 
+	/* Let queued writes land first, rather than after it's gone */
+	jffs2_aio_wait_inode(c, dead_f);
 	ret = jffs2_do_unlink(c, dir_f, (const char *)d_name,
 		strlen((char *)d_name), dead_f, now);
 	if (dead_f->inocache)
 		d_inode->i_nlink = dead_f->inocache->pino_nlink;
 	if (!ret)
 		dir_i->i_mtime = dir_i->i_ctime = now;
+	/* Nobody can read back what's cached now, so don't write it */
+	if (!ret && !d_inode->i_nlink) {
+		jffs2_inode_lock(dead_f);
+		jffs2_wb_discard(c, dead_f);
+		jffs2_inode_unlock(dead_f);
+	}
 	return ret;
 }
 
@@ -96,9 +104,9 @@ int jffs2_link(struct jffs2_inode *old_d_inode, struct jffs2_inode *dir_i, const
 						strlen((char *)d_name), now);
 
 	if (!ret) {
-		mutex_lock(&f->sem);
+		jffs2_inode_lock(f);
 		old_d_inode->i_nlink = ++f->inocache->pino_nlink;
-		mutex_unlock(&f->sem);
+		jffs2_inode_unlock(f);
 		dir_i->i_mtime = dir_i->i_ctime = now;
 	}
 	return ret;
@@ -166,7 +174,7 @@ int jffs2_symlink(struct jffs2_inode *dir_i, struct jffs2_inode **d_inode, const
 
 	if (IS_ERR(fn)) {
 		/* Eeek. Wave bye bye */
-		mutex_unlock(&f->sem);
+		jffs2_inode_unlock(f);
 		jffs2_complete_reservation(c);
 		ret = PTR_ERR(fn);
 		goto fail;
@@ -177,7 +185,7 @@ int jffs2_symlink(struct jffs2_inode *dir_i, struct jffs2_inode **d_inode, const
 	f->target = (unsigned char *)malloc(targetlen + 1);
 	if (!f->target) {
 		pr_warn("Can't allocate %d bytes of memory\n", targetlen + 1);
-		mutex_unlock(&f->sem);
+		jffs2_inode_unlock(f);
 		jffs2_complete_reservation(c);
 		ret = -ENOMEM;
 		goto fail;
@@ -187,7 +195,7 @@ int jffs2_symlink(struct jffs2_inode *dir_i, struct jffs2_inode **d_inode, const
 	if (ret != EOK) {
 		(void)free(f->target);
 		f->target = NULL;
-		mutex_unlock(&f->sem);
+		jffs2_inode_unlock(f);
 		jffs2_complete_reservation(c);
 		goto fail;
 	}
@@ -199,7 +207,7 @@ int jffs2_symlink(struct jffs2_inode *dir_i, struct jffs2_inode **d_inode, const
 	   obsoleted by the first data write
 	*/
 	f->metadata = fn;
-	mutex_unlock(&f->sem);
+	jffs2_inode_unlock(f);
 
 	jffs2_complete_reservation(c);
 
@@ -217,7 +225,7 @@ int jffs2_symlink(struct jffs2_inode *dir_i, struct jffs2_inode **d_inode, const
 	}
 
 	dir_f = JFFS2_INODE_INFO(dir_i);
-	mutex_lock(&dir_f->sem);
+	jffs2_inode_lock(dir_f);
 
 	rd->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
 	rd->nodetype = cpu_to_je16(JFFS2_NODETYPE_DIRENT);
@@ -240,7 +248,7 @@ int jffs2_symlink(struct jffs2_inode *dir_i, struct jffs2_inode **d_inode, const
 		   as if it were the final unlink() */
 		jffs2_complete_reservation(c);
 		jffs2_free_raw_dirent(rd);
-		mutex_unlock(&dir_f->sem);
+		jffs2_inode_unlock(dir_f);
 		ret = PTR_ERR(fd);
 		goto fail;
 	}
@@ -253,7 +261,7 @@ int jffs2_symlink(struct jffs2_inode *dir_i, struct jffs2_inode **d_inode, const
 	   one if necessary. */
 	jffs2_add_fd_to_list(c, fd, &dir_f->dents);
 
-	mutex_unlock(&dir_f->sem);
+	jffs2_inode_unlock(dir_f);
 	jffs2_complete_reservation(c);
 
 	*d_inode = inode;
@@ -318,7 +326,7 @@ int jffs2_mkdir(struct jffs2_inode *dir_i, const unsigned char *d_name, int mode
 
 	if (IS_ERR(fn)) {
 		/* Eeek. Wave bye bye */
-		mutex_unlock(&f->sem);
+		jffs2_inode_unlock(f);
 		jffs2_complete_reservation(c);
 
 		ret = PTR_ERR(fn);
@@ -328,7 +336,7 @@ int jffs2_mkdir(struct jffs2_inode *dir_i, const unsigned char *d_name, int mode
 	   obsoleted by the first data write
 	*/
 	f->metadata = fn;
-	mutex_unlock(&f->sem);
+	jffs2_inode_unlock(f);
 
 	jffs2_complete_reservation(c);
 
@@ -346,7 +354,7 @@ int jffs2_mkdir(struct jffs2_inode *dir_i, const unsigned char *d_name, int mode
 	}
 
 	dir_f = JFFS2_INODE_INFO(dir_i);
-	mutex_lock(&dir_f->sem);
+	jffs2_inode_lock(dir_f);
 
 	rd->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
 	rd->nodetype = cpu_to_je16(JFFS2_NODETYPE_DIRENT);
@@ -369,7 +377,7 @@ int jffs2_mkdir(struct jffs2_inode *dir_i, const unsigned char *d_name, int mode
 		   as if it were the final unlink() */
 		jffs2_complete_reservation(c);
 		jffs2_free_raw_dirent(rd);
-		mutex_unlock(&dir_f->sem);
+		jffs2_inode_unlock(dir_f);
 		inode->i_nlink = 0;
 		ret = PTR_ERR(fd);
 		goto fail;
@@ -383,7 +391,7 @@ int jffs2_mkdir(struct jffs2_inode *dir_i, const unsigned char *d_name, int mode
 	   one if necessary. */
 	jffs2_add_fd_to_list(c, fd, &dir_f->dents);
 
-	mutex_unlock(&dir_f->sem);
+	jffs2_inode_unlock(dir_f);
 	jffs2_complete_reservation(c);
 	*new_i = inode;
 
@@ -428,15 +436,25 @@ int jffs2_rename (struct jffs2_inode *old_dir_i, struct jffs2_inode *d_inode, co
 	struct jffs2_sb_info *c = JFFS2_SB_INFO(old_dir_i->i_sb);
 	uint8_t type;
 	uint32_t now;
+	int split = 0;
 
 	/* XXX: This is ugly */
 	type = (d_inode->i_mode & S_IFMT) >> 12;
 	if (!type) type = DT_REG;
 
 	now = Jffs2CurSec();
-	ret = jffs2_do_link(c, JFFS2_INODE_INFO(new_dir_i),
-				d_inode->i_ino, type,
+
+	/* Both dirents in one go if they fit, else link then unlink */
+	ret = jffs2_do_rename(c, JFFS2_INODE_INFO(old_dir_i),
+				(const char *)old_d_name, strlen((char *)old_d_name),
+				JFFS2_INODE_INFO(new_dir_i), d_inode->i_ino, type,
 				(const char *)new_d_name, strlen((char *)new_d_name), now);
+	if (ret == -EAGAIN) {
+		split = 1;
+		ret = jffs2_do_link(c, JFFS2_INODE_INFO(new_dir_i),
+					d_inode->i_ino, type,
+					(const char *)new_d_name, strlen((char *)new_d_name), now);
+	}
 
 	if (ret)
 		return ret;
@@ -449,18 +467,19 @@ int jffs2_rename (struct jffs2_inode *old_dir_i, struct jffs2_inode *d_inode, co
 	}
 
 	/* Unlink the original */
-	ret = jffs2_do_unlink(c, JFFS2_INODE_INFO(old_dir_i),
-				(const char *)old_d_name, strlen((char *)old_d_name), NULL, now);
+	if (split)
+		ret = jffs2_do_unlink(c, JFFS2_INODE_INFO(old_dir_i),
+					(const char *)old_d_name, strlen((char *)old_d_name), NULL, now);
 
 	/* We don't touch inode->i_nlink */
 
 	if (ret) {
 		/* Oh shit. We really ought to make a single node which can do both atomically */
 		struct jffs2_inode_info *f = JFFS2_INODE_INFO(d_inode);
-		mutex_lock(&f->sem);
+		jffs2_inode_lock(f);
 		if (f->inocache)
 			d_inode->i_nlink = f->inocache->pino_nlink++;
-		mutex_unlock(&f->sem);
+		jffs2_inode_unlock(f);
 
 		pr_notice("%s(): Link succeeded, unlink failed (err %d). You now have a hard link\n",
 			  __func__, ret);
@@ -508,7 +527,7 @@ int jffs2_create(struct jffs2_inode *dir_i, const unsigned char *d_name, int mod
 	   lockdep gets unhappy (although it's a false positive;
 	   nothing else will be looking at this inode yet so there's
 	   no chance of AB-BA deadlock involving its f->sem). */
-	mutex_unlock(&f->sem);
+	jffs2_inode_unlock(f);
 	ret = jffs2_do_create(c, dir_f, f, ri,
 				(const char *)d_name,
 				strlen((char *)d_name));
@@ -543,7 +562,7 @@ int jffs2_readdir(struct jffs2_inode *inode, off_t *offset, off_t *int_off, stru
 
 	f = JFFS2_INODE_INFO(inode);
 
-	mutex_lock(&f->sem);
+	jffs2_inode_lock_shared(f);
 	for (fd = f->dents; fd; fd = fd->next) {
 		if (curofs++ < *int_off) {
 			D2(printk
@@ -570,7 +589,7 @@ int jffs2_readdir(struct jffs2_inode *inode, off_t *offset, off_t *int_off, stru
 		break;
 	}
 
-	mutex_unlock(&f->sem);
+	jffs2_inode_unlock_shared(f);
 
 	if (fd == NULL) {
 		D2(printk(KERN_DEBUG "reached the end of the directory\n"));
@@ -33,8 +33,27 @@ static void jffs2_erase_block(struct jffs2_sb_info *c,
 {
 	int ret;
 	uint64_t bad_offset = 0;
-
+	uint64_t start;
+
+	/* Nodes may have been left obsolete only in RAM because of what this
+	   block holds, such as a deletion dirent. Get them marked first */
+	jffs2_flush_obsolete(c);
+	/* Nothing of this block may still be waiting to be programmed. If
+	   that fails, what was waiting has been written off and dropped, so
+	   it's just as gone */
+	(void)jffs2_flush_wcbuf(c);
+	/* Nor may anything read ahead from it outlive it */
+	jffs2_ra_drop(c, jeb);
+
+	start = jffs2_now_ns();
 	ret = c->mtd->erase(c->mtd, jeb->offset, c->sector_size, &bad_offset);
+	jffs2_lat_hist_add(&c->stats.erase_lat, jffs2_now_ns() - start);
+	if (ret) {
+		LOS_AtomicInc(&c->stats.erase_failures);
+		jffs2_trace(c, JFFS2_TR_ERASE_FAIL, jeb->offset, -ret);
+	} else {
+		jffs2_trace(c, JFFS2_TR_ERASE, jeb->offset, (jffs2_now_ns() - start) / 1000);
+	}
 	if (!ret) {
 		jffs2_erase_succeeded(c, jeb);
 		return;
@@ -239,6 +258,10 @@ void jffs2_free_jeb_node_refs(struct jffs2_sb_info *c, struct jffs2_eraseblock *
 	jffs2_dbg(1, "Freeing all node refs for eraseblock offset 0x%08x\n",
 		  jeb->offset);
 
+	/* No need to mark anything here obsolete on the flash any more */
+	jffs2_drop_obsolete(c, jeb);
+	jffs2_obsd_drop(c, jeb);
+
 	block = ref = jeb->first_node;
 
 	while (ref) {
@@ -18,6 +18,9 @@
 #include "capability_type.h"
 #include "capability_api.h"
 
+/* Bytes of unused inodes on the LRUs of all mounts */
+static uint32_t jffs2_icache_total_bytes = 0;
+
 int jffs2_setattr (struct jffs2_inode *inode, struct IATTR *attr)
 {
 	struct jffs2_full_dnode *old_metadata, *new_metadata;
@@ -31,21 +34,40 @@ int jffs2_setattr (struct jffs2_inode *inode, struct IATTR *attr)
 	uint32_t alloclen;
 	int ret;
 	int alloc_type = ALLOC_NORMAL;
+	int lazy;
 
 	jffs2_dbg(1, "%s(): ino #%lu\n", __func__, inode->i_ino);
+	/* Queued writes carry the attributes they were submitted with, so
+	   let them land before we change any. Cached data has to go out too
+	   if we're truncating, so the truncation applies to it */
+	jffs2_aio_wait_inode(c, f);
+	if (attr->attr_chg_valid & CHG_SIZE) {
+		ret = jffs2_wb_flush(c, f);
+		if (ret) {
+			return ret;
+		}
+	}
+
 	ri = jffs2_alloc_raw_inode();
 	if (!ri) {
 		return -ENOMEM;
 	}
 
-	ret = jffs2_reserve_space(c, sizeof(*ri), &alloclen, ALLOC_NORMAL, JFFS2_SUMMARY_INODE_SIZE);
-
-	if (ret) {
-		jffs2_free_raw_inode(ri);
-		return ret;
-	}
-	mutex_lock(&f->sem);
 	ivalid = attr->attr_chg_valid;
+	/* With lazy_attr, attribute-only changes to these are just kept in
+	   core, so there's nothing to make room for. (Others keep their data
+	   in the metadata node; leave those be) */
+	lazy = c->mount_opts.lazy_attr && !(ivalid & CHG_SIZE) &&
+		(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode));
+	if (!lazy) {
+		ret = jffs2_reserve_space(c, sizeof(*ri), &alloclen, ALLOC_NORMAL,
+					  JFFS2_SUMMARY_INODE_SIZE);
+		if (ret) {
+			jffs2_free_raw_inode(ri);
+			return ret;
+		}
+	}
+	jffs2_inode_lock(f);
 	tmp_mode = inode->i_mode;
 
 	ri->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
@@ -60,9 +82,10 @@ int jffs2_setattr (struct jffs2_inode *inode, struct IATTR *attr)
 
 	if (ivalid & CHG_UID) {
 		if (((c_uid != inode->i_uid) || (attr->attr_chg_uid != inode->i_uid)) && (!IsCapPermit(CAP_CHOWN))) {
-			jffs2_complete_reservation(c);
+			if (!lazy)
+				jffs2_complete_reservation(c);
 			jffs2_free_raw_inode(ri);
-			mutex_unlock(&f->sem);
+			jffs2_inode_unlock(f);
 			return -EPERM;
 		} else {
 			ri->uid = cpu_to_je16(attr->attr_chg_uid);
@@ -71,9 +94,10 @@ int jffs2_setattr (struct jffs2_inode *inode, struct IATTR *attr)
 
 	if (ivalid & CHG_GID) {
 		if (((c_gid != inode->i_gid) || (attr->attr_chg_gid != inode->i_gid)) && (!IsCapPermit(CAP_CHOWN))) {
-			jffs2_complete_reservation(c);
+			if (!lazy)
+				jffs2_complete_reservation(c);
 			jffs2_free_raw_inode(ri);
-			mutex_unlock(&f->sem);
+			jffs2_inode_unlock(f);
 			return -EPERM;
 		} else {
 			ri->gid = cpu_to_je16(attr->attr_chg_gid);
@@ -82,9 +106,10 @@ int jffs2_setattr (struct jffs2_inode *inode, struct IATTR *attr)
 
 	if (ivalid & CHG_MODE) {
 		if (!IsCapPermit(CAP_FOWNER) && (c_uid != inode->i_uid)) {
-			jffs2_complete_reservation(c);
+			if (!lazy)
+				jffs2_complete_reservation(c);
 			jffs2_free_raw_inode(ri);
-			mutex_unlock(&f->sem);
+			jffs2_inode_unlock(f);
 			return -EPERM;
 		} else {
 			attr->attr_chg_mode  &= ~S_IFMT; // delete file type
@@ -132,11 +157,28 @@ int jffs2_setattr (struct jffs2_inode *inode, struct IATTR *attr)
 	}
 	ri->node_crc = cpu_to_je32(crc32(0, ri, (sizeof(*ri)-8)));
 	ri->data_crc = cpu_to_je32(0);
+
+	if (lazy) {
+		/* Just remember it. It goes out with the next data node for
+		   this inode, or on its own from jffs2_wb_flush() */
+		inode->i_atime = je32_to_cpu(ri->atime);
+		inode->i_ctime = je32_to_cpu(ri->ctime);
+		inode->i_mtime = je32_to_cpu(ri->mtime);
+		inode->i_mode = jemode_to_cpu(ri->mode);
+		inode->i_uid = je16_to_cpu(ri->uid);
+		inode->i_gid = je16_to_cpu(ri->gid);
+		jffs2_wb_set_attr(f, ri);
+		jffs2_wb_attr_dirty(c, f, 1);
+		jffs2_free_raw_inode(ri);
+		jffs2_inode_unlock(f);
+		return 0;
+	}
+
 	new_metadata = jffs2_write_dnode(c, f, ri, NULL, 0, alloc_type);
 	if (IS_ERR(new_metadata)) {
 		jffs2_complete_reservation(c);
 		jffs2_free_raw_inode(ri);
-		mutex_unlock(&f->sem);
+		jffs2_inode_unlock(f);
 		return PTR_ERR(new_metadata);
 	}
 	/* It worked. Update the inode */
@@ -146,6 +188,11 @@ int jffs2_setattr (struct jffs2_inode *inode, struct IATTR *attr)
 	inode->i_mode = jemode_to_cpu(ri->mode);
 	inode->i_uid = je16_to_cpu(ri->uid);
 	inode->i_gid = je16_to_cpu(ri->gid);
+	/* ...which now has all of it on the flash. A cached page mustn't
+	   take it back to what it was when the page was dirtied */
+	if (f->attr_dirty)
+		jffs2_wb_attr_dirty(c, f, 0);
+	jffs2_wb_set_attr(f, ri);
 
 	old_metadata = f->metadata;
 	if (ivalid & CHG_SIZE && inode->i_size > attr->attr_chg_size)
@@ -164,7 +211,7 @@ int jffs2_setattr (struct jffs2_inode *inode, struct IATTR *attr)
 	}
 	jffs2_free_raw_inode(ri);
 
-	mutex_unlock(&f->sem);
+	jffs2_inode_unlock(f);
 	jffs2_complete_reservation(c);
 
 	/* We have to do the truncate_setsize() without f->sem held, since
@@ -179,6 +226,34 @@ int jffs2_setattr (struct jffs2_inode *inode, struct IATTR *attr)
 	return 0;
 }
 
+/* Make sure everything written so far is actually on the flash */
+int jffs2_fsync(struct jffs2_inode *inode)
+{
+	struct jffs2_sb_info *c = JFFS2_SB_INFO(inode->i_sb);
+	struct jffs2_inode_info *f = JFFS2_INODE_INFO(inode);
+	int ret;
+
+	jffs2_aio_wait_inode(c, f);
+	ret = jffs2_wb_flush(c, f);
+	if (ret)
+		return ret;
+	/* An unlink or overwrite isn't durable until the nodes it obsoleted
+	   are marked */
+	jffs2_flush_obsolete(c);
+	ret = jffs2_flush_wcbuf(c);
+
+	/* Some of it may have been lost when an earlier flush of the
+	   write-combining buffer failed. Say so, once */
+	spin_lock(&c->inocache_lock);
+	if (f->inocache && (f->inocache->flags & INO_FLAGS_WRITE_ERR)) {
+		f->inocache->flags &= ~INO_FLAGS_WRITE_ERR;
+		if (!ret)
+			ret = -EIO;
+	}
+	spin_unlock(&c->inocache_lock);
+	return ret;
+}
+
 static void jffs2_clear_inode (struct jffs2_inode *inode)
 {
 	/* We can forget about this inode for now - drop all
@@ -187,6 +262,7 @@ static void jffs2_clear_inode (struct jffs2_inode *inode)
 	struct jffs2_sb_info *c = JFFS2_SB_INFO(inode->i_sb);
 	struct jffs2_inode_info *f = JFFS2_INODE_INFO(inode);
 
+	jffs2_wb_discard(c, f);
 	jffs2_do_clear_inode(c, f);
 }
 
@@ -220,11 +296,109 @@ struct jffs2_inode *new_inode(struct super_block *sb)
 	inode->i_ino = 1;
 	inode->i_nlink = 1;    // Let JFFS2 manage the link count
 	inode->i_size = 0;
+	inode->i_count = 1;
 	LOS_ListInit((&(inode->i_hashlist)));
+	LOS_ListInit((&(inode->i_lru)));
+	LOS_ListInit((&(inode->jffs2_i.wb_list)));
 
 	return inode;
 }
 
+/*
+ * In-core inode cache.
+ *
+ * An inode stays in the hash for as long as it's referenced. Once the last
+ * reference to a linked inode is dropped we keep it around on the LRU, in
+ * case it's wanted again, until the unused inodes of this mount (or of all
+ * mounts together) add up to more than the budget. Then the oldest are
+ * thrown away; their inocache and raw node refs stay, so they can be read
+ * back in later. All of this is under Jffs2NodeLock().
+ */
+static uint32_t jffs2_inode_mem(struct jffs2_inode *inode)
+{
+	struct jffs2_inode_info *f = JFFS2_INODE_INFO(inode);
+	struct jffs2_node_frag *frag;
+	struct jffs2_full_dirent *fd;
+	uint32_t bytes = sizeof(*inode);
+
+	for (frag = frag_first(&f->fragtree); frag; frag = frag_next(frag))
+		bytes += sizeof(*frag) + sizeof(struct jffs2_full_dnode);
+	for (fd = f->dents; fd; fd = fd->next)
+		bytes += sizeof(*fd) + fd->nsize + 1;
+	if (f->metadata)
+		bytes += sizeof(struct jffs2_full_dnode);
+	if (f->target)
+		bytes += strlen((const char *)f->target) + 1;
+	return bytes;
+}
+
+static void jffs2_free_inode(struct jffs2_inode *i)
+{
+	struct jffs2_inode_info *f = JFFS2_INODE_INFO(i);
+
+	jffs2_clear_inode(i);
+	jffs2_inode_lock_destroy(f);
+	(void)Jffs2HashRemove(&i->i_sb->s_node_hash_lock, i);
+	(void)memset_s(i, sizeof(*i), 0x5a, sizeof(*i));
+	free(i);
+}
+
+static void jffs2_icache_del(struct jffs2_sb_info *c, struct jffs2_inode *i)
+{
+	if (LOS_ListEmpty(&i->i_lru))
+		return;
+	LOS_ListDelInit(&i->i_lru);
+	c->icache_lru_bytes -= i->i_lru_bytes;
+	jffs2_icache_total_bytes -= i->i_lru_bytes;
+}
+
+static void jffs2_icache_evict(struct jffs2_sb_info *c, struct jffs2_inode *i)
+{
+	struct jffs2_inode_info *f = JFFS2_INODE_INFO(i);
+
+	jffs2_dbg(1, "evicting ino #%u (%u bytes)\n", i->i_ino, i->i_lru_bytes);
+	jffs2_icache_del(c, i);
+
+	spin_lock(&c->inocache_lock);
+	if (f->inocache)
+		f->inocache->flags |= INO_FLAGS_EVICTED;
+	spin_unlock(&c->inocache_lock);
+
+	jffs2_free_inode(i);
+	c->icache_evictions++;
+}
+
+/* Take a reference to an inode found in the hash */
+static void jffs2_ipin(struct jffs2_sb_info *c, struct jffs2_inode *i)
+{
+	if (!i->i_count++)
+		jffs2_icache_del(c, i);
+}
+
+static void jffs2_icache_add(struct jffs2_sb_info *c, struct jffs2_inode *i)
+{
+	i->i_lru_bytes = jffs2_inode_mem(i);
+	LOS_ListTailInsert(&c->icache_lru, &i->i_lru);
+	c->icache_lru_bytes += i->i_lru_bytes;
+	jffs2_icache_total_bytes += i->i_lru_bytes;
+
+	while (!LOS_ListEmpty(&c->icache_lru) &&
+	       (c->icache_lru_bytes > c->icache_budget ||
+		jffs2_icache_total_bytes > JFFS2_ICACHE_GLOBAL_BUDGET))
+		jffs2_icache_evict(c, LOS_DL_LIST_ENTRY(c->icache_lru.pstNext,
+							struct jffs2_inode, i_lru));
+}
+
+/* Throw away every unused inode, at umount */
+void jffs2_icache_purge(struct jffs2_sb_info *c)
+{
+	Jffs2NodeLock();
+	while (!LOS_ListEmpty(&c->icache_lru))
+		jffs2_icache_evict(c, LOS_DL_LIST_ENTRY(c->icache_lru.pstNext,
+							struct jffs2_inode, i_lru));
+	Jffs2NodeUnlock();
+}
+
 struct jffs2_inode *jffs2_iget(struct super_block *sb, uint32_t ino)
 {
 	struct jffs2_inode_info *f;
@@ -236,7 +410,9 @@ struct jffs2_inode *jffs2_iget(struct super_block *sb, uint32_t ino)
 	Jffs2NodeLock();
 	inode = ilookup(sb, ino);
 	if (inode) {
+		jffs2_ipin(JFFS2_SB_INFO(sb), inode);
 		Jffs2NodeUnlock();
+		LOS_AtomicInc(&JFFS2_SB_INFO(sb)->stats.icache_hits);
 		return inode;
 	}
 	inode = new_inode(sb);
@@ -248,13 +424,15 @@ struct jffs2_inode *jffs2_iget(struct super_block *sb, uint32_t ino)
 	inode->i_ino = ino;
 	f = JFFS2_INODE_INFO(inode);
 	c = JFFS2_SB_INFO(inode->i_sb);
+	LOS_AtomicInc(&c->stats.icache_misses);
 
-	(void)mutex_init(&f->sem);
-	(void)mutex_lock(&f->sem);
+	jffs2_inode_lock_init(f);
+	jffs2_inode_lock(f);
 
 	ret = jffs2_do_read_inode(c, f, inode->i_ino, &latest_node);
 	if (ret) {
-		(void)mutex_unlock(&f->sem);
+		jffs2_inode_unlock(f);
+		jffs2_inode_lock_destroy(f);
         inode->i_nlink = 0;
         free(inode);
 		Jffs2NodeUnlock();
@@ -270,7 +448,25 @@ struct jffs2_inode *jffs2_iget(struct super_block *sb, uint32_t ino)
 	inode->i_ctime = je32_to_cpu(latest_node.ctime);
 	inode->i_nlink = f->inocache->pino_nlink;
 
-	(void)mutex_unlock(&f->sem);
+	spin_lock(&c->inocache_lock);
+	if (f->inocache->flags & INO_FLAGS_EVICTED) {
+		f->inocache->flags &= ~INO_FLAGS_EVICTED;
+		c->icache_rereads++;
+	}
+	spin_unlock(&c->inocache_lock);
+
+	/* Whatever is in here is likely to be looked up next. Get the
+	   background checkers onto it, if they're still going */
+	if (S_ISDIR(inode->i_mode) && c->unchecked_size) {
+		struct jffs2_full_dirent *fd;
+
+		for (fd = f->dents; fd; fd = fd->next) {
+			if (fd->ino)
+				jffs2_check_hint(c, fd->ino);
+		}
+	}
+
+	jffs2_inode_unlock(f);
 
 	(void)Jffs2HashInsert(&sb->s_node_hash_lock, &sb->s_node_hash[0], inode, ino);
 
@@ -285,32 +481,110 @@ struct jffs2_inode *jffs2_iget(struct super_block *sb, uint32_t ino)
 // Decrement the reference count on an inode. If this makes the ref count
 // zero, then this inode can be freed.
 
-int jffs2_iput(struct jffs2_inode *i)
+static int __jffs2_iput(struct jffs2_inode *i, int flush)
 {
 	// Called in jffs2_find
 	// (and jffs2_open and jffs2_ops_mkdir?)
 	// super.c jffs2_fill_super,
 	// and gc.c jffs2_garbage_collect_pass
-	struct jffs2_inode_info *f = NULL;
+	struct jffs2_sb_info *c = NULL;
+
+	// Last one out writes back the cache. Not under Jffs2NodeLock(),
+	// which the GC takes inside alloc_sem
+	if (flush && i && i->i_nlink && i->i_count == 1)
+		(void)jffs2_wb_flush(JFFS2_SB_INFO(i->i_sb), JFFS2_INODE_INFO(i));
 
 	Jffs2NodeLock();
-	if (!i || i->i_nlink) {
+	if (!i) {
 		// and let it fault...
 		Jffs2NodeUnlock();
 		return -EBUSY;
 	}
 
-	jffs2_clear_inode(i);
-	f = JFFS2_INODE_INFO(i);
-	(void)mutex_destroy(&(f->sem));
-	(void)Jffs2HashRemove(&i->i_sb->s_node_hash_lock, i);
-	(void)memset_s(i, sizeof(*i), 0x5a, sizeof(*i));
-	free(i);
+	c = JFFS2_SB_INFO(i->i_sb);
+	if (i->i_count > 0)
+		i->i_count--;
+
+	if (i->i_nlink) {
+		// Still linked: keep it cached until we need the memory
+		// (unless it's still dirty, when jffs2_wb_writeback() will come
+		// back for it)
+		if (!i->i_count && i != i->i_sb->s_root && LOS_ListEmpty(&i->i_lru) &&
+		    LOS_ListEmpty(&i->jffs2_i.wb_list))
+			jffs2_icache_add(c, i);
+		Jffs2NodeUnlock();
+		return -EBUSY;
+	}
+
+	// Unlinked, but still open somewhere else. The last one out frees it
+	if (i->i_count) {
+		Jffs2NodeUnlock();
+		return -EBUSY;
+	}
+
+	jffs2_icache_del(c, i);
+	jffs2_free_inode(i);
 	Jffs2NodeUnlock();
 
 	return 0;
 }
 
+int jffs2_iput(struct jffs2_inode *i)
+{
+	return __jffs2_iput(i, 1);
+}
+
+/*
+ * Drop a pin a background task took while it worked on an inode. Unlike
+ * jffs2_iput() it doesn't write back the cache, and it never frees an
+ * inode that anyone else still holds. Only an unlinked inode that
+ * everyone else let go of while it was pinned is freed here.
+ */
+void jffs2_iunpin(struct jffs2_inode *i)
+{
+	(void)__jffs2_iput(i, 0);
+}
+
+/*
+ * Write back cached data, oldest first: everything dirtied before 'before'
+ * (a jffs2_now_ns() time), and then some more while there are over
+ * mount_opts.wb_max_pages dirty. Each inode is pinned while we write it
+ * so it can't go away under us. Mustn't be called holding alloc_sem or
+ * any inode's sem.
+ */
+int jffs2_wb_writeback(struct jffs2_sb_info *c, uint64_t before)
+{
+	struct jffs2_inode_info *f;
+	struct jffs2_inode *inode;
+	int ret = 0;
+
+	while (1) {
+		Jffs2NodeLock();
+		mutex_lock(&c->wb_sem);
+		if (LOS_ListEmpty(&c->wb_dirty)) {
+			mutex_unlock(&c->wb_sem);
+			Jffs2NodeUnlock();
+			break;
+		}
+		f = LOS_DL_LIST_ENTRY(c->wb_dirty.pstNext, struct jffs2_inode_info, wb_list);
+		if (f->wb_stamp >= before && c->wb_dirty_pages <= c->mount_opts.wb_max_pages) {
+			mutex_unlock(&c->wb_sem);
+			Jffs2NodeUnlock();
+			break;
+		}
+		inode = OFNI_EDONI_2SFFJ(f);
+		jffs2_ipin(c, inode);
+		mutex_unlock(&c->wb_sem);
+		Jffs2NodeUnlock();
+
+		ret = jffs2_wb_flush(c, f);
+		jffs2_iunpin(inode);
+		if (ret)
+			break;
+	}
+	return ret;
+}
+
 
 /* jffs2_new_inode: allocate a new inode and inocache, add it to the hash,
    fill in the raw_inode while you're at it. */
@@ -331,8 +605,8 @@ struct jffs2_inode *jffs2_new_inode (struct jffs2_inode *dir_i, int mode, struct
 		return (struct jffs2_inode *)-ENOMEM;
 
 	f = JFFS2_INODE_INFO(inode);
-	(void)mutex_init(&f->sem);
-	(void)mutex_lock(&f->sem);;
+	jffs2_inode_lock_init(f);
+	jffs2_inode_lock(f);
 
 	memset(ri, 0, sizeof(*ri));
 	/* Set OS-specific defaults for new inodes */
@@ -341,9 +615,9 @@ struct jffs2_inode *jffs2_new_inode (struct jffs2_inode *dir_i, int mode, struct
 
 	ret = jffs2_do_new_inode (c, f, mode, ri);
 	if (ret) {
-		mutex_unlock(&(f->sem));
+		jffs2_inode_unlock(f);
 		jffs2_clear_inode(inode);
-		(void)mutex_destroy(&(f->sem));
+		jffs2_inode_lock_destroy(f);
 		(void)memset_s(inode, sizeof(*inode), 0x6a, sizeof(*inode));
 		free(inode);
 		Jffs2NodeUnlock();
@@ -390,7 +664,8 @@ void jffs2_gc_release_inode(struct jffs2_sb_info *c,
 		   	    struct jffs2_inode_info *f)
 {
 	struct jffs2_inode *node = OFNI_EDONI_2SFFJ(f);
-	jffs2_iput(node);
+	/* We're inside alloc_sem; leave any cached data to its owner */
+	(void)__jffs2_iput(node, 0);
 }
 
 struct jffs2_inode_info *jffs2_gc_fetch_inode(struct jffs2_sb_info *c,
@@ -414,7 +689,12 @@ struct jffs2_inode_info *jffs2_gc_fetch_inode(struct jffs2_sb_info *c,
 		   holding the alloc_sem, and jffs2_do_unlink() would also
 		   need that while decrementing nlink on any inode.
 		*/
+		Jffs2NodeLock();
 		inode = ilookup(OFNI_BS_2SFFJ(c), inum);
+		/* jffs2_gc_release_inode() drops this again */
+		if (inode)
+			jffs2_ipin(c, inode);
+		Jffs2NodeUnlock();
 		if (!inode) {
 			jffs2_dbg(1, "ilookup() failed for ino #%u; inode is probably deleted.\n",
 				  inum);
@@ -21,6 +21,7 @@
 #include "nodelist.h"
 #include "compr.h"
 #include "los_crc32.h"
+#include "vfs_jffs2.h"
 
 static int jffs2_garbage_collect_pristine(struct jffs2_sb_info *c,
 					  struct jffs2_inode_cache *ic,
@@ -36,7 +37,7 @@ static int jffs2_garbage_collect_hole(struct jffs2_sb_info *c, struct jffs2_eras
 				      uint32_t start, uint32_t end);
 static int jffs2_garbage_collect_dnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
 				       struct jffs2_inode_info *f, struct jffs2_full_dnode *fn,
-				       uint32_t start, uint32_t end);
+				       uint32_t start, uint32_t end, int recompr);
 static int jffs2_garbage_collect_live(struct jffs2_sb_info *c,  struct jffs2_eraseblock *jeb,
 			       struct jffs2_raw_node_ref *raw, struct jffs2_inode_info *f);
 
@@ -114,6 +115,7 @@ again:
 		ret->wasted_size = 0;
 	}
 
+	jffs2_trace(c, JFFS2_TR_GC_BLOCK, ret->offset, ret->dirty_size);
 	return ret;
 }
 
@@ -121,7 +123,7 @@ again:
  * Make a single attempt to progress GC. Move one node, and possibly
  * start erasing one eraseblock.
  */
-int jffs2_garbage_collect_pass(struct jffs2_sb_info *c)
+static int __jffs2_garbage_collect_pass(struct jffs2_sb_info *c)
 {
 	struct jffs2_inode_info *f;
 	struct jffs2_inode_cache *ic;
@@ -182,13 +184,14 @@ int jffs2_garbage_collect_pass(struct jffs2_sb_info *c)
 			continue;
 
 		case INO_STATE_GC:
-		case INO_STATE_CHECKING:
 			pr_warn("Inode #%u is in state %d during CRC check phase!\n",
 				ic->ino, ic->state);
 			spin_unlock(&c->inocache_lock);
 			BUG();
 			break;
 
+		case INO_STATE_CHECKING:
+			/* One of the background checkers has it */
 		case INO_STATE_READING:
 			/* We need to wait for it to finish, lest we move on
 			   and trigger the BUG() above while we haven't yet
@@ -451,6 +454,8 @@ int jffs2_garbage_collect_pass(struct jffs2_sb_info *c)
 		pr_err("Error garbage collecting node at %08x!\n",
 		       ref_offset(jeb->gc_node));
 		ret = -ENOSPC;
+	} else if (jeb->dirty_size > gcblock_dirty) {
+		LOS_Atomic64Add(&c->stats.gc_bytes, jeb->dirty_size - gcblock_dirty);
 	}
  release_sem:
 	mutex_unlock(&c->alloc_sem);
@@ -474,6 +479,16 @@ int jffs2_garbage_collect_pass(struct jffs2_sb_info *c)
 	return ret;
 }
 
+int jffs2_garbage_collect_pass(struct jffs2_sb_info *c)
+{
+	uint64_t start = jffs2_now_ns();
+	int ret;
+
+	ret = __jffs2_garbage_collect_pass(c);
+	jffs2_lat_hist_add(&c->stats.gc_lat, jffs2_now_ns() - start);
+	return ret;
+}
+
 static int jffs2_garbage_collect_live(struct jffs2_sb_info *c,  struct jffs2_eraseblock *jeb,
 				      struct jffs2_raw_node_ref *raw, struct jffs2_inode_info *f)
 {
@@ -481,9 +496,11 @@ static int jffs2_garbage_collect_live(struct jffs2_sb_info *c,  struct jffs2_era
 	struct jffs2_full_dnode *fn = NULL;
 	struct jffs2_full_dirent *fd;
 	uint32_t start = 0, end = 0, nrfrags = 0;
+	int recompr = 0;
 	int ret = 0;
 
-	mutex_lock(&f->sem);
+	jffs2_trace(c, JFFS2_TR_GC_NODE, ref_offset(raw), f->inocache->ino);
+	jffs2_inode_lock(f);
 
 	/* Now we have the lock for this inode. Check that it's still the one at the head
 	   of the list. */
@@ -530,6 +547,8 @@ static int jffs2_garbage_collect_live(struct jffs2_sb_info *c,  struct jffs2_era
 			}
 			if (ret != -EBADFD)
 				goto upnout;
+			recompr = (c->recompr_raw == raw);
+			c->recompr_raw = NULL;
 		}
 		/* We found a datanode. Do the GC */
 		if((start >> PAGE_CACHE_SHIFT) < ((end-1) >> PAGE_CACHE_SHIFT)) {
@@ -537,7 +556,7 @@ static int jffs2_garbage_collect_live(struct jffs2_sb_info *c,  struct jffs2_era
 			ret = jffs2_garbage_collect_hole(c, jeb, f, fn, start, end);
 		} else {
 			/* It could still be a hole. But we GC the page this way anyway */
-			ret = jffs2_garbage_collect_dnode(c, jeb, f, fn, start, end);
+			ret = jffs2_garbage_collect_dnode(c, jeb, f, fn, start, end, recompr);
 		}
 		goto upnout;
 	}
@@ -563,11 +582,62 @@ static int jffs2_garbage_collect_live(struct jffs2_sb_info *c,  struct jffs2_era
 		}
 	}
  upnout:
-	mutex_unlock(&f->sem);
+	jffs2_inode_unlock(f);
 
 	return ret;
 }
 
+/*
+ * Should this pristine data node be rewritten with the best compressor we
+ * have instead of being copied? Only if it went out uncompressed or with
+ * a fast compressor and hasn't been modified for JFFS2_RECOMPR_AGE. It's
+ * only done by the GC thread, so no writer ever waits for it, and no
+ * faster than JFFS2_RECOMPR_RATE. A node which gained nothing last time
+ * is written back REF_NORMAL and doesn't get here again.
+ */
+static int jffs2_gc_want_recompr(struct jffs2_sb_info *c,
+				 struct jffs2_raw_inode *ri)
+{
+	uint32_t dsize = je32_to_cpu(ri->dsize);
+	uint32_t now, mtime;
+	uint64_t t, ms;
+
+	if (!JFFS2_RECOMPR_RATE || !dsize)
+		return 0;
+
+	if (ri->compr != JFFS2_COMPR_NONE && ri->compr != JFFS2_COMPR_RTIME &&
+	    ri->compr != JFFS2_COMPR_LZO)
+		return 0;
+
+	if (c->mount_opts.override_compr &&
+	    c->mount_opts.compr == JFFS2_COMPR_MODE_NONE)
+		return 0;
+
+	if (!jffs2_gc_thread_is_current(c))
+		return 0;
+
+	/* If the clock is behind the node, it was written before a reboot
+	   and that's old enough */
+	now = Jffs2CurSec();
+	mtime = je32_to_cpu(ri->mtime);
+	if (now >= mtime && now - mtime < JFFS2_RECOMPR_AGE)
+		return 0;
+
+	/* Earn JFFS2_RECOMPR_RATE bytes a second, up to a second's worth */
+	t = jffs2_now_ns();
+	ms = (t - c->recompr_stamp) / 1000000;
+	if (ms >= 1000) {
+		c->recompr_credit = JFFS2_RECOMPR_RATE;
+		c->recompr_stamp = t;
+	} else {
+		c->recompr_credit = min_t(uint32_t, JFFS2_RECOMPR_RATE,
+				c->recompr_credit + ms * JFFS2_RECOMPR_RATE / 1000);
+		c->recompr_stamp += ms * 1000000;
+	}
+
+	return c->recompr_credit >= dsize;
+}
+
 static int jffs2_garbage_collect_pristine(struct jffs2_sb_info *c,
 					  struct jffs2_inode_cache *ic,
 					  struct jffs2_raw_node_ref *raw)
@@ -582,6 +652,8 @@ static int jffs2_garbage_collect_pristine(struct jffs2_sb_info *c,
 	jffs2_dbg(1, "Going to GC REF_PRISTINE node at 0x%08x\n",
 		  ref_offset(raw));
 
+	c->recompr_raw = NULL;
+
 	alloclen = rawlen = ref_totlen(c, c->gcblock, raw);
 
 	/* Ask for a small amount of space (or the totlen if smaller) because we
@@ -640,6 +712,16 @@ static int jffs2_garbage_collect_pristine(struct jffs2_sb_info *c,
 				goto bail;
 			}
 		}
+
+		/* Hand it back to jffs2_garbage_collect_live() to rewrite */
+		if (ic && jffs2_gc_want_recompr(c, &node->i)) {
+			jffs2_dbg(1, "Recompressing cold data node at 0x%08x\n",
+				  ref_offset(raw));
+			c->recompr_raw = raw;
+			c->recompr_rawlen = rawlen;
+			ret = -EBADFD;
+			goto out_node;
+		}
 		break;
 
 	case JFFS2_NODETYPE_DIRENT:
@@ -684,6 +766,21 @@ static int jffs2_garbage_collect_pristine(struct jffs2_sb_info *c,
  retry:
 	phys_ofs = write_ofs(c);
 
+	/* jffs2_flash_write() doesn't collect summary information */
+	if (jffs2_sum_active()) {
+		if (je16_to_cpu(node->u.nodetype) == JFFS2_NODETYPE_INODE ||
+		    je16_to_cpu(node->u.nodetype) == JFFS2_NODETYPE_DIRENT) {
+			struct kvec vec = { .iov_base = node, .iov_len = rawlen };
+
+			ret = jffs2_sum_add_kvec(c, &vec, 1, phys_ofs);
+			if (ret)
+				goto out_node;
+		} else {
+			/* We can't summarise nodes we don't grok */
+			jffs2_sum_disable_collecting(c->summary);
+		}
+	}
+
 	ret = jffs2_flash_write(c, phys_ofs, rawlen, &retlen, (const u_char *)node);
 
 	if (ret || (retlen != rawlen)) {
@@ -896,6 +993,7 @@ static int jffs2_garbage_collect_deletion_dirent(struct jffs2_sb_info *c, struct
 		struct jffs2_raw_node_ref *raw;
 		int ret;
 		size_t retlen;
+		uint32_t ocrc, onsize;
 		int name_len = strlen((const char *)fd->name);
 		uint32_t name_crc = crc32(0, fd->name, name_len);
 		uint32_t rawlen = ref_totlen(c, jeb, fd->raw);
@@ -926,6 +1024,13 @@ static int jffs2_garbage_collect_deletion_dirent(struct jffs2_sb_info *c, struct
 			if (SECTOR_ADDR(raw->flash_offset) == SECTOR_ADDR(fd->raw->flash_offset))
 				continue;
 
+			/* If we've already seen what's in it, we may not need to read it */
+			if (jffs2_obsd_lookup(c, ref_offset(raw), &ocrc, &onsize) &&
+			    (ocrc != name_crc || onsize != name_len)) {
+				c->obsd_hits++;
+				continue;
+			}
+
 			jffs2_dbg(1, "Check potential deletion dirent at %08x\n",
 				  ref_offset(raw));
 
@@ -945,8 +1050,12 @@ static int jffs2_garbage_collect_deletion_dirent(struct jffs2_sb_info *c, struct
 				continue;
 			}
 
-			if (je16_to_cpu(rd->nodetype) != JFFS2_NODETYPE_DIRENT)
+			if (je16_to_cpu(rd->nodetype) != JFFS2_NODETYPE_DIRENT ||
+			    !je32_to_cpu(rd->ino)) {
+				__jffs2_obsd_add(c, ref_offset(raw), 0, 0);
 				continue;
+			}
+			__jffs2_obsd_add(c, ref_offset(raw), je32_to_cpu(rd->name_crc), rd->nsize);
 
 			/* If the name CRC doesn't match, skip */
 			if (je32_to_cpu(rd->name_crc) != name_crc)
@@ -980,6 +1089,12 @@ static int jffs2_garbage_collect_deletion_dirent(struct jffs2_sb_info *c, struct
 	/* FIXME: If we're deleting a dirent which contains the current mtime and ctime,
 	   we should update the metadata node with those times accordingly */
 
+	/* On NOR we drop it without looking, because whatever it deletes
+	   was marked obsolete on the flash. Make sure that's really so
+	   before its block can be erased */
+	if (jffs2_can_mark_obsolete(c))
+		jffs2_flush_obsolete(c);
+
 	/* No need for it any more. Just mark it obsolete and remove it from the list */
 	while (*fdp) {
 		if ((*fdp) == fd) {
@@ -1152,11 +1267,12 @@ static int jffs2_garbage_collect_hole(struct jffs2_sb_info *c, struct jffs2_eras
 
 static int jffs2_garbage_collect_dnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *orig_jeb,
 				       struct jffs2_inode_info *f, struct jffs2_full_dnode *fn,
-				       uint32_t start, uint32_t end)
+				       uint32_t start, uint32_t end, int recompr)
 {
 	struct jffs2_full_dnode *new_fn;
 	struct jffs2_raw_inode ri;
 	uint32_t alloclen, offset, orig_end, orig_start;
+	uint32_t written = 0;
 	int ret = 0;
 	unsigned char *comprbuf = NULL, *writebuf;
 	unsigned long pg;
@@ -1170,7 +1286,9 @@ static int jffs2_garbage_collect_dnode(struct jffs2_sb_info *c, struct jffs2_era
 	orig_end = end;
 	orig_start = start;
 
-	if (c->nr_free_blocks + c->nr_erasing_blocks > c->resv_blocks_gcmerge) {
+	/* When recompressing we rewrite just the one node, so that we know
+	   what it saved */
+	if (!recompr && c->nr_free_blocks + c->nr_erasing_blocks > c->resv_blocks_gcmerge) {
 		/* Attempt to do some merging. But only expand to cover logically
 		   adjacent frags if the block containing them is already considered
 		   to be dirty. Otherwise we end up with GC just going round in
@@ -1339,7 +1457,11 @@ static int jffs2_garbage_collect_dnode(struct jffs2_sb_info *c, struct jffs2_era
 
 		writebuf = pg_ptr + (offset & (PAGE_CACHE_SIZE -1));
 
-		comprtype = jffs2_compress(c, f, writebuf, &comprbuf, &datalen, &cdatalen);
+		if (recompr)
+			comprtype = jffs2_compress_mode(c, f, JFFS2_COMPR_MODE_SIZE,
+					writebuf, &comprbuf, &datalen, &cdatalen);
+		else
+			comprtype = jffs2_compress(c, f, writebuf, &comprbuf, &datalen, &cdatalen);
 
 		ri.magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
 		ri.nodetype = cpu_to_je16(JFFS2_NODETYPE_INODE);
@@ -1373,8 +1495,19 @@ static int jffs2_garbage_collect_dnode(struct jffs2_sb_info *c, struct jffs2_era
 			ret = PTR_ERR(new_fn);
 			break;
 		}
+		/* If the best we have did no better than what was there, say
+		   so by taking it off the pristine path, which is the only
+		   place jffs2_gc_want_recompr() looks. Otherwise cold data
+		   which doesn't compress would come back every time */
+		if (recompr && (uint64_t)PAD(sizeof(ri) + cdatalen) * (orig_end - orig_start) >=
+			       (uint64_t)c->recompr_rawlen * datalen) {
+			spin_lock(&c->erase_completion_lock);
+			new_fn->raw->flash_offset = ref_offset(new_fn->raw) | REF_NORMAL;
+			spin_unlock(&c->erase_completion_lock);
+		}
 		ret = jffs2_add_full_dnode_to_inode(c, f, new_fn);
 		offset += datalen;
+		written += PAD(sizeof(ri) + cdatalen);
 		if (f->metadata) {
 			jffs2_mark_node_obsolete(c, f->metadata->raw);
 			jffs2_free_full_dnode(f->metadata);
@@ -1382,6 +1515,14 @@ static int jffs2_garbage_collect_dnode(struct jffs2_sb_info *c, struct jffs2_era
 		}
 	}
 
+	if (recompr && !ret) {
+		c->recompr_credit -= min_t(uint32_t, c->recompr_credit,
+					   orig_end - orig_start);
+		LOS_AtomicInc(&c->stats.recompr_nodes);
+		LOS_Atomic64Add(&c->stats.recompr_in, c->recompr_rawlen);
+		LOS_Atomic64Add(&c->stats.recompr_out, written);
+	}
+
 	jffs2_gc_release_page(c, pg_ptr, &pg);
 	return ret;
 }
@@ -15,6 +15,7 @@
 
 #include <linux/rbtree.h>
 #include <linux/kernel.h>
+#include "los_rwlock.h"
 
 #ifdef __cplusplus
 #if __cplusplus
@@ -29,7 +30,11 @@ struct jffs2_inode_info {
 	   before letting GC proceed. Or we'd have to put ugliness
 	   into the GC code so it didn't attempt to obtain the i_mutex
 	   for the inode(s) which are already locked */
-	struct pthread_mutex sem;
+	/* It's a reader/writer lock: lookups, readdir and reads of the
+	   data only look at the lists below and may share it. Anything
+	   which changes them (writes, truncation, the GC) holds it
+	   exclusively. Use the jffs2_inode_lock*() helpers below */
+	LosRwlock sem;
 
 	/* The highest (datanode) version number used for this ino */
 	uint32_t highest_version;
@@ -55,8 +60,36 @@ struct jffs2_inode_info {
 
 	uint16_t flags;
 	uint8_t usercompr;
+	uint8_t attr_dirty;	/* Lazy jffs2_setattr() changes not on the flash yet */
+
+	/* Sequential read detection. Readers only share sem, so these are
+	   under c->ra_sem */
+	uint32_t ra_next;	/* Where the last read ended */
+	uint16_t ra_streak;	/* How many reads in a row started there */
+
+	uint32_t aio_pending;	/* Async writes queued, under c->aio_sem */
+
+	/* Write-back cache: one page of data not yet written to the flash,
+	   [wb_ofs + wb_start, wb_ofs + wb_end), and the raw inode to write
+	   it out with. wb_page is NULL when clean. Changed under both sem
+	   and c->wb_sem, so either is enough to look at it. See write.c */
+	unsigned char *wb_page;
+	struct jffs2_raw_inode *wb_ri;
+	uint32_t wb_ofs;
+	uint32_t wb_start;
+	uint32_t wb_end;
+	uint64_t wb_stamp;	/* When it was dirtied */
+	LOS_DL_LIST wb_list;	/* On c->wb_dirty, oldest first, while
+				   wb_page or attr_dirty is set */
 };
 
+#define jffs2_inode_lock_init(f)	(void)LOS_RwlockInit(&(f)->sem)
+#define jffs2_inode_lock_destroy(f)	(void)LOS_RwlockDestroy(&(f)->sem)
+#define jffs2_inode_lock(f)		(void)LOS_RwlockWrLock(&(f)->sem, LOS_WAIT_FOREVER)
+#define jffs2_inode_unlock(f)		(void)LOS_RwlockUnLock(&(f)->sem)
+#define jffs2_inode_lock_shared(f)	(void)LOS_RwlockRdLock(&(f)->sem, LOS_WAIT_FOREVER)
+#define jffs2_inode_unlock_shared(f)	(void)LOS_RwlockUnLock(&(f)->sem)
+
 struct super_block;
 
 struct jffs2_inode {
@@ -71,6 +104,9 @@ struct jffs2_inode {
 	off_t i_size;
 	struct super_block *i_sb;
 	LOS_DL_LIST i_hashlist;
+	int i_count;		/* References from jffs2_iget()/jffs2_new_inode() */
+	LOS_DL_LIST i_lru;	/* On the sb's icache_lru while i_count is zero */
+	uint32_t i_lru_bytes;	/* What we reckoned it cost when it went there */
 	struct jffs2_inode_info jffs2_i;
 };
 
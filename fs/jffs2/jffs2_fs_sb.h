@@ -23,6 +23,7 @@
 #include <linux/rwsem.h>
 #include "vfs_jffs2.h"
 #include "mtd_dev.h"
+#include "los_atomic.h"
 
 #ifdef __cplusplus
 #if __cplusplus
@@ -36,6 +37,126 @@ extern "C" {
 
 struct jffs2_inodirty;
 
+#define JFFS2_WCBUF_SIZE 256 /* NOR program page size, unless the driver says */
+
+#define JFFS2_OBSOLETE_QUEUE 64 /* Nodes waiting to be marked obsolete on flash */
+
+struct jffs2_raw_node_ref;
+
+struct jffs2_obsolete_ent {
+	struct jffs2_raw_node_ref *ref;
+	uint32_t len;
+};
+
+#define JFFS2_OBSD_HASH 64	/* Obsolete dirent index buckets */
+#define JFFS2_OBSD_MAX 2048	/* ... and most entries it may hold */
+
+struct jffs2_obsd;
+
+#define JFFS2_RA_SLOTS 8 /* Nodes the read-ahead task may keep decompressed */
+
+struct jffs2_ra_slot {
+	uint32_t ofs;		/* Flash offset of the node */
+	uint32_t len;		/* Its data size; 0 if the slot is free */
+	unsigned char *data;
+};
+
+#define JFFS2_AIO_RING 2 /* Async write chunks compressed ahead of the writer */
+
+struct jffs2_aio_req;
+
+/* Up to a page of an async write, compressed and waiting to be written */
+struct jffs2_aio_chunk {
+	struct jffs2_aio_req *req;
+	unsigned char *data;	/* Where it is in the request's buffer */
+	unsigned char *cbuf;	/* Compressed, or data itself */
+	uint32_t offset;
+	uint32_t datalen;
+	uint32_t cdatalen;
+	uint16_t comprtype;
+};
+
+#define JFFS2_CHECK_THREADS_MAX 4 /* Background CRC checkers per mount */
+#define JFFS2_GC_WORKERS_MAX 4 /* GC workers shared by all mounts */
+#define JFFS2_CHECK_PRIO_SLOTS 32 /* Inodes queued to be checked first */
+
+/* Latency histogram. Bucket n counts samples of [2^n, 2^(n+1)) us; the
+   first also takes everything under 1us and the last everything above.
+   Added to without a lock, so max_ns may miss a sample which raced with
+   a bigger one */
+#define JFFS2_LAT_HIST_BUCKETS 20
+
+struct jffs2_lat_hist {
+	Atomic count[JFFS2_LAT_HIST_BUCKETS];
+	Atomic64 total_ns;
+	Atomic64 max_ns;
+};
+
+#define JFFS2_STATS_COMPR 8 /* Compression types we keep times for */
+
+/* Statistics kept for every mount, see jffs2_get_stats(). The number of
+   calls to each function timed is its histogram's sample count */
+struct jffs2_stats {
+	struct jffs2_lat_hist resv_lat;		/* jffs2_reserve_space() */
+	struct jffs2_lat_hist gc_lat;		/* jffs2_garbage_collect_pass() */
+	struct jffs2_lat_hist erase_lat;	/* Block erases */
+	struct jffs2_lat_hist read_lat;		/* jffs2_read_inode_range() */
+	struct jffs2_lat_hist write_lat;	/* jffs2_write_inode_range() */
+	struct jffs2_lat_hist iread_lat;	/* jffs2_do_read_inode() */
+	Atomic64 read_bytes;		/* Read by jffs2_read_inode_range() */
+	Atomic64 write_bytes;		/* Taken by jffs2_write_inode_range() */
+	Atomic64 gc_bytes;		/* Moved out of the GC block by GC passes */
+	Atomic erase_failures;
+	Atomic icache_hits;		/* jffs2_iget() found the inode in core */
+	Atomic icache_misses;		/* ... or had to read it */
+	Atomic64 compr_ns[JFFS2_STATS_COMPR];	/* Time in each compressor */
+	Atomic64 decompr_ns[JFFS2_STATS_COMPR];	/* ... and decompressor */
+	Atomic recompr_nodes;		/* Cold nodes recompressed by GC */
+	Atomic64 recompr_in;		/* ... the flash space they took */
+	Atomic64 recompr_out;		/* ... and what they take now */
+	uint64_t mount_ns;		/* jffs2_fill_super() */
+};
+
+/* Event trace. Each mount keeps the last JFFS2_TRACE_ENTRIES events in a
+   ring, which jffs2_get_trace() copies out behind a jffs2_trace_hdr and
+   scripts/jffs2/jffs2_trace.py decodes. Keep the three in step */
+#define JFFS2_TRACE_MAGIC 0x4a325452	/* "J2TR" */
+#define JFFS2_TRACE_VERSION 1
+
+enum {
+	JFFS2_TR_GC_BLOCK = 1,	/* Block picked for GC: offset, dirty size */
+	JFFS2_TR_GC_NODE,	/* Live node GC moves: offset, ino */
+	JFFS2_TR_ERASE,		/* Block erased: offset, time taken in us */
+	JFFS2_TR_ERASE_FAIL,	/* ... or not: offset, -error */
+	JFFS2_TR_NEXTBLOCK,	/* New block to write to: offset, free blocks left */
+	JFFS2_TR_OBSOLETE,	/* Node obsoleted: offset, length */
+	JFFS2_TR_RESERVE,	/* Space reserved: bytes asked for, time taken in us */
+};
+
+struct jffs2_trace_ent {
+	uint64_t ns;		/* jffs2_now_ns() */
+	uint32_t seq;		/* Events logged before this one, plus one; 0 while it's being written */
+	uint16_t event;		/* JFFS2_TR_* */
+	uint16_t task;		/* Task it happened in */
+	uint32_t a;
+	uint32_t b;
+};
+
+struct jffs2_trace_hdr {
+	uint32_t magic;		/* JFFS2_TRACE_MAGIC */
+	uint16_t version;	/* JFFS2_TRACE_VERSION */
+	uint16_t entsize;	/* sizeof(struct jffs2_trace_ent) */
+	uint32_t nr;		/* Entries which follow, in no particular order */
+	uint32_t seq;		/* Events logged so far */
+};
+
+struct kvec;
+
+/* Vectored write, for MTD drivers which can program straight from a list
+   of buffers. Returns 0 or a negative error, and the bytes written */
+typedef int (*jffs2_mtd_writev_t)(struct MtdDev *mtd, const struct kvec *vecs,
+				  unsigned long count, loff_t to, size_t *retlen);
+
 struct jffs2_mount_opts {
 	bool override_compr;
 	unsigned int compr;
@@ -46,6 +167,30 @@ struct jffs2_mount_opts {
 	 * latter users to write to the file system if the amount if the
 	 * available space is less then 'rp_size'. */
 	unsigned int rp_size;
+
+	/* How long a non-blocking data write may spend garbage collecting
+	 * in jffs2_reserve_space() before it stops, short or with -EAGAIN,
+	 * and leaves the rest to the GC thread. Only writes made through
+	 * jffs2_write_inode_range_budget() are bounded. Zero means no limit. */
+	unsigned int resv_budget_ms;
+
+	/* Per-inode write-back cache. Small writes are gathered into a page
+	 * per inode and written as one node on fsync, on the last iput, when
+	 * more than wb_max_pages are dirty or once they're wb_timeout_ms
+	 * old. That's also how much may be lost on power failure. Zero
+	 * means write-through, as before. */
+	unsigned int wb_timeout_ms;
+	unsigned int wb_max_pages;
+
+	/* Keep attribute-only jffs2_setattr() changes in core, and write
+	 * them with the next data node for the inode or, failing that, as
+	 * one metadata node when the write-back cache is flushed. */
+	bool lazy_attr;
+
+	/* Mounted read-only. There's no GC or erasing, no summary or
+	 * obsolete dirent bookkeeping for them, and nodes are CRC-checked
+	 * as they're first read rather than all of them in the background. */
+	bool rdonly;
 };
 
 /* A struct for the overall file system control.  Pointers to
@@ -54,10 +199,26 @@ struct jffs2_mount_opts {
 */
 struct jffs2_sb_info {
 	struct MtdDev *mtd;
+	jffs2_mtd_writev_t mtd_writev;	/* Optional; MtdDev itself has no writev */
 
 	uint32_t highest_ino;
 	uint32_t checked_ino;
 
+	/* Background CRC checking of unchecked inodes after mount. Which
+	   inode is next, and whether to stop, are protected by the
+	   inocache_lock; the progress report by the erase_completion_lock,
+	   along with the unchecked_size it's taken from. The rest is set up
+	   before the checkers start. See background.c */
+	uint32_t check_next_ino;	/* Next inode for the checkers to look at */
+	uint32_t check_prio_head;	/* Ring of inodes to check ahead of that */
+	uint32_t check_prio_tail;
+	uint32_t check_prio[JFFS2_CHECK_PRIO_SLOTS];
+	uint32_t check_total;		/* unchecked_size when checking started */
+	uint32_t check_reported;	/* Last progress percentage logged */
+	uint64_t check_start;
+	int check_threads;		/* Checker tasks started */
+	int check_stop;
+
 	unsigned int flags;
 
 	struct task_struct *gc_task;	/* GC task struct */
@@ -94,6 +255,99 @@ struct jffs2_sb_info {
 
 	uint32_t nospc_dirty_size;
 
+	/* Background GC scheduling. The GC thread works ahead of demand
+	   while the filesystem is idle, until this many blocks are free */
+	uint32_t gc_idle_watermark;
+	uint32_t gc_idle_last_free;	/* Free + erasing blocks at the last idle tick */
+	uint32_t gc_fg_reserves;	/* Foreground reservations since the last idle tick,
+					   under erase_completion_lock */
+
+	/* Our place in the pool of GC workers. gc_trig is set by anyone,
+	   the rest is protected by the pool's lock. See background.c */
+	LOS_DL_LIST gc_list;
+	uint32_t gc_state;
+	Atomic gc_trig;			/* GC was asked for since the last turn */
+	unsigned int gc_worker;		/* Task collecting, while GC_STATE_BUSY */
+	uint64_t gc_last_ns;		/* When we last had a worker */
+	uint32_t gc_waited;		/* Turns passed over since then */
+	uint32_t gc_served;		/* Turns we've had */
+
+	/* GC statistics */
+	uint32_t gc_fg_passes;		/* GC passes run inline by writers */
+	uint64_t gc_fg_pass_ns;		/* ... and the time they took */
+	uint32_t gc_idle_passes;	/* GC passes run ahead of demand by the GC thread */
+	uint64_t gc_idle_pass_ns;	/* ... and the time they took */
+	uint64_t gc_stall_avoided_ns;	/* Estimated writer stall time saved by idle GC */
+	uint32_t resv_budget_exceeded;	/* Reservations which ran out of GC budget */
+
+	/* Cold data recompression. When the GC thread comes across a data
+	   node which was written with a fast compressor, or none, and hasn't
+	   been modified for JFFS2_RECOMPR_AGE, it rewrites it with the best
+	   one we have instead of copying it. Protected by alloc_sem. See gc.c */
+	struct jffs2_raw_node_ref *recompr_raw;	/* Node pristine GC left to us */
+	uint32_t recompr_rawlen;
+	uint32_t recompr_credit;	/* Bytes we may recompress right now */
+	uint64_t recompr_stamp;		/* When recompr_credit was last topped up */
+
+	/* In-core inodes which nobody holds a reference to are kept on this
+	   LRU, oldest first, and evicted once they take up more than
+	   icache_budget bytes. Protected by Jffs2NodeLock(). See fs.c */
+	LOS_DL_LIST icache_lru;
+	uint32_t icache_lru_bytes;
+	uint32_t icache_budget;
+	uint32_t icache_evictions;
+	uint32_t icache_rereads;	/* Evicted inodes which were read back in */
+
+	/* Read-ahead. A reader which keeps reading on from where it left off
+	   leaves a request here for the read-ahead task, which reads and
+	   decompresses the next few nodes of the file into ra_slot[] for
+	   jffs2_read_dnode() to find. Slots are keyed by flash offset and
+	   dropped when their block is erased. ra_sem protects the slots, the
+	   request and each inode's ra_next and ra_streak. See read.c */
+	struct pthread_mutex ra_sem;
+	struct jffs2_ra_slot ra_slot[JFFS2_RA_SLOTS];
+	uint32_t ra_clock;		/* Next slot to reuse */
+	uint32_t ra_req_ino;		/* 0: nothing asked for */
+	uint32_t ra_req_ofs;
+	int ra_running;			/* Read-ahead task started */
+	uint32_t ra_filled;		/* Nodes read ahead */
+	uint32_t ra_hits;		/* Reads served from them */
+
+	/* Asynchronous writes. jffs2_write_async() queues requests on
+	   aio_queue, the compressor task cuts them into chunks and compresses
+	   them into aio_ring[], and the writer task writes them out, so the
+	   next chunk is compressed while this one is programmed. Until its
+	   chunks are written, each request holds the most flash they could
+	   take in aio_ledger, which other reservations leave alone. aio_sem
+	   protects the queue, the ring and the counts; aio_ledger is under
+	   erase_completion_lock. See background.c */
+	struct pthread_mutex aio_sem;
+	LOS_DL_LIST aio_queue;
+	struct jffs2_aio_chunk aio_ring[JFFS2_AIO_RING];
+	uint32_t aio_head;		/* Next slot the compressor fills */
+	uint32_t aio_tail;		/* Next slot the writer empties */
+	uint32_t aio_inflight;		/* Requests queued and not yet completed */
+	uint32_t aio_ledger;
+	int aio_running;		/* Async write tasks started */
+	int aio_stop;
+	uint32_t aio_reqs;		/* Requests completed */
+	uint32_t aio_chunks;		/* Nodes written for them */
+	uint32_t aio_failed;		/* Requests completed with an error */
+
+	/* Inodes with write-back data, oldest first. wb_sem nests inside
+	   everything else. See write.c */
+	struct pthread_mutex wb_sem;
+	LOS_DL_LIST wb_dirty;
+	uint32_t wb_dirty_pages;
+	uint32_t wb_writes;		/* Writes absorbed by the cache */
+	uint32_t wb_nodes;		/* Nodes written out for them */
+	uint32_t attr_deferred;		/* Lazy setattrs kept in core */
+	uint32_t attr_folded;		/* ... and written with a data node */
+	uint32_t attr_nodes;		/* ... and written as a metadata node */
+	struct jffs2_stats stats;	/* Always kept, see jffs2_get_stats() */
+	struct jffs2_trace_ent *trace;	/* JFFS2_TRACE_ENTRIES of them, or NULL */
+	Atomic trace_seq;
+
 	uint32_t nr_blocks;
 	struct jffs2_eraseblock *blocks;	/* The whole array of blocks. Used for getting blocks
 						 * from the offset (blocks[ofs / sector_size]) */
@@ -130,6 +384,36 @@ struct jffs2_sb_info {
 
 	uint32_t wbuf_pagesize; /* 0 for NOR and other flashes with no wbuf */
 
+	/* Nodes obsoleted in core but still ACCURATE on the flash. Cleared
+	   in offset order by the GC thread, or when the queue fills up, and
+	   forgotten when their block is erased. Protected by erase_free_sem.
+	   See nodemgmt.c */
+	struct jffs2_obsolete_ent obs_queue[JFFS2_OBSOLETE_QUEUE];
+	uint32_t obs_queued;
+	uint32_t obs_marked;		/* Nodes marked on the flash */
+	uint32_t obs_dropped;		/* ...or not, as their block went first */
+
+	/* What's in obsoleted dirents, by flash offset, so that GC of a
+	   deletion dirent can pick out the ones which might have its name
+	   without reading them all. Forgotten when their block is erased.
+	   Protected by erase_free_sem. See nodelist.c */
+	struct jffs2_obsd *obsd_hash[JFFS2_OBSD_HASH];
+	uint32_t obsd_count;
+	uint32_t obsd_hits;		/* Flash reads it saved */
+
+	/* Write-combining buffer for NOR (CONFIG_JFFS2_FS_NOR_WCBUF). Holds
+	   data destined for [wcbuf_ofs, wcbuf_ofs + wcbuf_len), which never
+	   crosses a wcbuf_size boundary. See writev.c */
+	struct pthread_mutex wcbuf_sem;
+	uint32_t *wcbuf;		/* NULL: write straight to the flash */
+	uint32_t wcbuf_size;		/* The device's program page, a power of two */
+	uint32_t wcbuf_ofs;
+	uint32_t wcbuf_len;
+	uint64_t wcbuf_stamp;		/* When the first byte went in */
+	uint32_t wcbuf_writes;		/* Writes absorbed by the buffer */
+	uint32_t wcbuf_programs;	/* Flash program operations issued for them */
+	uint32_t wcbuf_lost;		/* Nodes lost when programming the buffer failed */
+
 #ifdef CONFIG_JFFS2_FS_WBUF_VERIFY
 	unsigned char *wbuf_verify; /* read-back buffer for verification */
 #endif
@@ -174,8 +458,14 @@ struct super_block {
 	void			*s_dev;
 
 	UINT32			s_lock;			/* Lock the inode cache */
-	EVENT_CB_S		s_gc_thread_flags;	/* Communication with the gcthread */
-	unsigned int		s_gc_thread;
+	EVENT_CB_S		s_gc_thread_flags;	/* GC workers let go of us at umount */
+	EVENT_CB_S		s_check_flags;		/* Checker thread n sets bit n on exit */
+	unsigned int		s_check_thread[JFFS2_CHECK_THREADS_MAX];
+	EVENT_CB_S		s_ra_flags;		/* Communication with the read-ahead task */
+	unsigned int		s_ra_thread;
+	EVENT_CB_S		s_aio_flags;		/* ... and the async write tasks */
+	unsigned int		s_aio_compr_thread;
+	unsigned int		s_aio_write_thread;
 	unsigned long		s_mount_flags;
 };
 
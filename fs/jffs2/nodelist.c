@@ -22,6 +22,126 @@
 static void jffs2_obsolete_node_frag(struct jffs2_sb_info *c,
 				     struct jffs2_node_frag *this);
 
+/*
+ * Obsolete dirent index.
+ *
+ * Where we can't mark nodes obsolete on the flash, a deletion dirent may
+ * only be thrown away once no older dirent with its name is left in any
+ * other block, and jffs2_garbage_collect_deletion_dirent() has to work
+ * that out from the directory's obsolete nodes. So whenever we obsolete
+ * a dirent we note its name CRC and length here, by flash offset, and GC
+ * only needs to read the ones which match. Whatever it does have to read
+ * it notes as well. An entry describes the node at that offset, which
+ * doesn't change until the block is erased, so it can't go stale.
+ */
+struct jffs2_obsd {
+	struct jffs2_obsd *next;
+	uint32_t ofs;
+	uint32_t name_crc;
+	uint32_t nsize;		/* 0 if it isn't a dirent with a name to delete */
+};
+
+#define obsd_hash(ofs) (((ofs) >> 2) & (JFFS2_OBSD_HASH - 1))
+
+/* Called with erase_free_sem held */
+void __jffs2_obsd_add(struct jffs2_sb_info *c, uint32_t ofs, uint32_t name_crc, uint32_t nsize)
+{
+	struct jffs2_obsd *o;
+
+	/* Read-only, GC isn't going to ask */
+	if (jffs2_can_mark_obsolete(c) || jffs2_is_readonly(c))
+		return;
+
+	for (o = c->obsd_hash[obsd_hash(ofs)]; o; o = o->next) {
+		if (o->ofs == ofs) {
+			o->name_crc = name_crc;
+			o->nsize = nsize;
+			return;
+		}
+	}
+
+	/* GC will just have to read the rest */
+	if (c->obsd_count >= JFFS2_OBSD_MAX)
+		return;
+	o = kmalloc(sizeof(*o), GFP_KERNEL);
+	if (!o)
+		return;
+
+	o->ofs = ofs;
+	o->name_crc = name_crc;
+	o->nsize = nsize;
+	o->next = c->obsd_hash[obsd_hash(ofs)];
+	c->obsd_hash[obsd_hash(ofs)] = o;
+	c->obsd_count++;
+}
+
+/* Note the dirent we've just obsoleted */
+void jffs2_obsd_add_fd(struct jffs2_sb_info *c, struct jffs2_full_dirent *fd)
+{
+	uint32_t len;
+
+	if (jffs2_can_mark_obsolete(c) || jffs2_is_readonly(c) || !fd->raw)
+		return;
+
+	len = strlen((const char *)fd->name);
+	mutex_lock(&c->erase_free_sem);
+	if (fd->ino)
+		__jffs2_obsd_add(c, ref_offset(fd->raw), crc32(0, fd->name, len), len);
+	else
+		__jffs2_obsd_add(c, ref_offset(fd->raw), 0, 0);
+	mutex_unlock(&c->erase_free_sem);
+}
+
+/* Do we know what's in the node at ofs? Called with erase_free_sem held */
+int jffs2_obsd_lookup(struct jffs2_sb_info *c, uint32_t ofs, uint32_t *name_crc, uint32_t *nsize)
+{
+	struct jffs2_obsd *o;
+
+	for (o = c->obsd_hash[obsd_hash(ofs)]; o; o = o->next) {
+		if (o->ofs == ofs) {
+			*name_crc = o->name_crc;
+			*nsize = o->nsize;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Forget the block's nodes, which are about to be erased. Called with
+   erase_free_sem held */
+void jffs2_obsd_drop(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
+{
+	struct jffs2_obsd **p, *o;
+	int i;
+
+	for (i = 0; c->obsd_count && i < JFFS2_OBSD_HASH; i++) {
+		p = &c->obsd_hash[i];
+		while ((o = *p)) {
+			if (o->ofs / c->sector_size == jeb->offset / c->sector_size) {
+				*p = o->next;
+				kfree(o);
+				c->obsd_count--;
+			} else {
+				p = &o->next;
+			}
+		}
+	}
+}
+
+static void jffs2_obsd_free(struct jffs2_sb_info *c)
+{
+	struct jffs2_obsd *o;
+	int i;
+
+	for (i = 0; i < JFFS2_OBSD_HASH; i++) {
+		while ((o = c->obsd_hash[i])) {
+			c->obsd_hash[i] = o->next;
+			kfree(o);
+		}
+	}
+	c->obsd_count = 0;
+}
+
 void jffs2_add_fd_to_list(struct jffs2_sb_info *c, struct jffs2_full_dirent *new, struct jffs2_full_dirent **list)
 {
 	struct jffs2_full_dirent **prev = list;
@@ -35,6 +155,7 @@ void jffs2_add_fd_to_list(struct jffs2_sb_info *c, struct jffs2_full_dirent *new
 				dbg_dentlist("Eep! Marking new dirent node obsolete, old is \"%s\", ino #%u\n",
 					(*prev)->name, (*prev)->ino);
 				jffs2_mark_node_obsolete(c, new->raw);
+				jffs2_obsd_add_fd(c, new);
 				jffs2_free_full_dirent(new);
 			} else {
 				dbg_dentlist("marking old dirent \"%s\", ino #%u obsolete\n",
@@ -42,8 +163,10 @@ void jffs2_add_fd_to_list(struct jffs2_sb_info *c, struct jffs2_full_dirent *new
 				new->next = (*prev)->next;
 				/* It may have been a 'placeholder' deletion dirent,
 				   if jffs2_can_mark_obsolete() (see jffs2_do_unlink()) */
-				if ((*prev)->raw)
+				if ((*prev)->raw) {
 					jffs2_mark_node_obsolete(c, ((*prev)->raw));
+					jffs2_obsd_add_fd(c, *prev);
+				}
 				jffs2_free_full_dirent(*prev);
 				*prev = new;
 			}
@@ -522,6 +645,7 @@ void jffs2_free_raw_node_refs(struct jffs2_sb_info *c)
 		}
 		c->blocks[i].first_node = c->blocks[i].last_node = NULL;
 	}
+	jffs2_obsd_free(c);
 }
 
 struct jffs2_node_frag *jffs2_lookup_node_frag(struct rb_root *fragtree, uint32_t offset)
@@ -151,6 +151,14 @@ static inline struct jffs2_inode_cache *jffs2_raw_ref_to_ic(struct jffs2_raw_nod
    throw them away when appropriate */
 #define dirent_node_state(rd)	( (je32_to_cpu((rd)->ino)?REF_PRISTINE:REF_NORMAL) )
 
+/* Data nodes are REF_PRISTINE if they cover at least a whole page, or if
+   they start at the beginning of a page and run to the end of the file,
+   or if they're hole nodes */
+#define dnode_node_state(ri)	( ((je32_to_cpu((ri)->dsize) >= PAGE_CACHE_SIZE) || \
+				   (((je32_to_cpu((ri)->offset) & (PAGE_CACHE_SIZE-1)) == 0) && \
+				    (je32_to_cpu((ri)->dsize) + je32_to_cpu((ri)->offset) == \
+				     je32_to_cpu((ri)->isize)))) ? REF_PRISTINE : REF_NORMAL )
+
 /* NB: REF_PRISTINE for an inode-less node (ref->next_in_ino == NULL) indicates
    it is an unknown node of type JFFS2_NODETYPE_RWCOMPAT_COPY, so it'll get
    copied. If you need to do anything different to GC inode-less nodes, then
@@ -204,6 +212,8 @@ struct jffs2_inode_cache {
 #define INOCACHE_HASHSIZE 128
 
 #define INO_FLAGS_XATTR_CHECKED	0x01	/* has no duplicate xattr_ref */
+#define INO_FLAGS_EVICTED	0x02	/* in-core inode was evicted from the LRU */
+#define INO_FLAGS_WRITE_ERR	0x04	/* a node was lost to a failed flash program */
 
 #define RAWNODE_CLASS_INODE_CACHE	0
 #define RAWNODE_CLASS_XATTR_DATUM	1
@@ -268,6 +278,24 @@ struct jffs2_full_dirent
 	unsigned char name[0];
 };
 
+/*
+  One of several nodes written together with jffs2_write_nodes(), so
+  that related nodes (an inode and its dirent, say) cost one reservation
+  and one flash write between them
+*/
+#define JFFS2_MULTI_MAX 2
+
+struct jffs2_multi_node
+{
+	void *hdr;		/* raw_inode or raw_dirent, CRCs done */
+	uint32_t hdrlen;
+	const unsigned char *data; /* Data or name following it, if any */
+	uint32_t datalen;
+	uint32_t state;		/* REF_PRISTINE or REF_NORMAL */
+	struct jffs2_inode_cache *ic;
+	struct jffs2_raw_node_ref *raw; /* Set once it's written */
+};
+
 /*
   Fragments - used to build a map of which raw node to obtain
   data from for each part of the ino
@@ -319,6 +347,27 @@ static inline int jffs2_blocks_use_vmalloc(struct jffs2_sb_info *c)
 
 #define PAD(x) (((x)+3)&~3)
 
+#if JFFS2_TRACE_ENTRIES
+void jffs2_trace(struct jffs2_sb_info *c, uint16_t event, uint32_t a, uint32_t b);
+#else
+#define jffs2_trace(c, event, a, b) do { } while (0)
+#endif
+
+static inline void jffs2_lat_hist_add(struct jffs2_lat_hist *h, uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	int n = 0;
+
+	while (us > 1 && n < JFFS2_LAT_HIST_BUCKETS - 1) {
+		us >>= 1;
+		n++;
+	}
+	LOS_AtomicInc(&h->count[n]);
+	LOS_Atomic64Add(&h->total_ns, (INT64)ns);
+	if ((INT64)ns > LOS_Atomic64Read(&h->max_ns))
+		LOS_Atomic64Set(&h->max_ns, (INT64)ns);
+}
+
 
 static inline struct jffs2_node_frag *frag_first(struct rb_root *root)
 {
@@ -360,6 +409,10 @@ static inline struct jffs2_node_frag *frag_last(struct rb_root *root)
 
 /* nodelist.c */
 void jffs2_add_fd_to_list(struct jffs2_sb_info *c, struct jffs2_full_dirent *new, struct jffs2_full_dirent **list);
+void __jffs2_obsd_add(struct jffs2_sb_info *c, uint32_t ofs, uint32_t name_crc, uint32_t nsize);
+void jffs2_obsd_add_fd(struct jffs2_sb_info *c, struct jffs2_full_dirent *fd);
+int jffs2_obsd_lookup(struct jffs2_sb_info *c, uint32_t ofs, uint32_t *name_crc, uint32_t *nsize);
+void jffs2_obsd_drop(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb);
 void jffs2_set_inocache_state(struct jffs2_sb_info *c, struct jffs2_inode_cache *ic, int state);
 struct jffs2_inode_cache *jffs2_get_ino_cache(struct jffs2_sb_info *c, uint32_t ino);
 void jffs2_add_ino_cache (struct jffs2_sb_info *c, struct jffs2_inode_cache *new);
@@ -382,6 +435,9 @@ extern uint32_t __jffs2_ref_totlen(struct jffs2_sb_info *c,
 int jffs2_thread_should_wake(struct jffs2_sb_info *c);
 int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
 			uint32_t *len, int prio, uint32_t sumsize);
+int jffs2_reserve_space_budget(struct jffs2_sb_info *c, uint32_t minsize,
+			       uint32_t *len, int prio, uint32_t sumsize,
+			       unsigned int budget_ms);
 int jffs2_reserve_space_gc(struct jffs2_sb_info *c, uint32_t minsize,
 			uint32_t *len, uint32_t sumsize);
 struct jffs2_raw_node_ref *jffs2_add_physical_node_ref(struct jffs2_sb_info *c, 
@@ -389,6 +445,9 @@ struct jffs2_raw_node_ref *jffs2_add_physical_node_ref(struct jffs2_sb_info *c,
 						       struct jffs2_inode_cache *ic);
 void jffs2_complete_reservation(struct jffs2_sb_info *c);
 void jffs2_mark_node_obsolete(struct jffs2_sb_info *c, struct jffs2_raw_node_ref *raw);
+void jffs2_flush_obsolete(struct jffs2_sb_info *c);
+int jffs2_seal_nextblock(struct jffs2_sb_info *c);
+void jffs2_drop_obsolete(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb);
 
 /* write.c */
 int jffs2_do_new_inode(struct jffs2_sb_info *c, struct jffs2_inode_info *f, uint32_t mode, struct jffs2_raw_inode *ri);
@@ -399,9 +458,24 @@ struct jffs2_full_dnode *jffs2_write_dnode(struct jffs2_sb_info *c, struct jffs2
 struct jffs2_full_dirent *jffs2_write_dirent(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 					     struct jffs2_raw_dirent *rd, const unsigned char *name,
 					     uint32_t namelen, int alloc_mode);
+int jffs2_write_nodes(struct jffs2_sb_info *c, struct jffs2_multi_node *nodes, int nr);
+int jffs2_write_compr_node(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+			   struct jffs2_raw_inode *ri, unsigned char *comprbuf,
+			   uint16_t comprtype, uint32_t offset, uint32_t datalen,
+			   uint32_t cdatalen, int *write_failed);
 int jffs2_write_inode_range(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 			    struct jffs2_raw_inode *ri, unsigned char *buf,
 			    uint32_t offset, uint32_t writelen, uint32_t *retlen);
+int jffs2_write_inode_range_budget(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+				   struct jffs2_raw_inode *ri, unsigned char *buf,
+				   uint32_t offset, uint32_t writelen, uint32_t *retlen,
+				   unsigned int budget_ms);
+int jffs2_wb_flush(struct jffs2_sb_info *c, struct jffs2_inode_info *f);
+void jffs2_wb_discard(struct jffs2_sb_info *c, struct jffs2_inode_info *f);
+void jffs2_wb_attr_dirty(struct jffs2_sb_info *c, struct jffs2_inode_info *f, int dirty);
+void jffs2_wb_set_attr(struct jffs2_inode_info *f, struct jffs2_raw_inode *ri);
+void jffs2_wb_overlay(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+		      unsigned char *buf, uint32_t offset, uint32_t len);
 int jffs2_do_create(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f,
 		    struct jffs2_inode_info *f, struct jffs2_raw_inode *ri,
 		    const char *name, int namelen);
@@ -409,6 +483,10 @@ int jffs2_do_unlink(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f, con
 		    int namelen, struct jffs2_inode_info *dead_f, uint32_t time);
 int jffs2_do_link(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f, uint32_t ino,
 		   uint8_t type, const char *name, int namelen, uint32_t time);
+int jffs2_do_rename(struct jffs2_sb_info *c, struct jffs2_inode_info *old_dir_f,
+		    const char *old_name, int old_namelen,
+		    struct jffs2_inode_info *new_dir_f, uint32_t ino, uint8_t type,
+		    const char *new_name, int new_namelen, uint32_t time);
 
 
 /* readinode.c */
@@ -452,6 +530,11 @@ int jffs2_garbage_collect_pass(struct jffs2_sb_info *c);
 int jffs2_read_dnode(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 		     struct jffs2_full_dnode *fd, unsigned char *buf,
 		     int ofs, int len);
+void jffs2_ra_prefetch(struct jffs2_sb_info *c, struct jffs2_inode_info *f, uint32_t offset);
+void jffs2_ra_drop(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb);
+void jffs2_ra_free(struct jffs2_sb_info *c);
+int jffs2_read_inode_range_nolock(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+				  unsigned char *buf, uint32_t offset, uint32_t len);
 int jffs2_read_inode_range(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 			   unsigned char *buf, uint32_t offset, uint32_t len);
 char *jffs2_getlink(struct jffs2_sb_info *c, struct jffs2_inode_info *f);
@@ -39,11 +39,13 @@
 static int jffs2_do_reserve_space(struct jffs2_sb_info *c,  uint32_t minsize,
 				  uint32_t *len, uint32_t sumsize);
 
-int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
-			uint32_t *len, int prio, uint32_t sumsize)
+static int __jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
+				 uint32_t *len, int prio, uint32_t sumsize,
+				 uint64_t deadline)
 {
 	int ret = -EAGAIN;
 	int blocksneeded = c->resv_blocks_write;
+	uint64_t gc_start;
 	/* align it */
 	minsize = PAD(minsize);
 
@@ -54,10 +56,13 @@ int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
 
 	spin_lock(&c->erase_completion_lock);
 
+	/* Tell the GC thread we're busy, so it leaves the flash to us */
+	c->gc_fg_reserves++;
+
 	/* this needs a little more thought (true <tglx> :)) */
 	while(ret == -EAGAIN) {
 		while(c->nr_free_blocks + c->nr_erasing_blocks < blocksneeded) {
-			uint32_t dirty, avail;
+			uint32_t dirty, avail, ledger;
 
 			/* calculate real dirty size
 			 * dirty_size contains blocks on erase_pending_list
@@ -97,6 +102,24 @@ int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
 			 * the check above passes.
 			 */
 			avail = c->free_size + c->dirty_size + c->erasing_size + c->unchecked_size;
+
+			/* Outstanding async writes have been promised aio_ledger
+			 * bytes of that, and this had better not take it from them
+			 * unless it's one of them. If they're all that's in the way,
+			 * get them written out and look again: their reservations
+			 * are pessimistic, so that should leave some over.
+			 */
+			ledger = jffs2_aio_is_current(c) ? 0 : c->aio_ledger;
+			if (ledger && (avail / c->sector_size) > blocksneeded &&
+			    ((avail - min(avail, ledger)) / c->sector_size) <= blocksneeded) {
+				spin_unlock(&c->erase_completion_lock);
+				mutex_unlock(&c->alloc_sem);
+				jffs2_aio_drain(c);
+				mutex_lock(&c->alloc_sem);
+				spin_lock(&c->erase_completion_lock);
+				continue;
+			}
+
 			if ( (avail / c->sector_size) <= blocksneeded) {
 				if (prio == ALLOC_DELETION && c->nr_free_blocks + c->nr_erasing_blocks >= c->resv_blocks_deletion) {
 					jffs2_dbg(1, "%s(): Low on possibly available space, but it's a deletion. Allowing...\n",
@@ -123,10 +146,23 @@ int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
 				  c->flash_size);
 			spin_unlock(&c->erase_completion_lock);
 
+			gc_start = jffs2_now_ns();
 			ret = jffs2_garbage_collect_pass(c);
+			c->gc_fg_passes++;
+			c->gc_fg_pass_ns += jffs2_now_ns() - gc_start;
 			if (ret)
 				return ret;
 
+			if (deadline && jffs2_now_ns() >= deadline) {
+				/* Out of time. Let the GC thread carry on
+				   and have the caller come back later */
+				jffs2_dbg(1, "%s(): GC budget exhausted, returning -EAGAIN\n",
+					  __func__);
+				c->resv_budget_exceeded++;
+				jffs2_garbage_collect_trigger(c);
+				return -EAGAIN;
+			}
+
 			cond_resched();
 
 			if (signal_pending(current))
@@ -150,6 +186,41 @@ int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
 	return ret;
 }
 
+int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
+			uint32_t *len, int prio, uint32_t sumsize)
+{
+	return jffs2_reserve_space_budget(c, minsize, len, prio, sumsize, 0);
+}
+
+/**
+ *	jffs2_reserve_space_budget - reserve space, bounding the GC done inline
+ *	@budget_ms: How long we may spend garbage collecting, or zero for no limit
+ *
+ *	As jffs2_reserve_space(), except that once @budget_ms has been spent on
+ *	garbage collection it returns -EAGAIN instead of carrying on. The GC
+ *	thread is kicked to continue in the background. A GC pass is never
+ *	interrupted, so the budget can be overrun by up to one pass.
+ *
+ *	Only use this where the caller can cope with -EAGAIN; deletions in
+ *	particular should always go through jffs2_reserve_space().
+ */
+int jffs2_reserve_space_budget(struct jffs2_sb_info *c, uint32_t minsize,
+			       uint32_t *len, int prio, uint32_t sumsize,
+			       unsigned int budget_ms)
+{
+	uint64_t start = jffs2_now_ns();
+	uint64_t deadline = budget_ms ? start + (uint64_t)budget_ms * 1000000 : 0;
+	int ret;
+
+	if (jffs2_is_readonly(c))
+		return -EROFS;
+
+	ret = __jffs2_reserve_space(c, minsize, len, prio, sumsize, deadline);
+	jffs2_lat_hist_add(&c->stats.resv_lat, jffs2_now_ns() - start);
+	jffs2_trace(c, JFFS2_TR_RESERVE, minsize, (jffs2_now_ns() - start) / 1000);
+	return ret;
+}
+
 int jffs2_reserve_space_gc(struct jffs2_sb_info *c, uint32_t minsize,
 			   uint32_t *len, uint32_t sumsize)
 {
@@ -287,10 +358,52 @@ static int jffs2_find_nextblock(struct jffs2_sb_info *c)
 
 	jffs2_dbg(1, "%s(): new nextblock = 0x%08x\n",
 		  __func__, c->nextblock->offset);
+	jffs2_trace(c, JFFS2_TR_NEXTBLOCK, c->nextblock->offset, c->nr_free_blocks);
 
 	return 0;
 }
 
+/*
+ * Write out the summary collected for nextblock, so that the next mount
+ * need not scan it node by node. Called at clean umount and sync.
+ *
+ * If there is room for it twice over, a continuation summary goes in and
+ * the block stays open; otherwise it is nearly full anyway, so it gets
+ * its final summary and is closed.
+ */
+int jffs2_seal_nextblock(struct jffs2_sb_info *c)
+{
+	struct jffs2_eraseblock *jeb;
+	int ret = 0;
+
+	if (!jffs2_sum_active())
+		return 0;
+
+	mutex_lock(&c->alloc_sem);
+	spin_lock(&c->erase_completion_lock);
+	jeb = c->nextblock;
+	if (!jeb || jffs2_sum_is_disabled(c->summary) || !c->summary->sum_num ||
+	    c->summary->sum_cont_ref == jeb->last_node) {
+		/* Nothing to say, or nothing new since last time */
+		goto out;
+	}
+
+	if (2 * PAD(c->summary->sum_size + JFFS2_SUMMARY_FRAME_SIZE) <= jeb->free_size) {
+		spin_unlock(&c->erase_completion_lock);
+		ret = jffs2_sum_write_contnode(c);
+		spin_lock(&c->erase_completion_lock);
+	} else {
+		jffs2_dbg(1, "%s(): closing nextblock 0x%08x\n", __func__, jeb->offset);
+		ret = jffs2_sum_write_sumnode(c);
+		if (!ret && !jffs2_sum_is_disabled(c->summary))
+			jffs2_close_nextblock(c, jeb);
+	}
+ out:
+	spin_unlock(&c->erase_completion_lock);
+	mutex_unlock(&c->alloc_sem);
+	return ret;
+}
+
 /* Called with alloc sem _and_ erase_completion_lock */
 static int jffs2_do_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
 				  uint32_t *len, uint32_t sumsize)
@@ -517,13 +630,150 @@ static inline int on_list(struct list_head *obj, struct list_head *head)
 	return 0;
 }
 
+/* Clear the ACCURATE bit of an obsoleted node on the flash, and take it
+   off its inode's list. Called with erase_free_sem held */
+static void jffs2_obliterate_node(struct jffs2_sb_info *c, struct jffs2_raw_node_ref *ref,
+				  uint32_t freed_len)
+{
+	struct jffs2_unknown_node n;
+	size_t retlen;
+	int ret;
+
+	jffs2_dbg(1, "obliterating obsoleted node at 0x%08x\n",
+		  ref_offset(ref));
+	ret = jffs2_flash_read(c, ref_offset(ref), sizeof(n), &retlen, (char *)&n);
+	if (ret) {
+		pr_warn("Read error reading from obsoleted node at 0x%08x: %d\n",
+			ref_offset(ref), ret);
+		return;
+	}
+	if (retlen != sizeof(n)) {
+		pr_warn("Short read from obsoleted node at 0x%08x: %zd\n",
+			ref_offset(ref), retlen);
+		return;
+	}
+	if (PAD(je32_to_cpu(n.totlen)) != PAD(freed_len)) {
+		pr_warn("Node totlen on flash (0x%08x) != totlen from node ref (0x%08x)\n",
+			je32_to_cpu(n.totlen), freed_len);
+		return;
+	}
+	if (!(je16_to_cpu(n.nodetype) & JFFS2_NODE_ACCURATE)) {
+		jffs2_dbg(1, "Node at 0x%08x was already marked obsolete (nodetype 0x%04x)\n",
+			  ref_offset(ref), je16_to_cpu(n.nodetype));
+		return;
+	}
+	/* XXX FIXME: This is ugly now */
+	n.nodetype = cpu_to_je16(je16_to_cpu(n.nodetype) & ~JFFS2_NODE_ACCURATE);
+	ret = jffs2_flash_write(c, ref_offset(ref), sizeof(n), &retlen, (const u_char *)&n);
+	if (ret) {
+		pr_warn("Write error in obliterating obsoleted node at 0x%08x: %d\n",
+			ref_offset(ref), ret);
+		return;
+	}
+	if (retlen != sizeof(n)) {
+		pr_warn("Short write in obliterating obsoleted node at 0x%08x: %zd\n",
+			ref_offset(ref), retlen);
+		return;
+	}
+
+	/* Nodes which have been marked obsolete no longer need to be
+	   associated with any inode. Remove them from the per-inode list.
+
+	   Note we can't do this for NAND at the moment because we need
+	   obsolete dirent nodes to stay on the lists, because of the
+	   horridness in jffs2_garbage_collect_deletion_dirent(). Also
+	   because we delete the inocache, and on NAND we need that to
+	   stay around until all the nodes are actually erased, in order
+	   to stop us from giving the same inode number to another newly
+	   created inode. */
+	if (ref->next_in_ino) {
+		struct jffs2_inode_cache *ic;
+		struct jffs2_raw_node_ref **p;
+
+		spin_lock(&c->erase_completion_lock);
+
+		ic = jffs2_raw_ref_to_ic(ref);
+		for (p = &ic->nodes; (*p) != ref; p = &((*p)->next_in_ino))
+			;
+
+		*p = ref->next_in_ino;
+		ref->next_in_ino = NULL;
+
+		switch (ic->class) {
+#ifdef CONFIG_JFFS2_FS_XATTR
+			case RAWNODE_CLASS_XATTR_DATUM:
+				jffs2_release_xattr_datum(c, (struct jffs2_xattr_datum *)ic);
+				break;
+			case RAWNODE_CLASS_XATTR_REF:
+				jffs2_release_xattr_ref(c, (struct jffs2_xattr_ref *)ic);
+				break;
+#endif
+			default:
+				if (ic->nodes == (void *)ic && ic->pino_nlink == 0)
+					jffs2_del_ino_cache(c, ic);
+				break;
+		}
+		spin_unlock(&c->erase_completion_lock);
+	}
+}
+
+static void __jffs2_flush_obsolete(struct jffs2_sb_info *c)
+{
+	struct jffs2_obsolete_ent ent;
+	uint32_t i, j;
+
+	/* Sort by offset, so we go through the flash in order */
+	for (i = 1; i < c->obs_queued; i++) {
+		ent = c->obs_queue[i];
+		for (j = i; j && ref_offset(c->obs_queue[j-1].ref) > ref_offset(ent.ref); j--)
+			c->obs_queue[j] = c->obs_queue[j-1];
+		c->obs_queue[j] = ent;
+	}
+
+	/* Even a block with nothing left in it but dirt needs them. It may
+	   not get erased before the power goes, and then a node it held
+	   which hasn't been marked would come back */
+	for (i = 0; i < c->obs_queued; i++) {
+		jffs2_obliterate_node(c, c->obs_queue[i].ref, c->obs_queue[i].len);
+		c->obs_marked++;
+	}
+	c->obs_queued = 0;
+}
+
+/* Mark queued obsolete nodes on the flash. The GC thread does this when
+   it has nothing better to do, and it has to be done before anything
+   which counts on a node being marked: erasing a block which may hold
+   what made it obsolete, dropping a deletion dirent on NOR, and fsync */
+void jffs2_flush_obsolete(struct jffs2_sb_info *c)
+{
+	if (!c->obs_queued)
+		return;
+	mutex_lock(&c->erase_free_sem);
+	__jffs2_flush_obsolete(c);
+	mutex_unlock(&c->erase_free_sem);
+}
+
+/* The block is about to be erased and its node refs freed. Called with
+   erase_free_sem held */
+void jffs2_drop_obsolete(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
+{
+	uint32_t i, j = 0;
+
+	for (i = 0; i < c->obs_queued; i++) {
+		if (c->obs_queue[i].ref->flash_offset / c->sector_size == jeb->offset / c->sector_size) {
+			c->obs_dropped++;
+			continue;
+		}
+		c->obs_queue[j++] = c->obs_queue[i];
+	}
+	c->obs_queued = j;
+}
+
 void jffs2_mark_node_obsolete(struct jffs2_sb_info *c, struct jffs2_raw_node_ref *ref)
 {
 	struct jffs2_eraseblock *jeb;
 	int blocknr;
-	struct jffs2_unknown_node n;
-	int ret, addedsize;
-	size_t retlen;
+	int addedsize;
 	uint32_t freed_len;
 	struct super_block *sb;
 	struct MtdNorDev *device;
@@ -560,6 +810,7 @@ void jffs2_mark_node_obsolete(struct jffs2_sb_info *c, struct jffs2_raw_node_ref
 	spin_lock(&c->erase_completion_lock);
 
 	freed_len = ref_totlen(c, jeb, ref);
+	jffs2_trace(c, JFFS2_TR_OBSOLETE, ref_offset(ref), freed_len);
 
 	if (ref_flags(ref) == REF_UNCHECKED) {
 		D1(if (unlikely(jeb->unchecked_size < freed_len)) {
@@ -619,12 +870,14 @@ void jffs2_mark_node_obsolete(struct jffs2_sb_info *c, struct jffs2_raw_node_ref
 	jffs2_dbg_acct_sanity_check_nolock(c, jeb);
 	jffs2_dbg_acct_paranoia_check_nolock(c, jeb);
 
-	if (c->flags & JFFS2_SB_FLAG_SCANNING) {
+	if ((c->flags & JFFS2_SB_FLAG_SCANNING) || jffs2_is_readonly(c)) {
 		/* Flash scanning is in progress. Don't muck about with the block
 		   lists because they're not ready yet, and don't actually
 		   obliterate nodes that look obsolete. If they weren't
 		   marked obsolete on the flash at the time they _became_
-		   obsolete, there was probably a reason for that. */
+		   obsolete, there was probably a reason for that.
+		   Read-only, nothing is going to GC or erase the block, so
+		   there's no list worth moving it to either. */
 		spin_unlock(&c->erase_completion_lock);
 		/* We didn't lock the erase_free_sem */
 		return;
@@ -695,86 +948,21 @@ void jffs2_mark_node_obsolete(struct jffs2_sb_info *c, struct jffs2_raw_node_ref
 	/* The erase_free_sem is locked, and has been since before we marked the node obsolete
 	   and potentially put its eraseblock onto the erase_pending_list. Thus, we know that
 	   the block hasn't _already_ been erased, and that 'ref' itself hasn't been freed yet
-	   by jffs2_free_jeb_node_refs() in erase.c. Which is nice. */
+	   by jffs2_free_jeb_node_refs() in erase.c. Which is nice.
 
-	jffs2_dbg(1, "obliterating obsoleted node at 0x%08x\n",
-		  ref_offset(ref));
-	ret = jffs2_flash_read(c, ref_offset(ref), sizeof(n), &retlen, (char *)&n);
-	if (ret) {
-		pr_warn("Read error reading from obsoleted node at 0x%08x: %d\n",
-			ref_offset(ref), ret);
-		goto out_erase_sem;
-	}
-	if (retlen != sizeof(n)) {
-		pr_warn("Short read from obsoleted node at 0x%08x: %zd\n",
-			ref_offset(ref), retlen);
-		goto out_erase_sem;
-	}
-	if (PAD(je32_to_cpu(n.totlen)) != PAD(freed_len)) {
-		pr_warn("Node totlen on flash (0x%08x) != totlen from node ref (0x%08x)\n",
-			je32_to_cpu(n.totlen), freed_len);
-		goto out_erase_sem;
-	}
-	if (!(je16_to_cpu(n.nodetype) & JFFS2_NODE_ACCURATE)) {
-		jffs2_dbg(1, "Node at 0x%08x was already marked obsolete (nodetype 0x%04x)\n",
-			  ref_offset(ref), je16_to_cpu(n.nodetype));
-		goto out_erase_sem;
-	}
-	/* XXX FIXME: This is ugly now */
-	n.nodetype = cpu_to_je16(je16_to_cpu(n.nodetype) & ~JFFS2_NODE_ACCURATE);
-	ret = jffs2_flash_write(c, ref_offset(ref), sizeof(n), &retlen, (const u_char *)&n);
-	if (ret) {
-		pr_warn("Write error in obliterating obsoleted node at 0x%08x: %d\n",
-			ref_offset(ref), ret);
-		goto out_erase_sem;
-	}
-	if (retlen != sizeof(n)) {
-		pr_warn("Short write in obliterating obsoleted node at 0x%08x: %zd\n",
-			ref_offset(ref), retlen);
-		goto out_erase_sem;
-	}
+	   Don't touch the flash now, though. Each of these is a read and a
+	   write, and a big unlink or truncate makes thousands of them. Queue
+	   it up for jffs2_flush_obsolete(); jffs2_drop_obsolete() forgets it
+	   again if the block is erased first. Until then it's only marked in
+	   RAM, so anyone who relies on it being on the flash has to flush
+	   the queue first. */
 
-	/* Nodes which have been marked obsolete no longer need to be
-	   associated with any inode. Remove them from the per-inode list.
-
-	   Note we can't do this for NAND at the moment because we need
-	   obsolete dirent nodes to stay on the lists, because of the
-	   horridness in jffs2_garbage_collect_deletion_dirent(). Also
-	   because we delete the inocache, and on NAND we need that to
-	   stay around until all the nodes are actually erased, in order
-	   to stop us from giving the same inode number to another newly
-	   created inode. */
-	if (ref->next_in_ino) {
-		struct jffs2_inode_cache *ic;
-		struct jffs2_raw_node_ref **p;
-
-		spin_lock(&c->erase_completion_lock);
-
-		ic = jffs2_raw_ref_to_ic(ref);
-		for (p = &ic->nodes; (*p) != ref; p = &((*p)->next_in_ino))
-			;
-
-		*p = ref->next_in_ino;
-		ref->next_in_ino = NULL;
-
-		switch (ic->class) {
-#ifdef CONFIG_JFFS2_FS_XATTR
-			case RAWNODE_CLASS_XATTR_DATUM:
-				jffs2_release_xattr_datum(c, (struct jffs2_xattr_datum *)ic);
-				break;
-			case RAWNODE_CLASS_XATTR_REF:
-				jffs2_release_xattr_ref(c, (struct jffs2_xattr_ref *)ic);
-				break;
-#endif
-			default:
-				if (ic->nodes == (void *)ic && ic->pino_nlink == 0)
-					jffs2_del_ino_cache(c, ic);
-				break;
-		}
-		spin_unlock(&c->erase_completion_lock);
-	}
+	if (c->obs_queued == JFFS2_OBSOLETE_QUEUE)
+		__jffs2_flush_obsolete(c);
+	c->obs_queue[c->obs_queued].ref = ref;
+	c->obs_queue[c->obs_queued].len = freed_len;
+	c->obs_queued++;
 
- out_erase_sem:
 	mutex_unlock(&c->erase_free_sem);
 }
 
@@ -16,6 +16,7 @@
 #include "fs/fs.h"
 #include "jffs2.h"
 #include "jffs2_fs_sb.h"
+#include "los_tick.h"
 
 
 /* jffs2 debug output opion */
@@ -23,6 +24,59 @@
 
 /* jffs2 gc thread section */
 #define JFFS2_GC_THREAD_PRIORITY  10 /* GC thread's priority */
+#define JFFS2_GC_IDLE_INTERVAL_MS 500 /* How often the GC thread looks for idle time */
+#define JFFS2_GC_IDLE_BATCH       8   /* Max GC passes per idle tick */
+#define JFFS2_GC_IDLE_EXTRA_BLOCKS 4  /* Idle GC target, in blocks above resv_blocks_gctrigger */
+#define JFFS2_GC_IDLE_BUSY_RESERVES 16 /* Reservations per idle tick that mean we're busy */
+#define JFFS2_GC_POOL_STALL_WEIGHT 4  /* How much more a block writers are short of counts */
+#ifdef LOSCFG_KERNEL_SMP
+#define JFFS2_GC_WORKERS min(LOSCFG_KERNEL_CORE_NUM, JFFS2_GC_WORKERS_MAX)
+#else
+#define JFFS2_GC_WORKERS 1            /* GC workers shared by all mounts */
+#endif
+#define JFFS2_RESV_BUDGET_MS      0   /* Default GC budget for non-blocking writes, 0 = unbounded */
+
+/* jffs2 GC recompression section */
+#define JFFS2_RECOMPR_AGE          (24 * 3600)  /* Seconds unmodified before data counts as cold */
+#define JFFS2_RECOMPR_RATE         (64 * 1024)  /* Cold data recompressed per second, 0 = never */
+
+/* jffs2 in-core inode cache section */
+#define JFFS2_ICACHE_BUDGET        (64 * 1024)  /* Bytes of unused inodes kept per mount */
+#define JFFS2_ICACHE_GLOBAL_BUDGET (256 * 1024) /* ... and across all mounts */
+
+/* jffs2 write-back cache section */
+#define JFFS2_WB_TIMEOUT_MS        0   /* Max age of cached data, 0 = write-through */
+#define JFFS2_WB_MAX_PAGES         16  /* Dirty pages per mount before we write some out */
+#define JFFS2_LAZY_ATTR            0   /* Keep attribute-only setattrs in core */
+
+/* jffs2 read-ahead section */
+#define JFFS2_RA_THREAD_PRIORITY   11  /* Read-ahead task's priority */
+#define JFFS2_RA_NODES             4   /* Nodes to read ahead of a sequential reader */
+#define JFFS2_RA_MIN_STREAK        2   /* Reads in a row before we call it sequential */
+
+#define RA_THREAD_FLAG_REQ 1
+#define RA_THREAD_FLAG_STOP 2
+#define RA_THREAD_FLAG_HAS_EXIT 4
+
+/* jffs2 asynchronous write section */
+#define JFFS2_AIO_THREAD_PRIORITY  10  /* Async compressor and writer tasks' priority */
+#define JFFS2_AIO_WAIT_MS          10  /* How often someone waiting on them looks again */
+
+/* jffs2 event trace section */
+#define JFFS2_TRACE_ENTRIES        512 /* Events kept per mount, a power of 2, 0 = no tracing */
+
+/* jffs2 background CRC check section */
+#define JFFS2_CHECK_THREAD_PRIORITY 12 /* Checker threads' priority */
+#ifdef LOSCFG_KERNEL_SMP
+#define JFFS2_CHECK_THREADS min(LOSCFG_KERNEL_CORE_NUM, JFFS2_CHECK_THREADS_MAX)
+#else
+#define JFFS2_CHECK_THREADS 1
+#endif
+
+/* NOR write-combining buffer: small node writes are gathered up and
+   programmed a page at a time */
+#define CONFIG_JFFS2_FS_NOR_WCBUF
+#define JFFS2_WCBUF_TIMEOUT_MS    500 /* Flush data that has been sitting this long */
 
 /* zlib section*/
 #define CONFIG_JFFS2_ZLIB
@@ -56,9 +110,11 @@ struct kvec;
 #define ITIME(sec) ((struct timespec){sec, 0})
 #define I_SEC(tv) ((tv).tv_sec)
 
+#define jffs2_now_ns() LOS_CurrNanosec()
+
 #define sleep_on_spinunlock(wq, sl) do {spin_unlock(sl); msleep(100);} while (0)
 
-#define jffs2_is_readonly(c) (0)
+#define jffs2_is_readonly(c) ((c)->mount_opts.rdonly)
 
 #define SECTOR_ADDR(x) ( (((unsigned long)(x) / c->sector_size) * c->sector_size) )
 
@@ -74,15 +130,25 @@ struct kvec;
 #define jffs2_cleanmarker_oob(c) (0)
 #define jffs2_write_nand_cleanmarker(c,jeb) (-EIO)
 
+#ifdef CONFIG_JFFS2_FS_NOR_WCBUF
+int jffs2_flash_write(struct jffs2_sb_info *c, loff_t ofs, size_t len, size_t *retlen, const u_char *buf);
+int jffs2_flash_read(struct jffs2_sb_info *c, loff_t ofs, size_t len, size_t *retlen, char *buf);
+int jffs2_flash_writev(struct jffs2_sb_info *c, const struct kvec *vecs, unsigned long count, loff_t to, size_t *retlen, uint32_t ino);
+int jffs2_flush_wcbuf(struct jffs2_sb_info *c);
+int jffs2_flush_wcbuf_stale(struct jffs2_sb_info *c);
+#else
 #define jffs2_flash_write(c, ofs, len, retlen, buf) jffs2_flash_direct_write(c, ofs, len, retlen, buf)
 #define jffs2_flash_read(c, ofs, len, retlen, buf) jffs2_flash_direct_read(c, ofs, len, retlen, buf)
+#define jffs2_flash_writev(a,b,c,d,e,f) jffs2_flash_direct_writev(a,b,c,d,e)
+#define jffs2_flush_wcbuf(c) (0)
+#define jffs2_flush_wcbuf_stale(c) (0)
+#endif
 #define jffs2_flush_wbuf_pad(c) (c=c)
 #define jffs2_flush_wbuf_gc(c, i) ({ do{} while(0); (void)(c), (void) i, 0; })
 #define jffs2_write_nand_badblock(c,jeb,p) (0)
 #define jffs2_nand_flash_setup(c) (0)
 #define jffs2_nand_flash_cleanup(c) do {} while(0)
 #define jffs2_wbuf_dirty(c) (0)
-#define jffs2_flash_writev(a,b,c,d,e,f) jffs2_flash_direct_writev(a,b,c,d,e)
 #define jffs2_wbuf_timeout NULL
 #define jffs2_wbuf_process NULL
 #define jffs2_dataflash(c) (0)
@@ -144,6 +210,23 @@ void jffs2_dirty_trigger(struct jffs2_sb_info *c);
 void jffs2_start_garbage_collect_thread(struct jffs2_sb_info *c);
 void jffs2_stop_garbage_collect_thread(struct jffs2_sb_info *c);
 void jffs2_garbage_collect_trigger(struct jffs2_sb_info *c);
+int jffs2_gc_thread_is_current(struct jffs2_sb_info *c);
+int jffs2_set_gc_workers(unsigned int n);
+void jffs2_start_ra_thread(struct jffs2_sb_info *c);
+void jffs2_stop_ra_thread(struct jffs2_sb_info *c);
+void jffs2_start_check_threads(struct jffs2_sb_info *c);
+void jffs2_stop_check_threads(struct jffs2_sb_info *c);
+void jffs2_check_hint(struct jffs2_sb_info *c, uint32_t ino);
+void jffs2_start_aio_threads(struct jffs2_sb_info *c);
+void jffs2_stop_aio_threads(struct jffs2_sb_info *c);
+int jffs2_aio_is_current(struct jffs2_sb_info *c);
+void jffs2_aio_wait_inode(struct jffs2_sb_info *c, struct jffs2_inode_info *f);
+void jffs2_aio_drain(struct jffs2_sb_info *c);
+typedef void (*jffs2_write_done_t)(void *priv, int ret, uint32_t written);
+int jffs2_write_async(struct jffs2_inode *inode, struct jffs2_raw_inode *ri,
+		      const unsigned char *buf, uint32_t offset, uint32_t len,
+		      jffs2_write_done_t done, void *priv);
+int jffs2_write_async_wait(struct jffs2_inode *inode);
 
 /* dir.c */
 struct jffs2_inode *jffs2_lookup(struct jffs2_inode *dir_i, const unsigned char *name, int namelen);
@@ -159,8 +242,11 @@ int jffs2_readdir(struct jffs2_inode *inode, off_t *offset, off_t *int_off, stru
 
 /* fs.c */
 int jffs2_setattr (struct jffs2_inode *inode, struct IATTR *attr);
+int jffs2_fsync(struct jffs2_inode *inode);
+int jffs2_wb_writeback(struct jffs2_sb_info *c, uint64_t before);
 struct jffs2_inode *jffs2_iget(struct super_block *sb, uint32_t ino);
 int jffs2_iput(struct jffs2_inode * i);
+void jffs2_iunpin(struct jffs2_inode *i);
 struct jffs2_inode *jffs2_new_inode (struct jffs2_inode *dir_i, int mode, struct jffs2_raw_inode *ri);
 
 void jffs2_gc_release_inode(struct jffs2_sb_info *c,
@@ -178,6 +264,7 @@ void jffs2_gc_release_page(struct jffs2_sb_info *c,
 void jffs2_flash_cleanup(struct jffs2_sb_info *c);
 
 int calculate_inocache_hashsize(uint32_t flash_size);
+void jffs2_icache_purge(struct jffs2_sb_info *c);
 
 /* writev.c */
 int jffs2_flash_direct_writev(struct jffs2_sb_info *c, const struct kvec *vecs,
@@ -191,6 +278,16 @@ int jffs2_flash_direct_read(struct jffs2_sb_info *c, loff_t ofs, size_t len,
 int jffs2_fill_super(struct super_block *sb);
 int jffs2_mount(int part_no, struct jffs2_inode **root_node, unsigned long mountflags);
 int jffs2_umount(struct jffs2_inode *root_node);
+void jffs2_set_mtd_writev(jffs2_mtd_writev_t writev);
+void jffs2_set_mtd_writesize(uint32_t writesize);
+int jffs2_set_writeback(struct jffs2_inode *root_node, unsigned int timeout_ms,
+			unsigned int max_pages);
+int jffs2_set_lazytime(struct jffs2_inode *root_node, bool on);
+int jffs2_sync_fs(struct jffs2_inode *root_node);
+int jffs2_get_stats(struct jffs2_inode *root_node, struct jffs2_stats *st);
+void jffs2_show_stats(struct jffs2_inode *root_node);
+int jffs2_get_trace(struct jffs2_inode *root_node, void *buf, size_t len);
+void jffs2_show_trace(struct jffs2_inode *root_node);
 
 #endif /* __JFFS2_OS_LINUX_H__ */
 
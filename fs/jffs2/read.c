@@ -19,6 +19,120 @@
 #include "los_crc32.h"
 #include "user_copy.h"
 
+/*
+ * Read-ahead cache. Nothing goes in here but whole nodes which are part of
+ * a file's fragtree at the time, put there by the read-ahead task while
+ * it holds the inode's sem. A node doesn't change while it's on the flash,
+ * and the GC has to have the sem exclusively to move it away, so the data
+ * for an offset stays good until the block is erased.
+ */
+static int jffs2_ra_read(struct jffs2_sb_info *c, struct jffs2_full_dnode *fd,
+			 unsigned char *buf, int ofs, int len, int *ret)
+{
+	struct jffs2_ra_slot *slot;
+	int found = 0;
+	int i;
+
+	mutex_lock(&c->ra_sem);
+	for (i = 0; i < JFFS2_RA_SLOTS; i++) {
+		slot = &c->ra_slot[i];
+		if (slot->len && slot->ofs == ref_offset(fd->raw) && ofs + len <= slot->len) {
+			*ret = LOS_CopyFromKernel(buf, len, slot->data + ofs, len) ? -EFAULT : 0;
+			c->ra_hits++;
+			found = 1;
+			break;
+		}
+	}
+	mutex_unlock(&c->ra_sem);
+	return found;
+}
+
+static int jffs2_ra_cached(struct jffs2_sb_info *c, uint32_t ofs)
+{
+	int i;
+
+	for (i = 0; i < JFFS2_RA_SLOTS; i++) {
+		if (c->ra_slot[i].len && c->ra_slot[i].ofs == ofs)
+			return 1;
+	}
+	return 0;
+}
+
+/* Read the nodes of the first JFFS2_RA_NODES frags at or after offset which
+   aren't cached already. Called by the read-ahead task, with f->sem held
+   shared */
+void jffs2_ra_prefetch(struct jffs2_sb_info *c, struct jffs2_inode_info *f, uint32_t offset)
+{
+	struct jffs2_node_frag *frag;
+	struct jffs2_full_dnode *fn;
+	struct jffs2_ra_slot *slot;
+	unsigned char *data;
+	int cached;
+	int n = 0;
+
+	for (frag = jffs2_lookup_node_frag(&f->fragtree, offset);
+	     frag && n < JFFS2_RA_NODES; frag = frag_next(frag)) {
+		fn = frag->node;
+		if (frag->ofs + frag->size <= offset || !fn || !fn->size)
+			continue;
+		n++;
+
+		mutex_lock(&c->ra_sem);
+		cached = jffs2_ra_cached(c, ref_offset(fn->raw));
+		mutex_unlock(&c->ra_sem);
+		if (cached)
+			continue;
+
+		data = kmalloc(fn->size, GFP_KERNEL);
+		if (!data)
+			break;
+		if (jffs2_read_dnode(c, f, fn, data, 0, fn->size)) {
+			kfree(data);
+			break;
+		}
+
+		mutex_lock(&c->ra_sem);
+		slot = &c->ra_slot[c->ra_clock];
+		c->ra_clock = (c->ra_clock + 1) % JFFS2_RA_SLOTS;
+		kfree(slot->data);
+		slot->ofs = ref_offset(fn->raw);
+		slot->len = fn->size;
+		slot->data = data;
+		c->ra_filled++;
+		mutex_unlock(&c->ra_sem);
+	}
+}
+
+/* The block is about to be erased */
+void jffs2_ra_drop(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
+{
+	struct jffs2_ra_slot *slot;
+	int i;
+
+	mutex_lock(&c->ra_sem);
+	for (i = 0; i < JFFS2_RA_SLOTS; i++) {
+		slot = &c->ra_slot[i];
+		if (slot->len && slot->ofs >= jeb->offset &&
+		    slot->ofs < jeb->offset + c->sector_size) {
+			kfree(slot->data);
+			slot->data = NULL;
+			slot->len = 0;
+		}
+	}
+	mutex_unlock(&c->ra_sem);
+}
+
+void jffs2_ra_free(struct jffs2_sb_info *c)
+{
+	int i;
+
+	for (i = 0; i < JFFS2_RA_SLOTS; i++) {
+		kfree(c->ra_slot[i].data);
+		c->ra_slot[i].data = NULL;
+		c->ra_slot[i].len = 0;
+	}
+}
+
 int jffs2_read_dnode(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 		     struct jffs2_full_dnode *fd, unsigned char *buf,
 		     int ofs, int len)
@@ -30,6 +144,9 @@ int jffs2_read_dnode(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 	unsigned char *readbuf = NULL;
 	int ret = 0;
 
+	if (jffs2_ra_read(c, fd, buf, ofs, len, &ret))
+		return ret;
+
 	ri = jffs2_alloc_raw_inode();
 	if (!ri)
 		return -ENOMEM;
@@ -154,10 +271,13 @@ int jffs2_read_dnode(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 	return ret;
 }
 
-int jffs2_read_inode_range(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
-			   unsigned char *buf, uint32_t offset, uint32_t len)
+/* Called with f->sem held, shared or not */
+int jffs2_read_inode_range_nolock(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+				  unsigned char *buf, uint32_t offset, uint32_t len)
 {
 	uint32_t end = offset + len;
+	unsigned char *start_buf = buf;
+	uint32_t start = offset;
 	struct jffs2_node_frag *frag;
 	int ret;
 
@@ -229,9 +349,47 @@ int jffs2_read_inode_range(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 			jffs2_dbg(2, "node read was OK. Looping\n");
 		}
 	}
+	jffs2_wb_overlay(c, f, start_buf, start, len);
 	return 0;
 }
 
+int jffs2_read_inode_range(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+			   unsigned char *buf, uint32_t offset, uint32_t len)
+{
+	uint64_t start = jffs2_now_ns();
+	int req;
+	int ret;
+
+	jffs2_inode_lock_shared(f);
+	ret = jffs2_read_inode_range_nolock(c, f, buf, offset, len);
+	if (!ret)
+		LOS_Atomic64Add(&c->stats.read_bytes, len);
+	if (!ret && len) {
+		/* Other readers may be in here too */
+		mutex_lock(&c->ra_sem);
+		if (offset == f->ra_next) {
+			if (f->ra_streak < 0xFFFF)
+				f->ra_streak++;
+		} else {
+			f->ra_streak = 0;
+		}
+		f->ra_next = offset + len;
+		req = f->ra_streak >= JFFS2_RA_MIN_STREAK && c->ra_running;
+		if (req) {
+			/* Looks like it'll want what comes next. Only the
+			   latest request matters */
+			c->ra_req_ino = f->inocache->ino;
+			c->ra_req_ofs = offset + len;
+		}
+		mutex_unlock(&c->ra_sem);
+		if (req)
+			LOS_EventWrite(&OFNI_BS_2SFFJ(c)->s_ra_flags, RA_THREAD_FLAG_REQ);
+	}
+	jffs2_inode_unlock_shared(f);
+	jffs2_lat_hist_add(&c->stats.read_lat, jffs2_now_ns() - start);
+	return ret;
+}
+
 int jffs2_flash_direct_read(struct jffs2_sb_info *c, loff_t ofs, size_t len,
 			size_t *retlen, const char *buf)
 {
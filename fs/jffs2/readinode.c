@@ -1296,6 +1296,9 @@ static int jffs2_do_read_inode_internal(struct jffs2_sb_info *c,
 int jffs2_do_read_inode(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 			uint32_t ino, struct jffs2_raw_inode *latest_node)
 {
+	uint64_t start;
+	int ret;
+
 	dbg_readinode("read inode #%u\n", ino);
 
  retry_inocache:
@@ -1354,7 +1357,10 @@ int jffs2_do_read_inode(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 		return -ENOENT;
 	}
 
-	return jffs2_do_read_inode_internal(c, f, latest_node);
+	start = jffs2_now_ns();
+	ret = jffs2_do_read_inode_internal(c, f, latest_node);
+	jffs2_lat_hist_add(&c->stats.iread_lat, jffs2_now_ns() - start);
+	return ret;
 }
 
 int jffs2_do_crccheck_inode(struct jffs2_sb_info *c, struct jffs2_inode_cache *ic)
@@ -1366,14 +1372,15 @@ int jffs2_do_crccheck_inode(struct jffs2_sb_info *c, struct jffs2_inode_cache *i
 	if (!f)
 		return -ENOMEM;
 
-	mutex_init(&f->sem);
-	mutex_lock(&f->sem);
+	jffs2_inode_lock_init(f);
+	jffs2_inode_lock(f);
 	f->inocache = ic;
 
 	ret = jffs2_do_read_inode_internal(c, f, &n);
-	mutex_unlock(&f->sem);
+	jffs2_inode_unlock(f);
 	jffs2_do_clear_inode(c, f);
 	jffs2_xattr_do_crccheck_inode(c, ic);
+	jffs2_inode_lock_destroy(f);
 	kfree (f);
 	return ret;
 }
@@ -1384,7 +1391,7 @@ void jffs2_do_clear_inode(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
 	int deleted;
 
 	jffs2_xattr_delete_inode(c, f->inocache);
-	mutex_lock(&f->sem);
+	jffs2_inode_lock(f);
 	deleted = f->inocache && !f->inocache->pino_nlink;
 
 	if (f->inocache && f->inocache->state != INO_STATE_CHECKING)
@@ -1416,5 +1423,5 @@ void jffs2_do_clear_inode(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
 			jffs2_del_ino_cache(c, f->inocache);
 	}
 
-	mutex_unlock(&f->sem);
+	jffs2_inode_unlock(f);
 }
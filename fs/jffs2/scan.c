@@ -65,6 +65,53 @@ static inline uint32_t EMPTY_SCAN_SIZE(uint32_t sector_size) {
 		return DEFAULT_EMPTY_SCAN_SIZE;
 }
 
+/*
+ * Length in bytes of the erased (all 0xFF) run at the start of buf, which
+ * is word aligned with len a multiple of 4. A mostly empty partition has
+ * the scan spending most of its time here, so look at four longs at a
+ * time rather than a word.
+ */
+static uint32_t jffs2_scan_erased_len(const unsigned char *buf, uint32_t len)
+{
+	const unsigned long *p;
+	uint32_t n = 0;
+
+	while (n < len && ((uintptr_t)(buf + n) & (sizeof(long) - 1))) {
+		if (*(const uint32_t *)(buf + n) != 0xFFFFFFFF)
+			return n;
+		n += 4;
+	}
+	while (n + 4 * sizeof(long) <= len) {
+		p = (const unsigned long *)(buf + n);
+		if ((p[0] & p[1] & p[2] & p[3]) != ~0UL)
+			break;
+		n += 4 * sizeof(long);
+	}
+	while (n < len && *(const uint32_t *)(buf + n) == 0xFFFFFFFF)
+		n += 4;
+	return n;
+}
+
+/*
+ * Length in bytes of the garbage at the start of buf: words which are
+ * neither erased nor the start of something that looks like a node, all
+ * of which the scan would just mark dirty one at a time.
+ */
+static uint32_t jffs2_scan_garbage_len(const unsigned char *buf, uint32_t len)
+{
+	uint16_t magic;
+	uint32_t n;
+
+	for (n = 0; n + 4 <= len; n += 4) {
+		if (*(const uint32_t *)(buf + n) == 0xFFFFFFFF)
+			break;
+		magic = je16_to_cpu(*(const jint16_t *)(buf + n));
+		if (magic == JFFS2_MAGIC_BITMASK || magic == JFFS2_OLD_MAGIC_BITMASK)
+			break;
+	}
+	return n;
+}
+
 static int file_dirty(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
 {
 	int ret;
@@ -105,10 +152,22 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 		else
 			buf_size = PAGE_SIZE;
 
-		jffs2_dbg(1, "Trying to allocate readbuf of %zu "
-			  "bytes\n", buf_size);
+		/* Fewer, bigger reads are quicker on NOR too, and we get
+		   to look through more of it in one go. A page will do if
+		   that's all there is */
+		if (buf_size < c->sector_size) {
+			jffs2_dbg(1, "Trying to allocate readbuf of %zu "
+				  "bytes\n", c->sector_size);
+			flashbuf = kmalloc(c->sector_size, GFP_KERNEL);
+			if (flashbuf)
+				buf_size = c->sector_size;
+		}
 
-		flashbuf = kmalloc(buf_size, GFP_KERNEL);
+		if (!flashbuf) {
+			jffs2_dbg(1, "Trying to allocate readbuf of %zu "
+				  "bytes\n", buf_size);
+			flashbuf = kmalloc(buf_size, GFP_KERNEL);
+		}
 		if (!flashbuf)
 			return -ENOMEM;
 
@@ -117,7 +176,7 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 	}
 
 	if (jffs2_sum_active()) {
-		s = kzalloc(sizeof(struct jffs2_summary), GFP_KERNEL);
+		s = jffs2_sum_alloc(c);
 		if (!s) {
 			JFFS2_WARNING("Can't allocate memory for summary\n");
 			ret = -ENOMEM;
@@ -134,6 +193,9 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 
 		/* reset summary info for next eraseblock scan */
 		jffs2_sum_reset_collected(s);
+		/* Read-only, there's no nextblock for it to go into */
+		if (jffs2_is_readonly(c))
+			jffs2_sum_disable_collecting(s);
 
 		ret = jffs2_scan_eraseblock(c, jeb, buf_size?flashbuf:(flashbuf+jeb->offset),
 						buf_size, s);
@@ -154,6 +216,9 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 			 * for later checks.
 			 */
 			empty_blocks++;
+			/* Read-only, it may as well stay as it is */
+			if (jffs2_is_readonly(c))
+				break;
 			list_add(&jeb->list, &c->erase_pending_list);
 			c->nr_erasing_blocks++;
 			break;
@@ -164,7 +229,7 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 				/* It's actually free */
 				list_add(&jeb->list, &c->free_list);
 				c->nr_free_blocks++;
-			} else {
+			} else if (!jffs2_is_readonly(c)) {
 				/* Dirt */
 				jffs2_dbg(1, "Adding all-dirty block at 0x%08x to erase_pending_list\n",
 					  jeb->offset);
@@ -181,8 +246,9 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 		case BLK_STATE_PARTDIRTY:
 			/* Some data, but not full. Dirty list. */
 			/* We want to remember the block with most free space
-			and stick it in the 'nextblock' position to start writing to it. */
-			if (jeb->free_size > min_free(c) &&
+			and stick it in the 'nextblock' position to start writing to it.
+			A read-only mount doesn't need one. */
+			if (!jffs2_is_readonly(c) && jeb->free_size > min_free(c) &&
 					(!c->nextblock || c->nextblock->free_size < jeb->free_size)) {
 				/* Better candidate for the next writes to go to */
 				if (c->nextblock) {
@@ -207,6 +273,8 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 		case BLK_STATE_ALLDIRTY:
 			/* Nothing valid - not even a clean marker. Needs erasing. */
 			/* For now we just put it on the erasing list. We'll start the erases later */
+			if (jffs2_is_readonly(c))
+				break;
 			jffs2_dbg(1, "Erase block at 0x%08x is not formatted. It will be erased\n",
 				  jeb->offset);
 			list_add(&jeb->list, &c->erase_pending_list);
@@ -258,6 +326,7 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 	}
 	ret = 0;
  out:
+	jffs2_sum_free(s);
 
 	kfree(flashbuf);
 
@@ -417,6 +486,102 @@ static int jffs2_scan_xref_node(struct jffs2_sb_info *c, struct jffs2_eraseblock
 }
 #endif
 
+#ifdef CONFIG_JFFS2_SUMMARY
+/*
+ * A block which was still open for writing at a clean umount ends with a
+ * continuation summary (see jffs2_sum_write_contnode()) rather than one
+ * at the very end. It is the last thing written, and its marker is its
+ * last word, so step back over the erased tail to find it. Returns a
+ * block state if the summary was good, or zero to scan the block in full.
+ * In that case *erased_ofs says where the erased tail starts, so the full
+ * scan doesn't have to read it all over again, and *loaded says if the
+ * whole block is still in buf, so it needn't read any of it.
+ */
+static int jffs2_scan_contsum(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+			      unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s,
+			      uint32_t *erased_ofs, int *loaded)
+{
+	struct jffs2_unknown_node *node = (struct jffs2_unknown_node *)buf;
+	struct jffs2_sum_marker *sm;
+	uint32_t cmlen = PAD(c->cleanmarker_size);
+	uint32_t end, len, i, sumofs, sumlen;
+	void *sumptr;
+	int err;
+
+	/* Erased, or holding nothing but a cleanmarker. The full scan can
+	   tell that from the first few bytes */
+	err = jffs2_fill_scan_buf(c, buf, jeb->offset, cmlen + sizeof(uint32_t));
+	if (err)
+		return err;
+	if (*(uint32_t *)buf == 0xFFFFFFFF)
+		return 0;
+	if (cmlen && je16_to_cpu(node->magic) == JFFS2_MAGIC_BITMASK &&
+	    je16_to_cpu(node->nodetype) == JFFS2_NODETYPE_CLEANMARKER &&
+	    *(uint32_t *)(buf + cmlen) == 0xFFFFFFFF)
+		return 0;
+
+	for (end = c->sector_size; end; end -= len) {
+		len = min_t(uint32_t, end, buf_size);
+		err = jffs2_fill_scan_buf(c, buf, jeb->offset + end - len, len);
+		if (err)
+			return err;
+		for (i = len; i && *(uint32_t *)(buf + i - 4) == 0xFFFFFFFF; i -= 4)
+			;
+		if (i) {
+			end -= len - i;
+			break;
+		}
+	}
+	*erased_ofs = end;
+	/* Then that was all of it in one go. Don't read any more over it */
+	*loaded = (buf_size >= c->sector_size);
+
+	/* Written right to the end, but not with a summary */
+	if (end == c->sector_size || end < sizeof(struct jffs2_raw_summary) + sizeof(*sm))
+		return 0;
+
+	if (*loaded) {
+		sm = (struct jffs2_sum_marker *)(buf + end - sizeof(*sm));
+	} else {
+		sm = (struct jffs2_sum_marker *)buf;
+		err = jffs2_fill_scan_buf(c, buf, jeb->offset + end - sizeof(*sm), sizeof(*sm));
+		if (err)
+			return err;
+	}
+	if (je32_to_cpu(sm->magic) != JFFS2_SUM_MAGIC)
+		return 0;
+	sumofs = je32_to_cpu(sm->offset);
+	if ((sumofs & 3) || sumofs + sizeof(struct jffs2_raw_summary) + sizeof(*sm) > end)
+		return 0;
+	sumlen = end - sumofs;
+
+	dbg_summary("continuation summary for 0x%08x at 0x%08x (0x%x bytes)\n",
+		    jeb->offset, jeb->offset + sumofs, sumlen);
+
+	if (*loaded) {
+		sumptr = buf + sumofs;
+		err = 0;
+	} else {
+		sumptr = buf;
+		if (sumlen > buf_size) {
+			sumptr = kmalloc(sumlen, GFP_KERNEL);
+			if (!sumptr)
+				return -ENOMEM;
+		}
+		err = jffs2_fill_scan_buf(c, sumptr, jeb->offset + sumofs, sumlen);
+	}
+	if (!err)
+		err = jffs2_sum_scan_contnode(c, jeb, sumptr, sumofs, sumlen, &pseudo_random, s);
+	if (!*loaded && sumptr != buf)
+		kfree(sumptr);
+
+	/* It stays open, so the summary has to fit in what's left as well */
+	if (err > 0 && PAD(s->sum_size + JFFS2_SUMMARY_FRAME_SIZE) > jeb->free_size)
+		jffs2_sum_disable_collecting(s);
+	return err;
+}
+#endif
+
 /* Called with 'buf_size == 0' if buf is in fact a pointer _directly_ into
    the flash, XIP-style */
 static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
@@ -424,7 +589,9 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 	struct jffs2_unknown_node *node;
 	struct jffs2_unknown_node crcnode;
 	uint32_t ofs, prevofs, max_ofs;
-	uint32_t hdr_crc, buf_ofs, buf_len;
+	uint32_t hdr_crc, buf_ofs, buf_len, skip;
+	uint32_t erased_ofs = c->sector_size;
+	int loaded = 0;
 	int err;
 	int noise = 0;
 
@@ -526,6 +693,13 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 			if (err)
 				return err;
 		}
+#ifdef CONFIG_JFFS2_SUMMARY
+		if (!sumptr && buf_size) {
+			err = jffs2_scan_contsum(c, jeb, buf, buf_size, s, &erased_ofs, &loaded);
+			if (err)
+				return err;
+		}
+#endif
 	}
 
 full_scan:
@@ -534,6 +708,9 @@ full_scan:
 	if (!buf_size) {
 		/* This is the XIP case -- we're reading _directly_ from the flash chip */
 		buf_len = c->sector_size;
+	} else if (loaded) {
+		/* jffs2_scan_contsum() left all of it in buf */
+		buf_len = c->sector_size;
 	} else {
 		buf_len = EMPTY_SCAN_SIZE(c->sector_size);
 		err = jffs2_fill_scan_buf(c, buf, buf_ofs, buf_len);
@@ -545,8 +722,7 @@ full_scan:
 	ofs = 0;
 	max_ofs = EMPTY_SCAN_SIZE(c->sector_size);
 	/* Scan only EMPTY_SCAN_SIZE of 0xFF before declaring it's empty */
-	while(ofs < max_ofs && *(uint32_t *)(&buf[ofs]) == 0xFFFFFFFF)
-		ofs += 4;
+	ofs = jffs2_scan_erased_len(buf, max_ofs);
 
 	if (ofs == max_ofs) {
 #ifdef CONFIG_JFFS2_FS_WRITEBUFFER
@@ -646,17 +822,16 @@ scan_more:
 			jffs2_dbg(1, "Found empty flash at 0x%08x\n", ofs);
 		more_empty:
 			inbuf_ofs = ofs - buf_ofs;
-			while (inbuf_ofs < scan_end) {
-				if (unlikely(*(uint32_t *)(&buf[inbuf_ofs]) != 0xffffffff)) {
+			if (inbuf_ofs < scan_end) {
+				skip = jffs2_scan_erased_len(&buf[inbuf_ofs], scan_end - inbuf_ofs);
+				ofs += skip;
+				if (unlikely(inbuf_ofs + skip < scan_end)) {
 					pr_warn("Empty flash at 0x%08x ends at 0x%08x\n",
 						empty_start, ofs);
 					if ((err = jffs2_scan_dirty_space(c, jeb, ofs-empty_start)))
 						return err;
 					goto scan_more;
 				}
-
-				inbuf_ofs+=4;
-				ofs += 4;
 			}
 			/* Ran off end. */
 			jffs2_dbg(1, "Empty flash to end of buffer at 0x%08x\n",
@@ -670,13 +845,16 @@ scan_more:
 					  EMPTY_SCAN_SIZE(c->sector_size));
 				return BLK_STATE_CLEANMARKER;
 			}
-			if (!buf_size && (scan_end != buf_len)) {/* XIP/point case */
+			if ((!buf_size || loaded) && (scan_end != buf_len)) {/* XIP/point case, or all in buf */
 				scan_end = buf_len;
 				goto more_empty;
 			}
 
 			/* See how much more there is to read in this eraseblock... */
 			buf_len = min_t(uint32_t, buf_size, jeb->offset + c->sector_size - ofs);
+			/* ...unless jffs2_scan_contsum() has already seen the rest */
+			if (ofs >= jeb->offset + erased_ofs)
+				buf_len = 0;
 			if (!buf_len) {
 				/* No more to read. Break out of main loop without marking
 				   this range of empty space as dirty (because it's not) */
@@ -724,9 +902,12 @@ scan_more:
 				     __func__,
 				     JFFS2_MAGIC_BITMASK, ofs,
 				     je16_to_cpu(node->magic));
-			if ((err = jffs2_scan_dirty_space(c, jeb, 4)))
+			/* And whatever follows it that is no better, in one go */
+			skip = 4 + jffs2_scan_garbage_len(&buf[ofs - buf_ofs + 4],
+							  buf_len - (ofs - buf_ofs) - 4);
+			if ((err = jffs2_scan_dirty_space(c, jeb, skip)))
 				return err;
-			ofs += 4;
+			ofs += skip;
 			continue;
 		}
 		/* We seem to have a node of sorts. Check the CRC */
@@ -27,22 +27,41 @@
 #include "nodelist.h"
 #include "debug.h"
 
-int jffs2_sum_init(struct jffs2_sb_info *c)
+/* Allocate a summary collector, with room for as much summary as a block
+   can take */
+
+struct jffs2_summary *jffs2_sum_alloc(struct jffs2_sb_info *c)
 {
-	uint32_t sum_size = min_t(uint32_t, c->sector_size, MAX_SUMMARY_SIZE);
+	struct jffs2_summary *s;
 
-	c->summary = kzalloc(sizeof(struct jffs2_summary), GFP_KERNEL);
+	s = kzalloc(sizeof(struct jffs2_summary), GFP_KERNEL);
+	if (!s)
+		return NULL;
 
-	if (!c->summary) {
-		JFFS2_WARNING("Can't allocate memory for summary information!\n");
-		return -ENOMEM;
+	s->sum_buf_size = min_t(uint32_t, c->sector_size, MAX_SUMMARY_SIZE);
+	s->sum_buf = kmalloc(s->sum_buf_size, GFP_KERNEL);
+	if (!s->sum_buf) {
+		kfree(s);
+		return NULL;
 	}
 
-	c->summary->sum_buf = kmalloc(sum_size, GFP_KERNEL);
+	return s;
+}
 
-	if (!c->summary->sum_buf) {
-		JFFS2_WARNING("Can't allocate buffer for writing out summary information!\n");
-		kfree(c->summary);
+void jffs2_sum_free(struct jffs2_summary *s)
+{
+	if (!s)
+		return;
+	kfree(s->sum_buf);
+	kfree(s);
+}
+
+int jffs2_sum_init(struct jffs2_sb_info *c)
+{
+	c->summary = jffs2_sum_alloc(c);
+
+	if (!c->summary) {
+		JFFS2_WARNING("Can't allocate memory for summary information!\n");
 		return -ENOMEM;
 	}
 
@@ -55,55 +74,33 @@ void jffs2_sum_exit(struct jffs2_sb_info *c)
 {
 	dbg_summary("called\n");
 
-	jffs2_sum_disable_collecting(c->summary);
-
-	kfree(c->summary->sum_buf);
-	c->summary->sum_buf = NULL;
-
-	kfree(c->summary);
+	jffs2_sum_free(c->summary);
 	c->summary = NULL;
 }
 
-static int jffs2_sum_add_mem(struct jffs2_summary *s, union jffs2_sum_mem *item)
+/* Make room for a len byte entry at the end of the collected information,
+   which is kept just as it will go on the flash. If the summary has
+   outgrown the buffer, it isn't going to be written anyway */
+
+static void *jffs2_sum_add_mem(struct jffs2_summary *s, uint32_t len)
 {
-	if (!s->sum_list_head)
-		s->sum_list_head = (union jffs2_sum_mem *) item;
-	if (s->sum_list_tail)
-		s->sum_list_tail->u.next = (union jffs2_sum_mem *) item;
-	s->sum_list_tail = (union jffs2_sum_mem *) item;
+	void *entry;
 
-	switch (je16_to_cpu(item->u.nodetype)) {
-		case JFFS2_NODETYPE_INODE:
-			s->sum_size += JFFS2_SUMMARY_INODE_SIZE;
-			s->sum_num++;
-			dbg_summary("inode (%u) added to summary\n",
-						je32_to_cpu(item->i.inode));
-			break;
-		case JFFS2_NODETYPE_DIRENT:
-			s->sum_size += JFFS2_SUMMARY_DIRENT_SIZE(item->d.nsize);
-			s->sum_num++;
-			dbg_summary("dirent (%u) added to summary\n",
-						je32_to_cpu(item->d.ino));
-			break;
-#ifdef CONFIG_JFFS2_FS_XATTR
-		case JFFS2_NODETYPE_XATTR:
-			s->sum_size += JFFS2_SUMMARY_XATTR_SIZE;
-			s->sum_num++;
-			dbg_summary("xattr (xid=%u, version=%u) added to summary\n",
-				    je32_to_cpu(item->x.xid), je32_to_cpu(item->x.version));
-			break;
-		case JFFS2_NODETYPE_XREF:
-			s->sum_size += JFFS2_SUMMARY_XREF_SIZE;
-			s->sum_num++;
-			dbg_summary("xref added to summary\n");
-			break;
-#endif
-		default:
-			JFFS2_WARNING("UNKNOWN node type %u\n",
-					    je16_to_cpu(item->u.nodetype));
-			return 1;
+	if (s->sum_size == JFFS2_SUMMARY_NOSUM_SIZE)
+		return NULL;
+
+	if (s->sum_size + len + sizeof(struct jffs2_sum_marker) > s->sum_buf_size) {
+		dbg_summary("summary too big (%u entries), disabling for this jeb\n",
+			    s->sum_num);
+		jffs2_sum_disable_collecting(s);
+		return NULL;
 	}
-	return 0;
+
+	entry = s->sum_buf + s->sum_size;
+	s->sum_size += len;
+	s->sum_num++;
+
+	return entry;
 }
 
 
@@ -119,29 +116,29 @@ int jffs2_sum_add_padding_mem(struct jffs2_summary *s, uint32_t size)
 int jffs2_sum_add_inode_mem(struct jffs2_summary *s, struct jffs2_raw_inode *ri,
 				uint32_t ofs)
 {
-	struct jffs2_sum_inode_mem *temp = kmalloc(sizeof(struct jffs2_sum_inode_mem), GFP_KERNEL);
+	struct jffs2_sum_inode_flash *temp = jffs2_sum_add_mem(s, JFFS2_SUMMARY_INODE_SIZE);
 
 	if (!temp)
-		return -ENOMEM;
+		return 0;
 
 	temp->nodetype = ri->nodetype;
 	temp->inode = ri->ino;
 	temp->version = ri->version;
 	temp->offset = cpu_to_je32(ofs); /* relative offset from the beginning of the jeb */
 	temp->totlen = ri->totlen;
-	temp->next = NULL;
 
-	return jffs2_sum_add_mem(s, (union jffs2_sum_mem *)temp);
+	dbg_summary("inode (%u) added to summary\n", je32_to_cpu(ri->ino));
+	return 0;
 }
 
 int jffs2_sum_add_dirent_mem(struct jffs2_summary *s, struct jffs2_raw_dirent *rd,
 				uint32_t ofs)
 {
-	struct jffs2_sum_dirent_mem *temp =
-		kmalloc(sizeof(struct jffs2_sum_dirent_mem) + rd->nsize, GFP_KERNEL);
+	struct jffs2_sum_dirent_flash *temp =
+		jffs2_sum_add_mem(s, JFFS2_SUMMARY_DIRENT_SIZE(rd->nsize));
 
 	if (!temp)
-		return -ENOMEM;
+		return 0;
 
 	temp->nodetype = rd->nodetype;
 	temp->totlen = rd->totlen;
@@ -151,64 +148,55 @@ int jffs2_sum_add_dirent_mem(struct jffs2_summary *s, struct jffs2_raw_dirent *r
 	temp->ino = rd->ino;
 	temp->nsize = rd->nsize;
 	temp->type = rd->type;
-	temp->next = NULL;
 
 	memcpy(temp->name, rd->name, rd->nsize);
 
-	return jffs2_sum_add_mem(s, (union jffs2_sum_mem *)temp);
+	dbg_summary("dirent (%u) added to summary\n", je32_to_cpu(rd->ino));
+	return 0;
 }
 
 #ifdef CONFIG_JFFS2_FS_XATTR
 int jffs2_sum_add_xattr_mem(struct jffs2_summary *s, struct jffs2_raw_xattr *rx, uint32_t ofs)
 {
-	struct jffs2_sum_xattr_mem *temp;
+	struct jffs2_sum_xattr_flash *temp;
 
-	temp = kmalloc(sizeof(struct jffs2_sum_xattr_mem), GFP_KERNEL);
+	temp = jffs2_sum_add_mem(s, JFFS2_SUMMARY_XATTR_SIZE);
 	if (!temp)
-		return -ENOMEM;
+		return 0;
 
 	temp->nodetype = rx->nodetype;
 	temp->xid = rx->xid;
 	temp->version = rx->version;
 	temp->offset = cpu_to_je32(ofs);
 	temp->totlen = rx->totlen;
-	temp->next = NULL;
 
-	return jffs2_sum_add_mem(s, (union jffs2_sum_mem *)temp);
+	dbg_summary("xattr (xid=%u, version=%u) added to summary\n",
+		    je32_to_cpu(rx->xid), je32_to_cpu(rx->version));
+	return 0;
 }
 
 int jffs2_sum_add_xref_mem(struct jffs2_summary *s, struct jffs2_raw_xref *rr, uint32_t ofs)
 {
-	struct jffs2_sum_xref_mem *temp;
+	struct jffs2_sum_xref_flash *temp;
 
-	temp = kmalloc(sizeof(struct jffs2_sum_xref_mem), GFP_KERNEL);
+	temp = jffs2_sum_add_mem(s, JFFS2_SUMMARY_XREF_SIZE);
 	if (!temp)
-		return -ENOMEM;
+		return 0;
 
 	temp->nodetype = rr->nodetype;
 	temp->offset = cpu_to_je32(ofs);
-	temp->next = NULL;
 
-	return jffs2_sum_add_mem(s, (union jffs2_sum_mem *)temp);
+	dbg_summary("xref added to summary\n");
+	return 0;
 }
 #endif
 /* Cleanup every collected summary information */
 
 static void jffs2_sum_clean_collected(struct jffs2_summary *s)
 {
-	union jffs2_sum_mem *temp;
-
-	if (!s->sum_list_head) {
-		dbg_summary("already empty\n");
-	}
-	while (s->sum_list_head) {
-		temp = s->sum_list_head;
-		s->sum_list_head = s->sum_list_head->u.next;
-		kfree(temp);
-	}
-	s->sum_list_tail = NULL;
 	s->sum_padded = 0;
 	s->sum_num = 0;
+	s->sum_cont_ref = NULL;
 }
 
 void jffs2_sum_reset_collected(struct jffs2_summary *s)
@@ -230,10 +218,13 @@ int jffs2_sum_is_disabled(struct jffs2_summary *s)
 	return (s->sum_size == JFFS2_SUMMARY_NOSUM_SIZE);
 }
 
-/* Move the collected summary information into sb (called from scan.c) */
+/* Move the collected summary information into sb (called from scan.c).
+   The buffers are the same size, so just swap them */
 
 void jffs2_sum_move_collected(struct jffs2_sb_info *c, struct jffs2_summary *s)
 {
+	uint8_t *buf;
+
 	dbg_summary("oldsize=0x%x oldnum=%u => newsize=0x%x newnum=%u\n",
 				c->summary->sum_size, c->summary->sum_num,
 				s->sum_size, s->sum_num);
@@ -241,53 +232,35 @@ void jffs2_sum_move_collected(struct jffs2_sb_info *c, struct jffs2_summary *s)
 	c->summary->sum_size = s->sum_size;
 	c->summary->sum_num = s->sum_num;
 	c->summary->sum_padded = s->sum_padded;
-	c->summary->sum_list_head = s->sum_list_head;
-	c->summary->sum_list_tail = s->sum_list_tail;
+	c->summary->sum_cont_ref = s->sum_cont_ref;
 
-	s->sum_list_head = s->sum_list_tail = NULL;
-}
+	buf = c->summary->sum_buf;
+	c->summary->sum_buf = s->sum_buf;
+	s->sum_buf = buf;
 
-/* Called from wbuf.c to collect writed node info */
+	jffs2_sum_reset_collected(s);
+}
 
-int jffs2_sum_add_kvec(struct jffs2_sb_info *c, const struct kvec *invecs,
-				unsigned long count, uint32_t ofs)
+static int jffs2_sum_add_node(struct jffs2_sb_info *c, const struct kvec *invecs,
+			      unsigned long count, uint32_t ofs)
 {
 	union jffs2_node_union *node;
 	struct jffs2_eraseblock *jeb;
 
-	if (c->summary->sum_size == JFFS2_SUMMARY_NOSUM_SIZE) {
-		dbg_summary("Summary is disabled for this jeb! Skipping summary info!\n");
-		return 0;
-	}
-
 	node = invecs[0].iov_base;
 	jeb = &c->blocks[ofs / c->sector_size];
 	ofs -= jeb->offset;
 
 	switch (je16_to_cpu(node->u.nodetype)) {
-		case JFFS2_NODETYPE_INODE: {
-			struct jffs2_sum_inode_mem *temp =
-				kmalloc(sizeof(struct jffs2_sum_inode_mem), GFP_KERNEL);
-
-			if (!temp)
-				goto no_mem;
-
-			temp->nodetype = node->i.nodetype;
-			temp->inode = node->i.ino;
-			temp->version = node->i.version;
-			temp->offset = cpu_to_je32(ofs);
-			temp->totlen = node->i.totlen;
-			temp->next = NULL;
-
-			return jffs2_sum_add_mem(c->summary, (union jffs2_sum_mem *)temp);
-		}
+		case JFFS2_NODETYPE_INODE:
+			return jffs2_sum_add_inode_mem(c->summary, &node->i, ofs);
 
 		case JFFS2_NODETYPE_DIRENT: {
-			struct jffs2_sum_dirent_mem *temp =
-				kmalloc(sizeof(struct jffs2_sum_dirent_mem) + node->d.nsize, GFP_KERNEL);
+			struct jffs2_sum_dirent_flash *temp =
+				jffs2_sum_add_mem(c->summary, JFFS2_SUMMARY_DIRENT_SIZE(node->d.nsize));
 
 			if (!temp)
-				goto no_mem;
+				break;
 
 			temp->nodetype = node->d.nodetype;
 			temp->totlen = node->d.totlen;
@@ -297,7 +270,6 @@ int jffs2_sum_add_kvec(struct jffs2_sb_info *c, const struct kvec *invecs,
 			temp->ino = node->d.ino;
 			temp->nsize = node->d.nsize;
 			temp->type = node->d.type;
-			temp->next = NULL;
 
 			switch (count) {
 				case 1:
@@ -313,35 +285,15 @@ int jffs2_sum_add_kvec(struct jffs2_sb_info *c, const struct kvec *invecs,
 					break;
 			}
 
-			return jffs2_sum_add_mem(c->summary, (union jffs2_sum_mem *)temp);
+			dbg_summary("dirent (%u) added to summary\n", je32_to_cpu(node->d.ino));
+			break;
 		}
 #ifdef CONFIG_JFFS2_FS_XATTR
-		case JFFS2_NODETYPE_XATTR: {
-			struct jffs2_sum_xattr_mem *temp;
-			temp = kmalloc(sizeof(struct jffs2_sum_xattr_mem), GFP_KERNEL);
-			if (!temp)
-				goto no_mem;
-
-			temp->nodetype = node->x.nodetype;
-			temp->xid = node->x.xid;
-			temp->version = node->x.version;
-			temp->totlen = node->x.totlen;
-			temp->offset = cpu_to_je32(ofs);
-			temp->next = NULL;
-
-			return jffs2_sum_add_mem(c->summary, (union jffs2_sum_mem *)temp);
-		}
-		case JFFS2_NODETYPE_XREF: {
-			struct jffs2_sum_xref_mem *temp;
-			temp = kmalloc(sizeof(struct jffs2_sum_xref_mem), GFP_KERNEL);
-			if (!temp)
-				goto no_mem;
-			temp->nodetype = node->r.nodetype;
-			temp->offset = cpu_to_je32(ofs);
-			temp->next = NULL;
+		case JFFS2_NODETYPE_XATTR:
+			return jffs2_sum_add_xattr_mem(c->summary, &node->x, ofs);
 
-			return jffs2_sum_add_mem(c->summary, (union jffs2_sum_mem *)temp);
-		}
+		case JFFS2_NODETYPE_XREF:
+			return jffs2_sum_add_xref_mem(c->summary, &node->r, ofs);
 #endif
 		case JFFS2_NODETYPE_PADDING:
 			dbg_summary("node PADDING\n");
@@ -365,10 +317,48 @@ int jffs2_sum_add_kvec(struct jffs2_sb_info *c, const struct kvec *invecs,
 	}
 
 	return 0;
+}
+
+/* Called from wbuf.c to collect writed node info. The vector may hold
+   several nodes back to back (see jffs2_write_nodes()): each one's header
+   starts an iovec, and where a node isn't a whole number of words the
+   padding after it has an iovec of its own */
+
+int jffs2_sum_add_kvec(struct jffs2_sb_info *c, const struct kvec *invecs,
+				unsigned long count, uint32_t ofs)
+{
+	union jffs2_node_union *node;
+	unsigned long i = 0, n;
+	uint32_t len, totlen;
+	int ret;
+
+	if (c->summary->sum_size == JFFS2_SUMMARY_NOSUM_SIZE) {
+		dbg_summary("Summary is disabled for this jeb! Skipping summary info!\n");
+		return 0;
+	}
 
-no_mem:
-	JFFS2_WARNING("MEMORY ALLOCATION ERROR!");
-	return -ENOMEM;
+	while (i < count) {
+		node = invecs[i].iov_base;
+		totlen = je32_to_cpu(node->u.totlen);
+		len = n = 0;
+		do {
+			len += invecs[i + n].iov_len;
+			n++;
+		} while (i + n < count && len < totlen);
+
+		ret = jffs2_sum_add_node(c, &invecs[i], n, ofs);
+		if (ret)
+			return ret;
+
+		ofs += len;
+		i += n;
+		if (i < count && PAD(ofs) != ofs) {
+			ofs += invecs[i].iov_len;
+			i++;
+		}
+	}
+
+	return 0;
 }
 
 static struct jffs2_raw_node_ref *sum_link_node_ref(struct jffs2_sb_info *c,
@@ -609,17 +599,63 @@ static int jffs2_sum_process_sum_data(struct jffs2_sb_info *c, struct jffs2_eras
 	return 0;
 }
 
-/* Process the summary node - called from jffs2_scan_eraseblock() */
-int jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
-			   struct jffs2_raw_summary *summary, uint32_t sumsize,
-			   uint32_t *pseudo_random)
+/* Put the entries of a continuation summary back in the collected
+   information, so that the block can go on being written to and summarised */
+
+static int jffs2_sum_collect_sum_data(struct jffs2_summary *s, struct jffs2_raw_summary *summary)
+{
+	void *temp;
+	uintptr_t sp = (uintptr_t)summary->sum;
+	uint32_t len;
+	int i;
+
+	for (i = 0; i < je32_to_cpu(summary->sum_num); i++) {
+		switch (je16_to_cpu(((struct jffs2_sum_unknown_flash *)sp)->nodetype)) {
+			case JFFS2_NODETYPE_INODE:
+				len = JFFS2_SUMMARY_INODE_SIZE;
+				break;
+			case JFFS2_NODETYPE_DIRENT:
+				len = JFFS2_SUMMARY_DIRENT_SIZE(((struct jffs2_sum_dirent_flash *)sp)->nsize);
+				break;
+#ifdef CONFIG_JFFS2_FS_XATTR
+			case JFFS2_NODETYPE_XATTR:
+				len = JFFS2_SUMMARY_XATTR_SIZE;
+				break;
+			case JFFS2_NODETYPE_XREF:
+				len = JFFS2_SUMMARY_XREF_SIZE;
+				break;
+#endif
+			default:
+				/* jffs2_sum_process_sum_data() would have refused it */
+				BUG();
+				return -EINVAL;
+		}
+
+		temp = jffs2_sum_add_mem(s, len);
+		if (!temp)
+			return 0;
+		memcpy(temp, (void *)sp, len);
+
+		sp += len;
+	}
+	s->sum_padded = je32_to_cpu(summary->padded);
+
+	return 0;
+}
+
+/* Process a summary node at ofs in the block. With s, it's a continuation
+   summary and the space after it is still free */
+
+static int __jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+				    struct jffs2_raw_summary *summary, uint32_t ofs,
+				    uint32_t sumsize, uint32_t *pseudo_random,
+				    struct jffs2_summary *s)
 {
 	struct jffs2_unknown_node crcnode;
-	int ret, ofs;
+	struct jffs2_raw_node_ref *ref;
+	int ret;
 	uint32_t crc;
 
-	ofs = c->sector_size - sumsize;
-
 	dbg_summary("summary found for 0x%08x at 0x%08x (0x%x bytes)\n",
 		    jeb->offset, jeb->offset + ofs, sumsize);
 
@@ -691,7 +727,15 @@ int jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb
 	if (ret)
 		return ret;
 
-	sum_link_node_ref(c, jeb, ofs | REF_NORMAL, sumsize, NULL);
+	ref = sum_link_node_ref(c, jeb, ofs | REF_NORMAL, sumsize, NULL);
+
+	if (s) {
+		ret = jffs2_sum_collect_sum_data(s, summary);
+		if (ret)
+			return ret;
+		s->sum_cont_ref = ref;
+		return jffs2_scan_classify_jeb(c, jeb);
+	}
 
 	if (unlikely(jeb->free_size)) {
 		JFFS2_WARNING("Free size 0x%x bytes in eraseblock @0x%08x with summary?\n",
@@ -710,21 +754,39 @@ crc_err:
 	return 0;
 }
 
+/* Process the summary node - called from jffs2_scan_eraseblock() */
+int jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+			   struct jffs2_raw_summary *summary, uint32_t sumsize,
+			   uint32_t *pseudo_random)
+{
+	return __jffs2_sum_scan_sumnode(c, jeb, summary, c->sector_size - sumsize,
+					sumsize, pseudo_random, NULL);
+}
+
+/* A summary written to a block which was left open (see
+   jffs2_sum_write_contnode()). The collected entries go to s */
+
+int jffs2_sum_scan_contnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+			    struct jffs2_raw_summary *summary, uint32_t sumofs, uint32_t sumlen,
+			    uint32_t *pseudo_random, struct jffs2_summary *s)
+{
+	return __jffs2_sum_scan_sumnode(c, jeb, summary, sumofs, sumlen, pseudo_random, s);
+}
+
 /* Write summary data to flash - helper function for jffs2_sum_write_sumnode() */
 
 static int jffs2_sum_write_data(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
-				uint32_t infosize, uint32_t datasize, int padsize)
+				uint32_t infosize, uint32_t datasize, int padsize, int cont)
 {
 	struct jffs2_raw_summary isum;
-	union jffs2_sum_mem *temp;
 	struct jffs2_sum_marker *sm;
+	struct jffs2_raw_node_ref *prev, *ref;
 	struct kvec vecs[2];
 	uint32_t sum_ofs;
-	uintptr_t wpage;
 	int ret;
 	size_t retlen;
 
-	if (padsize + datasize > MAX_SUMMARY_SIZE) {
+	if (datasize > c->summary->sum_buf_size) {
 		/* It won't fit in the buffer. Abort summary for this jeb */
 		jffs2_sum_disable_collecting(c->summary);
 
@@ -744,7 +806,10 @@ static int jffs2_sum_write_data(struct jffs2_sb_info *c, struct jffs2_eraseblock
 		return 0;
 	}
 
-	memset(c->summary->sum_buf, 0xff, datasize);
+	/* The entries are already in sum_buf, all that's left is the padding
+	   and the marker after them */
+	memset(c->summary->sum_buf + c->summary->sum_size, 0xff,
+	       datasize - c->summary->sum_size);
 	memset(&isum, 0, sizeof(isum));
 
 	isum.magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
@@ -754,93 +819,15 @@ static int jffs2_sum_write_data(struct jffs2_sb_info *c, struct jffs2_eraseblock
 	isum.padded = cpu_to_je32(c->summary->sum_padded);
 	isum.cln_mkr = cpu_to_je32(c->cleanmarker_size);
 	isum.sum_num = cpu_to_je32(c->summary->sum_num);
-	wpage = (uintptr_t)c->summary->sum_buf;
-
-	while (c->summary->sum_num) {
-		temp = c->summary->sum_list_head;
+	sm = (struct jffs2_sum_marker *)(c->summary->sum_buf + datasize - sizeof(*sm));
+	prev = c->summary->sum_cont_ref;
 
-		switch (je16_to_cpu(temp->u.nodetype)) {
-			case JFFS2_NODETYPE_INODE: {
-				struct jffs2_sum_inode_flash *sino_ptr = (struct jffs2_sum_inode_flash *)wpage;
+	/* A continuation summary leaves the collected information in place
+	   for the next one. Otherwise it's forgotten, though it stays in
+	   sum_buf for the write below */
+	if (!cont)
+		jffs2_sum_reset_collected(c->summary);
 
-				sino_ptr->nodetype = temp->i.nodetype;
-				sino_ptr->inode = temp->i.inode;
-				sino_ptr->version = temp->i.version;
-				sino_ptr->offset = temp->i.offset;
-				sino_ptr->totlen = temp->i.totlen;
-
-				wpage += JFFS2_SUMMARY_INODE_SIZE;
-
-				break;
-			}
-
-			case JFFS2_NODETYPE_DIRENT: {
-				struct jffs2_sum_dirent_flash *sdrnt_ptr = (struct jffs2_sum_dirent_flash *)wpage;
-
-				sdrnt_ptr->nodetype = temp->d.nodetype;
-				sdrnt_ptr->totlen = temp->d.totlen;
-				sdrnt_ptr->offset = temp->d.offset;
-				sdrnt_ptr->pino = temp->d.pino;
-				sdrnt_ptr->version = temp->d.version;
-				sdrnt_ptr->ino = temp->d.ino;
-				sdrnt_ptr->nsize = temp->d.nsize;
-				sdrnt_ptr->type = temp->d.type;
-
-				memcpy(sdrnt_ptr->name, temp->d.name,
-							temp->d.nsize);
-
-				wpage += JFFS2_SUMMARY_DIRENT_SIZE(temp->d.nsize);
-
-				break;
-			}
-#ifdef CONFIG_JFFS2_FS_XATTR
-			case JFFS2_NODETYPE_XATTR: {
-				struct jffs2_sum_xattr_flash *sxattr_ptr = wpage;
-
-				temp = c->summary->sum_list_head;
-				sxattr_ptr->nodetype = temp->x.nodetype;
-				sxattr_ptr->xid = temp->x.xid;
-				sxattr_ptr->version = temp->x.version;
-				sxattr_ptr->offset = temp->x.offset;
-				sxattr_ptr->totlen = temp->x.totlen;
-
-				wpage += JFFS2_SUMMARY_XATTR_SIZE;
-				break;
-			}
-			case JFFS2_NODETYPE_XREF: {
-				struct jffs2_sum_xref_flash *sxref_ptr = wpage;
-
-				temp = c->summary->sum_list_head;
-				sxref_ptr->nodetype = temp->r.nodetype;
-				sxref_ptr->offset = temp->r.offset;
-
-				wpage += JFFS2_SUMMARY_XREF_SIZE;
-				break;
-			}
-#endif
-			default : {
-				if ((je16_to_cpu(temp->u.nodetype) & JFFS2_COMPAT_MASK)
-				    == JFFS2_FEATURE_RWCOMPAT_COPY) {
-					dbg_summary("Writing unknown RWCOMPAT_COPY node type %x\n",
-						    je16_to_cpu(temp->u.nodetype));
-					jffs2_sum_disable_collecting(c->summary);
-				} else {
-					BUG();	/* unknown node in summary information */
-				}
-			}
-		}
-
-		c->summary->sum_list_head = temp->u.next;
-		kfree(temp);
-
-		c->summary->sum_num--;
-	}
-
-	jffs2_sum_reset_collected(c->summary);
-
-	wpage += padsize;
-
-	sm = (struct jffs2_sum_marker *)wpage;
 	sm->offset = cpu_to_je32(c->sector_size - jeb->free_size);
 	sm->magic = cpu_to_je32(JFFS2_SUM_MAGIC);
 
@@ -871,13 +858,18 @@ static int jffs2_sum_write_data(struct jffs2_sb_info *c, struct jffs2_eraseblock
 		}
 
 		c->summary->sum_size = JFFS2_SUMMARY_NOSUM_SIZE;
-
-		return 0;
+		ref = NULL;
+	} else {
+		spin_lock(&c->erase_completion_lock);
+		ref = jffs2_link_node_ref(c, jeb, sum_ofs | REF_NORMAL, infosize, NULL);
+		spin_unlock(&c->erase_completion_lock);
 	}
 
-	spin_lock(&c->erase_completion_lock);
-	jffs2_link_node_ref(c, jeb, sum_ofs | REF_NORMAL, infosize, NULL);
-	spin_unlock(&c->erase_completion_lock);
+	/* Whatever happened, an earlier continuation summary isn't the last
+	   word on this block any more */
+	if (prev)
+		jffs2_mark_node_obsolete(c, prev);
+	c->summary->sum_cont_ref = (cont && !jffs2_sum_is_disabled(c->summary)) ? ref : NULL;
 
 	return 0;
 }
@@ -898,7 +890,7 @@ int jffs2_sum_write_sumnode(struct jffs2_sb_info *c)
 	jeb = c->nextblock;
 	jffs2_prealloc_raw_node_refs(c, jeb, 1);
 
-	if (!c->summary->sum_num || !c->summary->sum_list_head) {
+	if (!c->summary->sum_num) {
 		JFFS2_WARNING("Empty summary info!!!\n");
 		BUG();
 	}
@@ -909,9 +901,46 @@ int jffs2_sum_write_sumnode(struct jffs2_sb_info *c)
 	infosize += padsize;
 	datasize += padsize;
 
-	ret = jffs2_sum_write_data(c, jeb, infosize, datasize, padsize);
+	ret = jffs2_sum_write_data(c, jeb, infosize, datasize, padsize, 0);
 	spin_lock(&c->erase_completion_lock);
 	return ret;
 }
 
+/*
+ * Write out a summary of nextblock so far without closing it - called at
+ * clean umount and sync, with alloc_sem held.
+ *
+ * It goes where the next node would have, unpadded, and is otherwise the
+ * same as the one jffs2_sum_write_sumnode() puts at the end of the block,
+ * ending with a marker which points back at it. Since it is the last
+ * thing written, jffs2_scan_eraseblock() can find it by stepping back
+ * over the erased tail of the block. Writing carries on after it, and the
+ * collected information is kept so that the next summary (continuation or
+ * final) covers the whole block and supersedes this one.
+ */
+
+int jffs2_sum_write_contnode(struct jffs2_sb_info *c)
+{
+	int datasize, infosize, padsize;
+	struct jffs2_eraseblock *jeb = c->nextblock;
+	int ret;
+
+	dbg_summary("called\n");
+
+	ret = jffs2_prealloc_raw_node_refs(c, jeb, 1);
+	if (ret)
+		return ret;
+
+	datasize = c->summary->sum_size + sizeof(struct jffs2_sum_marker);
+	infosize = sizeof(struct jffs2_raw_summary) + datasize;
+	padsize = PAD(infosize) - infosize;
+	infosize += padsize;
+	datasize += padsize;
+
+	if (infosize > jeb->free_size)
+		return 0;
+
+	return jffs2_sum_write_data(c, jeb, infosize, datasize, padsize, 1);
+}
+
 #endif
@@ -89,64 +89,6 @@ union jffs2_sum_flash
 	struct jffs2_sum_xref_flash r;
 };
 
-/* Summary structures used in the memory */
-
-struct jffs2_sum_unknown_mem
-{
-	union jffs2_sum_mem *next;
-	jint16_t nodetype;	/* node type */
-};
-
-struct jffs2_sum_inode_mem
-{
-	union jffs2_sum_mem *next;
-	jint16_t nodetype;	/* node type */
-	jint32_t inode;		/* inode number */
-	jint32_t version;	/* inode version */
-	jint32_t offset;	/* offset on jeb */
-	jint32_t totlen; 	/* record length */
-} __attribute__((packed));
-
-struct jffs2_sum_dirent_mem
-{
-	union jffs2_sum_mem *next;
-	jint16_t nodetype;	/* == JFFS_NODETYPE_DIRENT */
-	jint32_t totlen;	/* record length */
-	jint32_t offset;	/* ofset on jeb */
-	jint32_t pino;		/* parent inode */
-	jint32_t version;	/* dirent version */
-	jint32_t ino; 		/* == zero for unlink */
-	uint8_t nsize;		/* dirent name size */
-	uint8_t type;		/* dirent type */
-	uint8_t name[0];	/* dirent name */
-} __attribute__((packed));
-
-struct jffs2_sum_xattr_mem
-{
-	union jffs2_sum_mem *next;
-	jint16_t nodetype;
-	jint32_t xid;
-	jint32_t version;
-	jint32_t offset;
-	jint32_t totlen;
-} __attribute__((packed));
-
-struct jffs2_sum_xref_mem
-{
-	union jffs2_sum_mem *next;
-	jint16_t nodetype;
-	jint32_t offset;
-} __attribute__((packed));
-
-union jffs2_sum_mem
-{
-	struct jffs2_sum_unknown_mem u;
-	struct jffs2_sum_inode_mem i;
-	struct jffs2_sum_dirent_mem d;
-	struct jffs2_sum_xattr_mem x;
-	struct jffs2_sum_xref_mem r;
-};
-
 /* Summary related information stored in superblock */
 
 struct jffs2_summary
@@ -154,10 +96,10 @@ struct jffs2_summary
 	uint32_t sum_size;      /* collected summary information for nextblock */
 	uint32_t sum_num;
 	uint32_t sum_padded;
-	union jffs2_sum_mem *sum_list_head;
-	union jffs2_sum_mem *sum_list_tail;
+	struct jffs2_raw_node_ref *sum_cont_ref; /* last continuation summary in nextblock */
 
-	jint32_t *sum_buf;	/* buffer for writing out summary */
+	uint8_t *sum_buf;	/* collected entries, as they go on flash */
+	uint32_t sum_buf_size;
 };
 
 /* Summary marker is stored at the end of every sumarized erase block */
@@ -177,6 +119,8 @@ struct jffs2_sum_marker
 #ifdef CONFIG_JFFS2_SUMMARY	/* SUMMARY SUPPORT ENABLED */
 
 #define jffs2_sum_active() (1)
+struct jffs2_summary *jffs2_sum_alloc(struct jffs2_sb_info *c);
+void jffs2_sum_free(struct jffs2_summary *s);
 int jffs2_sum_init(struct jffs2_sb_info *c);
 void jffs2_sum_exit(struct jffs2_sb_info *c);
 void jffs2_sum_disable_collecting(struct jffs2_summary *s);
@@ -186,6 +130,7 @@ void jffs2_sum_move_collected(struct jffs2_sb_info *c, struct jffs2_summary *s);
 int jffs2_sum_add_kvec(struct jffs2_sb_info *c, const struct kvec *invecs,
 			unsigned long count,  uint32_t to);
 int jffs2_sum_write_sumnode(struct jffs2_sb_info *c);
+int jffs2_sum_write_contnode(struct jffs2_sb_info *c);
 int jffs2_sum_add_padding_mem(struct jffs2_summary *s, uint32_t size);
 int jffs2_sum_add_inode_mem(struct jffs2_summary *s, struct jffs2_raw_inode *ri, uint32_t ofs);
 int jffs2_sum_add_dirent_mem(struct jffs2_summary *s, struct jffs2_raw_dirent *rd, uint32_t ofs);
@@ -194,10 +139,15 @@ int jffs2_sum_add_xref_mem(struct jffs2_summary *s, struct jffs2_raw_xref *rr, u
 int jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
 			   struct jffs2_raw_summary *summary, uint32_t sumlen,
 			   uint32_t *pseudo_random);
+int jffs2_sum_scan_contnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+			    struct jffs2_raw_summary *summary, uint32_t sumofs, uint32_t sumlen,
+			    uint32_t *pseudo_random, struct jffs2_summary *s);
 
 #else				/* SUMMARY DISABLED */
 
 #define jffs2_sum_active() (0)
+#define jffs2_sum_alloc(a) (NULL)
+#define jffs2_sum_free(a)
 #define jffs2_sum_init(a) (0)
 #define jffs2_sum_exit(a)
 #define jffs2_sum_disable_collecting(a)
@@ -206,12 +156,14 @@ int jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb
 #define jffs2_sum_add_kvec(a,b,c,d) (0)
 #define jffs2_sum_move_collected(a,b)
 #define jffs2_sum_write_sumnode(a) (0)
+#define jffs2_sum_write_contnode(a) (0)
 #define jffs2_sum_add_padding_mem(a,b)
 #define jffs2_sum_add_inode_mem(a,b,c)
 #define jffs2_sum_add_dirent_mem(a,b,c)
 #define jffs2_sum_add_xattr_mem(a,b,c)
 #define jffs2_sum_add_xref_mem(a,b,c)
 #define jffs2_sum_scan_sumnode(a,b,c,d,e) (0)
+#define jffs2_sum_scan_contnode(a,b,c,d,e,f,g) (0)
 
 #endif /* CONFIG_JFFS2_SUMMARY */
 
@@ -20,6 +20,131 @@
 
 static unsigned char jffs2_mounted_number = 0; /* a counter to track the number of jffs2 instances mounted */
 struct MtdNorDev jffs2_dev_list[CONFIG_MTD_PATTITION_NUM];
+static jffs2_mtd_writev_t jffs2_mtd_writev = NULL;
+static uint32_t jffs2_mtd_writesize = JFFS2_WCBUF_SIZE;
+
+/*
+ * Let the MTD driver supply a vectored write, used for every subsequent
+ * mount. MtdDev has no such operation of its own.
+ */
+void jffs2_set_mtd_writev(jffs2_mtd_writev_t writev)
+{
+	jffs2_mtd_writev = writev;
+}
+
+/*
+ * Let the MTD driver say how many bytes it programs at a time, for every
+ * subsequent mount. MtdDev doesn't say. Writes are gathered up into
+ * pages of this size (CONFIG_JFFS2_FS_NOR_WCBUF).
+ */
+void jffs2_set_mtd_writesize(uint32_t writesize)
+{
+	jffs2_mtd_writesize = writesize;
+}
+
+/*
+ * Set how long data may sit in the write-back cache of this mount, and so
+ * how much may be lost on power failure, and how many pages it may hold.
+ * A timeout of zero turns it off and writes out whatever is cached.
+ */
+int jffs2_set_writeback(struct jffs2_inode *root_node, unsigned int timeout_ms,
+			unsigned int max_pages)
+{
+	struct jffs2_sb_info *c = JFFS2_SB_INFO(root_node->i_sb);
+
+	c->mount_opts.wb_max_pages = max_pages;
+	c->mount_opts.wb_timeout_ms = timeout_ms;
+	if (!timeout_ms)
+		return jffs2_wb_writeback(c, (uint64_t)-1);
+	return 0;
+}
+
+/* Turn lazy attribute updates on or off for this mount. Turning them off
+   writes out whatever is held back */
+int jffs2_set_lazytime(struct jffs2_inode *root_node, bool on)
+{
+	struct jffs2_sb_info *c = JFFS2_SB_INFO(root_node->i_sb);
+
+	c->mount_opts.lazy_attr = on;
+	if (!on)
+		return jffs2_wb_writeback(c, (uint64_t)-1);
+	return 0;
+}
+
+/* Take a copy of this mount's statistics. They're updated as we go, so
+   they needn't all be from quite the same moment */
+int jffs2_get_stats(struct jffs2_inode *root_node, struct jffs2_stats *st)
+{
+	struct jffs2_sb_info *c = JFFS2_SB_INFO(root_node->i_sb);
+
+	(void)memcpy_s(st, sizeof(*st), &c->stats, sizeof(c->stats));
+	return 0;
+}
+
+/* Print them, for the shell */
+void jffs2_show_stats(struct jffs2_inode *root_node)
+{
+	jffs2_dump_stats(JFFS2_SB_INFO(root_node->i_sb));
+}
+
+/* Copy out this mount's trace ring, behind a struct jffs2_trace_hdr.
+   Slots which were being written as we copied them come out cleared.
+   Returns the bytes copied */
+int jffs2_get_trace(struct jffs2_inode *root_node, void *buf, size_t len)
+{
+	struct jffs2_sb_info *c = JFFS2_SB_INFO(root_node->i_sb);
+	size_t ringsize = JFFS2_TRACE_ENTRIES * sizeof(struct jffs2_trace_ent);
+	struct jffs2_trace_ent e;
+	struct jffs2_trace_hdr hdr;
+	char *ent;
+	uint32_t i;
+
+	if (!c->trace)
+		return -ENODATA;
+	if (len < sizeof(hdr) + ringsize)
+		return -ERANGE;
+
+	hdr.magic = JFFS2_TRACE_MAGIC;
+	hdr.version = JFFS2_TRACE_VERSION;
+	hdr.entsize = sizeof(struct jffs2_trace_ent);
+	hdr.nr = JFFS2_TRACE_ENTRIES;
+	hdr.seq = (uint32_t)LOS_AtomicRead(&c->trace_seq);
+	(void)memcpy_s(buf, len, &hdr, sizeof(hdr));
+	ent = (char *)buf + sizeof(hdr);
+	for (i = 0; i < JFFS2_TRACE_ENTRIES; i++, ent += sizeof(e)) {
+		if (!jffs2_trace_copy(c, i, &e))
+			(void)memset_s(&e, sizeof(e), 0, sizeof(e));
+		(void)memcpy_s(ent, sizeof(e), &e, sizeof(e));
+	}
+	return sizeof(hdr) + ringsize;
+}
+
+void jffs2_show_trace(struct jffs2_inode *root_node)
+{
+	jffs2_dump_trace(JFFS2_SB_INFO(root_node->i_sb));
+}
+
+/* Get everything for this mount onto the flash, and leave the block being
+   written to summarised so that the next mount can skip scanning it */
+int jffs2_sync_fs(struct jffs2_inode *root_node)
+{
+	struct super_block *sb = root_node->i_sb;
+	struct jffs2_sb_info *c = JFFS2_SB_INFO(sb);
+	int ret;
+
+	if (sb->s_mount_flags & MS_RDONLY)
+		return 0;
+
+	jffs2_aio_drain(c);
+	ret = jffs2_wb_writeback(c, (uint64_t)-1);
+	if (ret)
+		return ret;
+	jffs2_flush_obsolete(c);
+	ret = jffs2_seal_nextblock(c);
+	if (ret)
+		return ret;
+	return jffs2_flush_wcbuf(c);
+}
 
 /*
  * fill in the superblock
@@ -35,6 +160,10 @@ int jffs2_fill_super(struct super_block *sb)
 
 	(void)mutex_init(&c->alloc_sem);
 	(void)mutex_init(&c->erase_free_sem);
+	(void)mutex_init(&c->wcbuf_sem);
+	(void)mutex_init(&c->wb_sem);
+	(void)mutex_init(&c->ra_sem);
+	(void)mutex_init(&c->aio_sem);
 	spin_lock_init(&c->erase_completion_lock);
 	spin_lock_init(&c->inocache_lock);
 
@@ -42,11 +171,36 @@ int jffs2_fill_super(struct super_block *sb)
 	c->sector_size = device->blockSize;
 	c->flash_size  = (device->blockEnd - device->blockStart + 1) * device->blockSize;
 	c->cleanmarker_size = sizeof(struct jffs2_unknown_node);
+#ifdef CONFIG_JFFS2_FS_NOR_WCBUF
+	if (c->wcbuf_size < sizeof(uint32_t) || (c->wcbuf_size & (c->wcbuf_size - 1)) ||
+	    c->wcbuf_size > c->sector_size)
+		c->wcbuf_size = JFFS2_WCBUF_SIZE;
+	/* Without it writes just go straight to the flash */
+	c->wcbuf = zalloc(c->wcbuf_size);
+#endif
+	c->mount_opts.resv_budget_ms = JFFS2_RESV_BUDGET_MS;
+	c->icache_budget = JFFS2_ICACHE_BUDGET;
+	LOS_ListInit(&c->icache_lru);
+	c->mount_opts.wb_timeout_ms = JFFS2_WB_TIMEOUT_MS;
+	c->mount_opts.wb_max_pages = JFFS2_WB_MAX_PAGES;
+	c->mount_opts.lazy_attr = JFFS2_LAZY_ATTR;
+	LOS_ListInit(&c->wb_dirty);
+	LOS_ListInit(&c->aio_queue);
+	/* Tracing is optional, so carry on without it */
+	if (JFFS2_TRACE_ENTRIES)
+		c->trace = zalloc(JFFS2_TRACE_ENTRIES * sizeof(struct jffs2_trace_ent));
 
 	ret = jffs2_do_mount_fs(c);
 	if (ret) {
+		free(c->trace);
+		c->trace = NULL;
+		free(c->wcbuf);
+		c->wcbuf = NULL;
 		(void)mutex_destroy(&c->alloc_sem);
 		(void)mutex_destroy(&c->erase_free_sem);
+		(void)mutex_destroy(&c->wcbuf_sem);
+		(void)mutex_destroy(&c->wb_sem);
+		(void)mutex_destroy(&c->ra_sem);
 		return ret;
 	}
 	D1(printk(KERN_DEBUG "jffs2_fill_super(): Getting root inode\n"));
@@ -59,9 +213,17 @@ int jffs2_fill_super(struct super_block *sb)
 		sb->s_root = NULL;
 		jffs2_free_ino_caches(c);
 		jffs2_free_raw_node_refs(c);
+		jffs2_sum_exit(c);
 		free(c->blocks);
+		free(c->trace);
+		c->trace = NULL;
+		free(c->wcbuf);
+		c->wcbuf = NULL;
 		(void)mutex_destroy(&c->alloc_sem);
 		(void)mutex_destroy(&c->erase_free_sem);
+		(void)mutex_destroy(&c->wcbuf_sem);
+		(void)mutex_destroy(&c->wb_sem);
+		(void)mutex_destroy(&c->ra_sem);
 
 		return ret;
 	}
@@ -75,6 +237,7 @@ int jffs2_mount(int part_no, struct jffs2_inode **root_node, unsigned long mount
 	LOS_DL_LIST *part_head = NULL;
 	struct MtdDev *spinor_mtd = NULL;
 	mtd_partition *mtd_part = GetSpinorPartitionHead();
+	uint64_t start;
 	int ret;
 
 	jffs2_dbg(1, "begin los_jffs2_mount:%d\n", part_no);
@@ -110,6 +273,8 @@ int jffs2_mount(int part_no, struct jffs2_inode **root_node, unsigned long mount
 	(void)FreeMtd(spinor_mtd);
 #endif
 	sb->jffs2_sb.mtd = mtd_part->mtd_info;
+	sb->jffs2_sb.mtd_writev = jffs2_mtd_writev;
+	sb->jffs2_sb.wcbuf_size = jffs2_mtd_writesize;
 	sb->s_dev = &jffs2_dev_list[part_no];
 
 	c = JFFS2_SB_INFO(sb);
@@ -130,6 +295,8 @@ int jffs2_mount(int part_no, struct jffs2_inode **root_node, unsigned long mount
 		(void)jffs2_compressors_init();
 	}
 
+	c->mount_opts.rdonly = !!(mountflags & MS_RDONLY);
+	start = jffs2_now_ns();
 	ret = jffs2_fill_super(sb);
 	if (ret) {
 		if (--jffs2_mounted_number == 0) {
@@ -143,9 +310,15 @@ int jffs2_mount(int part_no, struct jffs2_inode **root_node, unsigned long mount
 		return ret;
 	}
 
-	if (!(mountflags & MS_RDONLY)) {
+	c->stats.mount_ns = jffs2_now_ns() - start;
+
+	/* Read-only, nodes are checked as they're read instead */
+	if (!jffs2_is_readonly(c)) {
 		jffs2_start_garbage_collect_thread(c);
+		jffs2_start_check_threads(c);
+		jffs2_start_aio_threads(c);
 	}
+	jffs2_start_ra_thread(c);
 
 	sb->s_mount_flags = mountflags;
 	*root_node = sb->s_root;
@@ -160,11 +333,38 @@ int jffs2_umount(struct jffs2_inode *root_node)
 
 	D2(PRINTK("Jffs2Umount\n"));
 
+	jffs2_stop_ra_thread(c);
+
 	// Only really umount if this is the only mount
 	if (!(sb->s_mount_flags & MS_RDONLY)) {
+		jffs2_stop_aio_threads(c);
+		(void)jffs2_wb_writeback(c, (uint64_t)-1);
+		if (c->wb_writes)
+			JFFS2_DEBUG("jffs2: write-back cache took %u writes in %u nodes\n",
+				    c->wb_writes, c->wb_nodes);
+		if (c->attr_deferred)
+			JFFS2_DEBUG("jffs2: %u lazy setattrs, %u folded into data nodes, "
+				    "%u metadata nodes\n", c->attr_deferred, c->attr_folded,
+				    c->attr_nodes);
+		jffs2_stop_check_threads(c);
 		jffs2_stop_garbage_collect_thread(c);
+		jffs2_flush_obsolete(c);
+		if (c->obs_marked || c->obs_dropped)
+			JFFS2_DEBUG("jffs2: %u obsolete nodes marked on flash, %u skipped\n",
+				    c->obs_marked, c->obs_dropped);
+		if (c->obsd_hits)
+			JFFS2_DEBUG("jffs2: %u obsolete dirent reads saved\n", c->obsd_hits);
+		(void)jffs2_seal_nextblock(c);
+		/* There's nobody left to tell if this fails; the nodes it
+		   loses are written off and the warning is all we can do */
+		if (jffs2_flush_wcbuf(c) || c->wcbuf_lost)
+			PRINTK("jffs2: %u nodes lost to failed flash programs\n",
+			       c->wcbuf_lost);
 	}
 
+	jffs2_icache_purge(c);
+	jffs2_ra_free(c);
+
 	// free directory entries
 	for (fd = root_node->jffs2_i.dents; fd; fd = next) {
 		next = fd->next;
@@ -176,14 +376,22 @@ int jffs2_umount(struct jffs2_inode *root_node)
 	// Clean up the super block and root_node inode
 	jffs2_free_ino_caches(c);
 	jffs2_free_raw_node_refs(c);
+	jffs2_sum_exit(c);
 	free(c->blocks);
 	c->blocks = NULL;
 	free(c->inocache_list);
 	c->inocache_list = NULL;
+	free(c->trace);
+	c->trace = NULL;
+	free(c->wcbuf);
+	c->wcbuf = NULL;
 	(void)Jffs2HashDeinit(&sb->s_node_hash_lock);
 
 	(void)mutex_destroy(&c->alloc_sem);
 	(void)mutex_destroy(&c->erase_free_sem);
+	(void)mutex_destroy(&c->wcbuf_sem);
+	(void)mutex_destroy(&c->wb_sem);
+	(void)mutex_destroy(&c->ra_sem);
 	free(sb);
 	// That's all folks.
 	D2(PRINTK("Jffs2Umount No current mounts\n"));
@@ -141,12 +141,12 @@ struct jffs2_full_dnode *jffs2_write_dnode(struct jffs2_sb_info *c, struct jffs2
 							     JFFS2_SUMMARY_INODE_SIZE);
 			} else {
 				/* Locking pain */
-				mutex_unlock(&f->sem);
+				jffs2_inode_unlock(f);
 				jffs2_complete_reservation(c);
 
 				ret = jffs2_reserve_space(c, sizeof(*ri) + datalen, &dummy,
 							  alloc_mode, JFFS2_SUMMARY_INODE_SIZE);
-				mutex_lock(&f->sem);
+				jffs2_inode_lock(f);
 			}
 
 			if (!ret) {
@@ -167,17 +167,7 @@ struct jffs2_full_dnode *jffs2_write_dnode(struct jffs2_sb_info *c, struct jffs2
 		return ERR_PTR(ret?ret:-EIO);
 	}
 	/* Mark the space used */
-	/* If node covers at least a whole page, or if it starts at the
-	   beginning of a page and runs to the end of the file, or if
-	   it's a hole node, mark it REF_PRISTINE, else REF_NORMAL.
-	*/
-	if ((je32_to_cpu(ri->dsize) >= PAGE_CACHE_SIZE) ||
-	    ( ((je32_to_cpu(ri->offset)&(PAGE_CACHE_SIZE-1))==0) &&
-	      (je32_to_cpu(ri->dsize)+je32_to_cpu(ri->offset) ==  je32_to_cpu(ri->isize)))) {
-		flash_ofs |= REF_PRISTINE;
-	} else {
-		flash_ofs |= REF_NORMAL;
-	}
+	flash_ofs |= dnode_node_state(ri);
 	fn->raw = jffs2_add_physical_node_ref(c, flash_ofs, PAD(sizeof(*ri)+datalen), f->inocache);
 	if (IS_ERR(fn->raw)) {
 		void *hold_err = fn->raw;
@@ -295,12 +285,12 @@ struct jffs2_full_dirent *jffs2_write_dirent(struct jffs2_sb_info *c, struct jff
 							     JFFS2_SUMMARY_DIRENT_SIZE(namelen));
 			} else {
 				/* Locking pain */
-				mutex_unlock(&f->sem);
+				jffs2_inode_unlock(f);
 				jffs2_complete_reservation(c);
 
 				ret = jffs2_reserve_space(c, sizeof(*rd) + namelen, &dummy,
 							  alloc_mode, JFFS2_SUMMARY_DIRENT_SIZE(namelen));
-				mutex_lock(&f->sem);
+				jffs2_inode_lock(f);
 			}
 
 			if (!ret) {
@@ -335,82 +325,201 @@ struct jffs2_full_dirent *jffs2_write_dirent(struct jffs2_sb_info *c, struct jff
 	return fd;
 }
 
-/* The OS-specific code fills in the metadata in the jffs2_raw_inode for us, so that
-   we don't have to go digging in struct inode or its equivalent. It should set:
-   mode, uid, gid, (starting)isize, atime, ctime, mtime */
-int jffs2_write_inode_range(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
-			    struct jffs2_raw_inode *ri, unsigned char *buf,
-			    uint32_t offset, uint32_t writelen, uint32_t *retlen)
+/* jffs2_write_nodes - write several nodes with a single flash write
+
+   The caller holds a reservation with room for all of them, PAD()ed one
+   after another, and has filled in their CRCs and versions. The nodes go
+   out back to back, each starting on a word boundary, and are then filed
+   in order. There's no retry here: if the write fails the space is marked
+   dirty, nothing is filed and -EAGAIN is returned, and the caller can go
+   back to writing them one at a time with a fresh reservation. */
+int jffs2_write_nodes(struct jffs2_sb_info *c, struct jffs2_multi_node *nodes, int nr)
 {
-	int ret = 0;
-	uint32_t writtenlen = 0;
-	unsigned char *bufRet = NULL;
-	unsigned char *bufRetBak = NULL;
+	static const unsigned char pad[3] = { 0xff, 0xff, 0xff };
+	struct kvec vecs[JFFS2_MULTI_MAX * 3];
+	uint32_t flash_ofs, len = 0, nodelen;
+	unsigned long cnt = 0;
+	size_t retlen;
+	int i, ret;
 
-	jffs2_dbg(1, "%s(): Ino #%u, ofs 0x%x, len 0x%x\n",
-		  __func__, f->inocache->ino, offset, writelen);
+	BUG_ON(nr < 1 || nr > JFFS2_MULTI_MAX);
 
-	if (writelen > 0) {
-		bufRet = kmalloc(writelen, GFP_KERNEL);
-		if (bufRet == NULL) {
-			return -ENOMEM;
+	for (i = 0; i < nr; i++) {
+		vecs[cnt].iov_base = nodes[i].hdr;
+		vecs[cnt++].iov_len = nodes[i].hdrlen;
+		if (nodes[i].datalen) {
+			vecs[cnt].iov_base = (unsigned char *)nodes[i].data;
+			vecs[cnt++].iov_len = nodes[i].datalen;
 		}
-		bufRetBak = bufRet;
-		if (LOS_CopyToKernel(bufRet, writelen, buf, writelen) != 0) {
-			kfree(bufRet);
-			return -EFAULT;
+		nodelen = nodes[i].hdrlen + nodes[i].datalen;
+		len += nodelen;
+		/* Leave the erased padding between nodes as it is */
+		if (i < nr - 1 && PAD(nodelen) != nodelen) {
+			vecs[cnt].iov_base = (unsigned char *)pad;
+			vecs[cnt++].iov_len = PAD(nodelen) - nodelen;
+			len += PAD(nodelen) - nodelen;
 		}
 	}
 
+	/* jffs2_reserve_space() only makes sure of one */
+	ret = jffs2_prealloc_raw_node_refs(c, c->nextblock, nr);
+	if (ret)
+		return ret;
+
+	flash_ofs = write_ofs(c);
+
+	jffs2_dbg_prewrite_paranoia_check(c, flash_ofs, len);
+
+	ret = jffs2_flash_writev(c, vecs, cnt, flash_ofs, &retlen,
+				 nodes[0].ic ? nodes[0].ic->ino : 0);
+	if (ret || (retlen != len)) {
+		pr_notice("Write of %u bytes at 0x%08x failed. returned %d, retlen %zd\n",
+			  len, flash_ofs, ret, retlen);
+		if (retlen)
+			jffs2_add_physical_node_ref(c, flash_ofs | REF_OBSOLETE, PAD(len), NULL);
+		return -EAGAIN;
+	}
+
+	for (i = 0; i < nr; i++) {
+		nodelen = PAD(nodes[i].hdrlen + nodes[i].datalen);
+		nodes[i].raw = jffs2_add_physical_node_ref(c, flash_ofs | nodes[i].state,
+							   nodelen, nodes[i].ic);
+		if (IS_ERR(nodes[i].raw))
+			return PTR_ERR(nodes[i].raw);
+		flash_ofs += nodelen;
+	}
+
+	jffs2_dbg(1, "%s(): wrote %d nodes, 0x%x bytes\n", __func__, nr, len);
+
+	return 0;
+}
+
+/* Write one data node for [offset, offset + datalen), already compressed
+   to cdatalen bytes of comprbuf, into space already reserved for it.
+   Called with f->sem held. If writing the node itself failed,
+   *write_failed is set and the caller may retry with a fresh reservation. */
+int jffs2_write_compr_node(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+			   struct jffs2_raw_inode *ri, unsigned char *comprbuf,
+			   uint16_t comprtype, uint32_t offset, uint32_t datalen,
+			   uint32_t cdatalen, int *write_failed)
+{
+	struct jffs2_full_dnode *fn;
+	int ret;
+
+	*write_failed = 0;
+
+	if (f->attr_dirty) {
+		/* Carry along what jffs2_setattr() left in core. The times
+		   are the write's own */
+		ri->mode = cpu_to_jemode(JFFS2_F_I_MODE(f));
+		ri->uid = cpu_to_je16(JFFS2_F_I_UID(f));
+		ri->gid = cpu_to_je16(JFFS2_F_I_GID(f));
+		ri->atime = cpu_to_je32(JFFS2_F_I_ATIME(f));
+	}
+
+	ri->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
+	ri->nodetype = cpu_to_je16(JFFS2_NODETYPE_INODE);
+	ri->totlen = cpu_to_je32(sizeof(*ri) + cdatalen);
+	ri->hdr_crc = cpu_to_je32(crc32(0, ri, sizeof(struct jffs2_unknown_node)-4));
+
+	ri->ino = cpu_to_je32(f->inocache->ino);
+	ri->version = cpu_to_je32(++f->highest_version);
+	ri->isize = cpu_to_je32(max(je32_to_cpu(ri->isize), offset + datalen));
+	ri->offset = cpu_to_je32(offset);
+	ri->csize = cpu_to_je32(cdatalen);
+	ri->dsize = cpu_to_je32(datalen);
+	ri->compr = comprtype & 0xff;
+	ri->usercompr = (comprtype >> 8 ) & 0xff;
+	ri->node_crc = cpu_to_je32(crc32(0, ri, sizeof(*ri)-8));
+	ri->data_crc = cpu_to_je32(crc32(0, comprbuf, cdatalen));
+
+	fn = jffs2_write_dnode(c, f, ri, comprbuf, cdatalen, ALLOC_NORETRY);
+	if (IS_ERR(fn)) {
+		*write_failed = 1;
+		return PTR_ERR(fn);
+	}
+	ret = jffs2_add_full_dnode_to_inode(c, f, fn);
+	if (f->metadata) {
+		jffs2_mark_node_obsolete(c, f->metadata->raw);
+		jffs2_free_full_dnode(f->metadata);
+		f->metadata = NULL;
+	}
+	if (ret) {
+		/* Eep */
+		jffs2_dbg(1, "Eep. add_full_dnode_to_inode() failed in commit_write, returned %d\n",
+			  ret);
+		jffs2_mark_node_obsolete(c, fn->raw);
+		jffs2_free_full_dnode(fn);
+	} else if (f->attr_dirty) {
+		jffs2_wb_attr_dirty(c, f, 0);
+		c->attr_folded++;
+	}
+	return ret;
+}
+
+/* Write one data node for the start of [offset, offset + writelen), at most
+   up to the end of its page and into the alloclen bytes already reserved.
+   Called with f->sem held. On success *datalen says how much of buf went
+   into it; if writing the node itself failed, *write_failed is set and the
+   caller may retry with a fresh reservation. */
+static int jffs2_write_data_node(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+				 struct jffs2_raw_inode *ri, unsigned char *buf,
+				 uint32_t offset, uint32_t writelen, uint32_t alloclen,
+				 uint32_t *datalen, int *write_failed)
+{
+	unsigned char *comprbuf = NULL;
+	uint16_t comprtype = JFFS2_COMPR_NONE;
+	uint32_t cdatalen;
+	int ret;
+
+	*datalen = min_t(uint32_t, writelen, PAGE_CACHE_SIZE - (offset & (PAGE_CACHE_SIZE-1)));
+	cdatalen = min_t(uint32_t, alloclen - sizeof(*ri), *datalen);
+
+	comprtype = jffs2_compress(c, f, buf, &comprbuf, datalen, &cdatalen);
+
+	ret = jffs2_write_compr_node(c, f, ri, comprbuf, comprtype, offset, *datalen,
+				     cdatalen, write_failed);
+
+	jffs2_free_comprbuf(comprbuf, buf);
+	return ret;
+}
+
+static int jffs2_write_range_nodes(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+				   struct jffs2_raw_inode *ri, unsigned char *buf,
+				   uint32_t offset, uint32_t writelen, uint32_t *retlen,
+				   unsigned int budget_ms)
+{
+	int ret = 0;
+	uint32_t writtenlen = 0;
+
 	while(writelen) {
-		struct jffs2_full_dnode *fn;
-		unsigned char *comprbuf = NULL;
-		uint16_t comprtype = JFFS2_COMPR_NONE;
 		uint32_t alloclen;
-		uint32_t datalen, cdatalen;
+		uint32_t datalen;
 		int retried = 0;
+		int write_failed;
 
 	retry:
 		jffs2_dbg(2, "jffs2_commit_write() loop: 0x%x to write to 0x%x\n",
 			  writelen, offset);
 
-		ret = jffs2_reserve_space(c, sizeof(*ri) + JFFS2_MIN_DATA_LEN,
-					&alloclen, ALLOC_NORMAL, JFFS2_SUMMARY_INODE_SIZE);
+		ret = jffs2_reserve_space_budget(c, sizeof(*ri) + JFFS2_MIN_DATA_LEN,
+					&alloclen, ALLOC_NORMAL, JFFS2_SUMMARY_INODE_SIZE,
+					budget_ms);
 		if (ret) {
 			jffs2_dbg(1, "jffs2_reserve_space returned %d\n", ret);
+			/* Ran out of GC budget part way through: report the
+			   short write rather than an error */
+			if (ret == -EAGAIN && writtenlen)
+				ret = 0;
 			break;
 		}
-		mutex_lock(&f->sem);
-		datalen = min_t(uint32_t, writelen, PAGE_CACHE_SIZE - (offset & (PAGE_CACHE_SIZE-1)));
-		cdatalen = min_t(uint32_t, alloclen - sizeof(*ri), datalen);
-
-		comprtype = jffs2_compress(c, f, bufRet, &comprbuf, &datalen, &cdatalen);
-
-		ri->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
-		ri->nodetype = cpu_to_je16(JFFS2_NODETYPE_INODE);
-		ri->totlen = cpu_to_je32(sizeof(*ri) + cdatalen);
-		ri->hdr_crc = cpu_to_je32(crc32(0, ri, sizeof(struct jffs2_unknown_node)-4));
-
-		ri->ino = cpu_to_je32(f->inocache->ino);
-		ri->version = cpu_to_je32(++f->highest_version);
-		ri->isize = cpu_to_je32(max(je32_to_cpu(ri->isize), offset + datalen));
-		ri->offset = cpu_to_je32(offset);
-		ri->csize = cpu_to_je32(cdatalen);
-		ri->dsize = cpu_to_je32(datalen);
-		ri->compr = comprtype & 0xff;
-		ri->usercompr = (comprtype >> 8 ) & 0xff;
-		ri->node_crc = cpu_to_je32(crc32(0, ri, sizeof(*ri)-8));
-		ri->data_crc = cpu_to_je32(crc32(0, comprbuf, cdatalen));
-
-		fn = jffs2_write_dnode(c, f, ri, comprbuf, cdatalen, ALLOC_NORETRY);
-
-		jffs2_free_comprbuf(comprbuf, bufRet);
-
-		if (IS_ERR(fn)) {
-			ret = PTR_ERR(fn);
-			mutex_unlock(&f->sem);
-			jffs2_complete_reservation(c);
-			if (!retried) {
+		jffs2_inode_lock(f);
+		ret = jffs2_write_data_node(c, f, ri, buf, offset, writelen, alloclen,
+					    &datalen, &write_failed);
+		jffs2_inode_unlock(f);
+		jffs2_complete_reservation(c);
+		if (ret) {
+			if (write_failed && !retried) {
 				/* Write error to be retried */
 				retried = 1;
 				jffs2_dbg(1, "Retrying node write in jffs2_write_inode_range()\n");
@@ -418,40 +527,493 @@ int jffs2_write_inode_range(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 			}
 			break;
 		}
-		ret = jffs2_add_full_dnode_to_inode(c, f, fn);
-		if (f->metadata) {
-			jffs2_mark_node_obsolete(c, f->metadata->raw);
-			jffs2_free_full_dnode(f->metadata);
-			f->metadata = NULL;
+		if (!datalen) {
+			pr_warn("Eep. We didn't actually write any data in jffs2_write_inode_range()\n");
+			ret = -EIO;
+			break;
 		}
-		if (ret) {
-			/* Eep */
-			jffs2_dbg(1, "Eep. add_full_dnode_to_inode() failed in commit_write, returned %d\n",
-				  ret);
-			jffs2_mark_node_obsolete(c, fn->raw);
-			jffs2_free_full_dnode(fn);
+		jffs2_dbg(1, "increasing writtenlen by %d\n", datalen);
+		writtenlen += datalen;
+		offset += datalen;
+		writelen -= datalen;
+		buf += datalen;
+	}
+	*retlen = writtenlen;
+	return ret;
+}
 
-			mutex_unlock(&f->sem);
+/*
+ * Write-back cache.
+ *
+ * With mount_opts.wb_timeout_ms set, data writes go into a page-sized buffer
+ * hanging off the inode instead of straight to the flash, as long as they
+ * land in the same page as, and touch, what's already there. Anything else
+ * writes the buffer out first. So a run of small appends ends up as one
+ * full-page node rather than one small node (and frag) each.
+ *
+ * Lazy jffs2_setattr() changes (f->attr_dirty) wait on the same list.
+ *
+ * jffs2_wb_flush() writes it out, holding f->sem for each node just as the
+ * write-through path does. jffs2_wb_writeback() in fs.c decides when.
+ */
+static void jffs2_wb_clean(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
+{
+	unsigned char *page = f->wb_page;
+	struct jffs2_raw_inode *ri = f->wb_ri;
+
+	mutex_lock(&c->wb_sem);
+	f->wb_page = NULL;
+	f->wb_ri = NULL;
+	f->wb_start = f->wb_end = 0;
+	if (!f->attr_dirty)
+		LOS_ListDelInit(&f->wb_list);
+	c->wb_dirty_pages--;
+	mutex_unlock(&c->wb_sem);
+
+	kfree(page);
+	jffs2_free_raw_inode(ri);
+}
+
+/* Give the cached page the attributes just set on the inode, so that
+   writing it out later doesn't undo them. Called with f->sem held */
+void jffs2_wb_set_attr(struct jffs2_inode_info *f, struct jffs2_raw_inode *ri)
+{
+	if (!f->wb_ri)
+		return;
+	f->wb_ri->mode = ri->mode;
+	f->wb_ri->uid = ri->uid;
+	f->wb_ri->gid = ri->gid;
+	f->wb_ri->atime = ri->atime;
+	f->wb_ri->mtime = ri->mtime;
+	f->wb_ri->ctime = ri->ctime;
+}
+
+/* Note that the in-core attributes of the inode are, or are no longer,
+   newer than those on the flash. Called with f->sem held */
+void jffs2_wb_attr_dirty(struct jffs2_sb_info *c, struct jffs2_inode_info *f, int dirty)
+{
+	mutex_lock(&c->wb_sem);
+	if (dirty) {
+		if (LOS_ListEmpty(&f->wb_list)) {
+			f->wb_stamp = jffs2_now_ns();
+			LOS_ListTailInsert(&c->wb_dirty, &f->wb_list);
+		}
+		c->attr_deferred++;
+	} else if (!f->wb_page) {
+		LOS_ListDelInit(&f->wb_list);
+	}
+	f->attr_dirty = dirty;
+	mutex_unlock(&c->wb_sem);
+}
+
+/* Write the attributes jffs2_setattr() left in core as a metadata node */
+static int jffs2_wb_flush_attr(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
+{
+	struct jffs2_full_dnode *new_metadata;
+	struct jffs2_raw_inode *ri;
+	uint32_t alloclen;
+	int ret;
+
+	ri = jffs2_alloc_raw_inode();
+	if (!ri)
+		return -ENOMEM;
+
+	ret = jffs2_reserve_space(c, sizeof(*ri), &alloclen, ALLOC_NORMAL, JFFS2_SUMMARY_INODE_SIZE);
+	if (ret) {
+		jffs2_free_raw_inode(ri);
+		return ret;
+	}
+
+	jffs2_inode_lock(f);
+	if (!f->attr_dirty)
+		goto out;
+
+	(void)memset_s(ri, sizeof(*ri), 0, sizeof(*ri));
+	ri->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
+	ri->nodetype = cpu_to_je16(JFFS2_NODETYPE_INODE);
+	ri->totlen = cpu_to_je32(sizeof(*ri));
+	ri->hdr_crc = cpu_to_je32(crc32(0, ri, sizeof(struct jffs2_unknown_node)-4));
+
+	ri->ino = cpu_to_je32(f->inocache->ino);
+	ri->version = cpu_to_je32(++f->highest_version);
+	ri->mode = cpu_to_jemode(JFFS2_F_I_MODE(f));
+	ri->uid = cpu_to_je16(JFFS2_F_I_UID(f));
+	ri->gid = cpu_to_je16(JFFS2_F_I_GID(f));
+	ri->isize = cpu_to_je32(JFFS2_F_I_SIZE(f));
+	ri->atime = cpu_to_je32(JFFS2_F_I_ATIME(f));
+	ri->mtime = cpu_to_je32(JFFS2_F_I_MTIME(f));
+	ri->ctime = cpu_to_je32(JFFS2_F_I_CTIME(f));
+	ri->compr = JFFS2_COMPR_NONE;
+	ri->node_crc = cpu_to_je32(crc32(0, ri, sizeof(*ri)-8));
+	ri->data_crc = cpu_to_je32(0);
+
+	new_metadata = jffs2_write_dnode(c, f, ri, NULL, 0, ALLOC_NORMAL);
+	if (IS_ERR(new_metadata)) {
+		ret = PTR_ERR(new_metadata);
+		goto out;
+	}
+	if (f->metadata) {
+		jffs2_mark_node_obsolete(c, f->metadata->raw);
+		jffs2_free_full_dnode(f->metadata);
+	}
+	f->metadata = new_metadata;
+	jffs2_wb_attr_dirty(c, f, 0);
+	c->attr_nodes++;
+ out:
+	jffs2_inode_unlock(f);
+	jffs2_complete_reservation(c);
+	jffs2_free_raw_inode(ri);
+	return ret;
+}
+
+int jffs2_wb_flush(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
+{
+	uint32_t alloclen, datalen;
+	int retried = 0;
+	int write_failed;
+	int ret = 0;
+
+	while (f->wb_page) {
+		ret = jffs2_reserve_space(c, sizeof(struct jffs2_raw_inode) + JFFS2_MIN_DATA_LEN,
+					  &alloclen, ALLOC_NORMAL, JFFS2_SUMMARY_INODE_SIZE);
+		if (ret)
+			break;
+
+		jffs2_inode_lock(f);
+		if (!f->wb_page) {
+			jffs2_inode_unlock(f);
 			jffs2_complete_reservation(c);
 			break;
 		}
-		mutex_unlock(&f->sem);
+		jffs2_dbg(1, "%s(): ino #%u, range 0x%x-0x%x\n", __func__, f->inocache->ino,
+			  f->wb_ofs + f->wb_start, f->wb_ofs + f->wb_end);
+		ret = jffs2_write_data_node(c, f, f->wb_ri, f->wb_page + f->wb_start,
+					    f->wb_ofs + f->wb_start, f->wb_end - f->wb_start,
+					    alloclen, &datalen, &write_failed);
+		if (!ret) {
+			c->wb_nodes++;
+			if (f->wb_start + datalen >= f->wb_end) {
+				jffs2_wb_clean(c, f);
+			} else {
+				mutex_lock(&c->wb_sem);
+				f->wb_start += datalen;
+				mutex_unlock(&c->wb_sem);
+			}
+		}
+		jffs2_inode_unlock(f);
 		jffs2_complete_reservation(c);
+
+		if (ret) {
+			if (write_failed && !retried) {
+				retried = 1;
+				continue;
+			}
+			break;
+		}
 		if (!datalen) {
-			pr_warn("Eep. We didn't actually write any data in jffs2_write_inode_range()\n");
 			ret = -EIO;
 			break;
 		}
-		jffs2_dbg(1, "increasing writtenlen by %d\n", datalen);
+	}
+	if (!ret && f->attr_dirty)
+		ret = jffs2_wb_flush_attr(c, f);
+	return ret;
+}
+
+/* The inode is going away for good; nobody will read this back */
+void jffs2_wb_discard(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
+{
+	if (f->attr_dirty)
+		jffs2_wb_attr_dirty(c, f, 0);
+	if (f->wb_page)
+		jffs2_wb_clean(c, f);
+}
+
+/* Copy whatever of [offset, offset + len) is still in the write-back page
+   over what was read from the flash */
+void jffs2_wb_overlay(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+		      unsigned char *buf, uint32_t offset, uint32_t len)
+{
+	uint32_t start, end;
+
+	mutex_lock(&c->wb_sem);
+	if (f->wb_page) {
+		start = max(offset, f->wb_ofs + f->wb_start);
+		end = min(offset + len, f->wb_ofs + f->wb_end);
+		if (start < end)
+			(void)LOS_CopyFromKernel(buf + (start - offset), end - start,
+						 f->wb_page + (start - f->wb_ofs), end - start);
+	}
+	mutex_unlock(&c->wb_sem);
+}
+
+/* Put [offset, offset + len), which lies within one page, into the
+   write-back page. Returns 1 if it can't go there as things stand and
+   the page has to be written out first, or -ENOMEM */
+static int jffs2_wb_add(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+			struct jffs2_raw_inode *ri, unsigned char *buf,
+			uint32_t offset, uint32_t len)
+{
+	uint32_t pgofs = offset & ~(PAGE_CACHE_SIZE-1);
+	uint32_t start = offset - pgofs;
+	uint32_t end = start + len;
+
+	if (f->wb_page && (f->wb_ofs != pgofs || end < f->wb_start || start > f->wb_end))
+		return 1;
+
+	if (!f->wb_page) {
+		unsigned char *page = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
+		struct jffs2_raw_inode *wb_ri = jffs2_alloc_raw_inode();
+
+		if (!page || !wb_ri) {
+			kfree(page);
+			if (wb_ri)
+				jffs2_free_raw_inode(wb_ri);
+			return -ENOMEM;
+		}
+		mutex_lock(&c->wb_sem);
+		f->wb_page = page;
+		f->wb_ri = wb_ri;
+		f->wb_ofs = pgofs;
+		f->wb_start = start;
+		f->wb_end = end;
+		if (LOS_ListEmpty(&f->wb_list)) {
+			f->wb_stamp = jffs2_now_ns();
+			LOS_ListTailInsert(&c->wb_dirty, &f->wb_list);
+		}
+		c->wb_dirty_pages++;
+	} else {
+		mutex_lock(&c->wb_sem);
+		f->wb_start = min(f->wb_start, start);
+		f->wb_end = max(f->wb_end, end);
+	}
+	(void)memcpy_s(f->wb_page + start, PAGE_CACHE_SIZE - start, buf, len);
+	mutex_unlock(&c->wb_sem);
+
+	/* The newest metadata wins, and the size never goes backwards */
+	*f->wb_ri = *ri;
+	f->wb_ri->isize = cpu_to_je32(max(je32_to_cpu(ri->isize), pgofs + f->wb_end));
+	c->wb_writes++;
+	return 0;
+}
+
+static int jffs2_wb_write(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+			  struct jffs2_raw_inode *ri, unsigned char *buf,
+			  uint32_t offset, uint32_t writelen, uint32_t *retlen,
+			  unsigned int budget_ms)
+{
+	uint32_t writtenlen = 0;
+	uint32_t datalen, len;
+	int full;
+	int ret = 0;
+
+	while (writelen) {
+		datalen = min_t(uint32_t, writelen, PAGE_CACHE_SIZE - (offset & (PAGE_CACHE_SIZE-1)));
+
+		jffs2_inode_lock(f);
+		ret = jffs2_wb_add(c, f, ri, buf, offset, datalen);
+		full = !ret && f->wb_start == 0 && f->wb_end == PAGE_CACHE_SIZE;
+		jffs2_inode_unlock(f);
+
+		if (ret == 1) {
+			ret = jffs2_wb_flush(c, f);
+			if (ret)
+				break;
+			continue;
+		}
+		if (ret == -ENOMEM) {
+			/* Can't cache it; write it through instead */
+			ret = jffs2_wb_flush(c, f);
+			if (!ret)
+				ret = jffs2_write_range_nodes(c, f, ri, buf, offset, datalen, &len,
+							      budget_ms);
+			if (ret)
+				break;
+			datalen = len;
+		} else if (full) {
+			ret = jffs2_wb_flush(c, f);
+			if (ret)
+				break;
+		}
 		writtenlen += datalen;
 		offset += datalen;
 		writelen -= datalen;
-		bufRet += datalen;
+		buf += datalen;
 	}
 	*retlen = writtenlen;
-	if (bufRetBak != NULL) {
-		kfree(bufRetBak);
+
+	/* Writers are the ones making the mess; they can clean it up */
+	if (!ret && c->wb_dirty_pages > c->mount_opts.wb_max_pages)
+		(void)jffs2_wb_writeback(c, 0);
+
+	/* Whatever we took is ours now, and will get to the flash */
+	if (writtenlen)
+		ret = 0;
+	return ret;
+}
+
+/* The OS-specific code fills in the metadata in the jffs2_raw_inode for us, so that
+   we don't have to go digging in struct inode or its equivalent. It should set:
+   mode, uid, gid, (starting)isize, atime, ctime, mtime */
+int jffs2_write_inode_range(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+			    struct jffs2_raw_inode *ri, unsigned char *buf,
+			    uint32_t offset, uint32_t writelen, uint32_t *retlen)
+{
+	return jffs2_write_inode_range_budget(c, f, ri, buf, offset, writelen, retlen, 0);
+}
+
+/* As jffs2_write_inode_range(), but for callers which would rather hear
+   -EAGAIN than wait for the garbage collector, e.g. O_NONBLOCK writers.
+   Once @budget_ms has gone on GC the write stops: a short write if any of
+   it made it, -EAGAIN if none did. Callers normally pass
+   c->mount_opts.resv_budget_ms; zero means no limit. */
+int jffs2_write_inode_range_budget(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+				   struct jffs2_raw_inode *ri, unsigned char *buf,
+				   uint32_t offset, uint32_t writelen, uint32_t *retlen,
+				   unsigned int budget_ms)
+{
+	int ret = 0;
+	unsigned char *bufRet = NULL;
+	uint64_t start = jffs2_now_ns();
+
+	jffs2_dbg(1, "%s(): Ino #%u, ofs 0x%x, len 0x%x\n",
+		  __func__, f->inocache->ino, offset, writelen);
+
+	*retlen = 0;
+	if (writelen == 0)
+		return 0;
+
+	/* Let any async writes to the file land first, or they'd land on
+	   top of this one */
+	jffs2_aio_wait_inode(c, f);
+
+	bufRet = kmalloc(writelen, GFP_KERNEL);
+	if (bufRet == NULL) {
+		return -ENOMEM;
+	}
+	if (LOS_CopyToKernel(bufRet, writelen, buf, writelen) != 0) {
+		kfree(bufRet);
+		return -EFAULT;
+	}
+
+	if (c->mount_opts.wb_timeout_ms)
+		ret = jffs2_wb_write(c, f, ri, bufRet, offset, writelen, retlen, budget_ms);
+	else
+		ret = jffs2_write_range_nodes(c, f, ri, bufRet, offset, writelen, retlen,
+					      budget_ms);
+
+	kfree(bufRet);
+	LOS_Atomic64Add(&c->stats.write_bytes, *retlen);
+	jffs2_lat_hist_add(&c->stats.write_lat, jffs2_now_ns() - start);
+	return ret;
+}
+
+static void jffs2_fill_dirent(struct jffs2_raw_dirent *rd, struct jffs2_inode_info *dir_f,
+			      uint32_t ino, uint8_t type, const char *name, int namelen,
+			      uint32_t time)
+{
+	rd->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
+	rd->nodetype = cpu_to_je16(JFFS2_NODETYPE_DIRENT);
+	rd->totlen = cpu_to_je32(sizeof(*rd) + namelen);
+	rd->hdr_crc = cpu_to_je32(crc32(0, rd, sizeof(struct jffs2_unknown_node)-4));
+
+	rd->pino = cpu_to_je32(dir_f->inocache->ino);
+	rd->version = cpu_to_je32(++dir_f->highest_version);
+	rd->ino = cpu_to_je32(ino);
+	rd->mctime = cpu_to_je32(time);
+	rd->nsize = namelen;
+	rd->type = type;
+	rd->node_crc = cpu_to_je32(crc32(0, rd, sizeof(*rd)-8));
+	rd->name_crc = cpu_to_je32(crc32(0, name, namelen));
+}
+
+/* The in-core side of a dirent which jffs2_write_nodes() has written */
+static void jffs2_fill_full_dirent(struct jffs2_full_dirent *fd, struct jffs2_raw_dirent *rd,
+				   struct jffs2_raw_node_ref *raw, const char *name, int namelen)
+{
+	fd->raw = raw;
+	fd->version = je32_to_cpu(rd->version);
+	fd->ino = je32_to_cpu(rd->ino);
+	fd->nhash = full_name_hash((const unsigned char *)name, namelen);
+	fd->type = rd->type;
+	memcpy(fd->name, name, namelen);
+	fd->name[namelen] = 0;
+}
+
+/* Write a new inode and its dirent together, into the reservation we
+   hold, which this completes. -EAGAIN means the write failed and nothing
+   has been filed */
+static int jffs2_do_create_multi(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f,
+				 struct jffs2_inode_info *f, struct jffs2_raw_inode *ri,
+				 const char *name, int namelen)
+{
+	struct jffs2_multi_node nodes[2];
+	struct jffs2_raw_dirent *rd;
+	struct jffs2_full_dnode *fn;
+	struct jffs2_full_dirent *fd;
+	int ret = -ENOMEM;
+
+	rd = jffs2_alloc_raw_dirent();
+	fn = jffs2_alloc_full_dnode();
+	fd = jffs2_alloc_full_dirent(namelen+1);
+	if (!rd || !fn || !fd)
+		goto out;
+
+	/* Nobody else can see f yet, so the order doesn't matter */
+	jffs2_inode_lock(dir_f);
+	jffs2_inode_lock(f);
+
+	ri->data_crc = cpu_to_je32(0);
+	ri->node_crc = cpu_to_je32(crc32(0, ri, sizeof(*ri)-8));
+	jffs2_fill_dirent(rd, dir_f, je32_to_cpu(ri->ino), DT_REG, name, namelen,
+			  je32_to_cpu(ri->ctime));
+
+	nodes[0].hdr = ri;
+	nodes[0].hdrlen = sizeof(*ri);
+	nodes[0].data = NULL;
+	nodes[0].datalen = 0;
+	nodes[0].state = dnode_node_state(ri);
+	nodes[0].ic = f->inocache;
+	nodes[1].hdr = rd;
+	nodes[1].hdrlen = sizeof(*rd);
+	nodes[1].data = (const unsigned char *)name;
+	nodes[1].datalen = namelen;
+	nodes[1].state = dirent_node_state(rd);
+	nodes[1].ic = dir_f->inocache;
+
+	ret = jffs2_write_nodes(c, nodes, 2);
+	if (ret) {
+		jffs2_inode_unlock(f);
+		jffs2_inode_unlock(dir_f);
+		goto out;
 	}
+
+	/* No data here. Only a metadata node, which will be
+	   obsoleted by the first data write
+	*/
+	fn->raw = nodes[0].raw;
+	fn->ofs = 0;
+	fn->size = 0;
+	fn->frags = 0;
+	f->metadata = fn;
+	fn = NULL;
+	jffs2_inode_unlock(f);
+
+	jffs2_fill_full_dirent(fd, rd, nodes[1].raw, name, namelen);
+	jffs2_add_fd_to_list(c, fd, &dir_f->dents);
+	fd = NULL;
+	jffs2_inode_unlock(dir_f);
+
+	jffs2_dbg(1, "jffs2_do_create created file with mode 0x%x, with its dirent\n",
+		  jemode_to_cpu(ri->mode));
+ out:
+	jffs2_complete_reservation(c);
+	if (fd)
+		jffs2_free_full_dirent(fd);
+	if (fn)
+		jffs2_free_full_dnode(fn);
+	if (rd)
+		jffs2_free_raw_dirent(rd);
 	return ret;
 }
 
@@ -466,15 +1028,28 @@ int jffs2_do_create(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f,
 	int ret;
 
 	/* Try to reserve enough space for both node and dirent.
-	 * Just the node will do for now, though
+	 * Just the node will do, though: if that's all the current block
+	 * has room for, write them one at a time rather than waste it
 	 */
 	ret = jffs2_reserve_space(c, sizeof(*ri), &alloclen, ALLOC_NORMAL,
-				JFFS2_SUMMARY_INODE_SIZE);
+				JFFS2_SUMMARY_INODE_SIZE + JFFS2_SUMMARY_DIRENT_SIZE(namelen));
 	jffs2_dbg(1, "%s(): reserved 0x%x bytes\n", __func__, alloclen);
 	if (ret)
 		return ret;
 
-	mutex_lock(&f->sem);
+	if (alloclen >= PAD(sizeof(*ri)) + PAD(sizeof(*rd) + namelen)) {
+		ret = jffs2_do_create_multi(c, dir_f, f, ri, name, namelen);
+		if (ret != -EAGAIN)
+			return ret;
+
+		/* Have another go the long way round */
+		ret = jffs2_reserve_space(c, sizeof(*ri), &alloclen, ALLOC_NORMAL,
+					JFFS2_SUMMARY_INODE_SIZE);
+		if (ret)
+			return ret;
+	}
+
+	jffs2_inode_lock(f);
 
 	ri->data_crc = cpu_to_je32(0);
 	ri->node_crc = cpu_to_je32(crc32(0, ri, sizeof(*ri)-8));
@@ -488,7 +1063,7 @@ int jffs2_do_create(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f,
 		jffs2_dbg(1, "jffs2_write_dnode() failed,error:%ld\n",
 		    PTR_ERR(fn));
 		/* Eeek. Wave bye bye */
-		mutex_unlock(&f->sem);
+		jffs2_inode_unlock(f);
 		jffs2_complete_reservation(c);
 		return PTR_ERR(fn);
 	}
@@ -497,7 +1072,7 @@ int jffs2_do_create(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f,
 	*/
 	f->metadata = fn;
 
-	mutex_unlock(&f->sem);
+	jffs2_inode_unlock(f);
 	jffs2_complete_reservation(c);
 
 	ret = jffs2_reserve_space(c, sizeof(*rd)+ namelen, &alloclen,
@@ -516,7 +1091,7 @@ int jffs2_do_create(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f,
 		return -ENOMEM;
 	}
 
-	mutex_lock(&dir_f->sem);
+	jffs2_inode_lock(dir_f);
 
 	rd->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
 	rd->nodetype = cpu_to_je16(JFFS2_NODETYPE_DIRENT);
@@ -540,7 +1115,7 @@ int jffs2_do_create(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f,
 		/* dirent failed to write. Delete the inode normally
 		   as if it were the final unlink() */
 		jffs2_complete_reservation(c);
-		mutex_unlock(&dir_f->sem);
+		jffs2_inode_unlock(dir_f);
 		return PTR_ERR(fd);
 	}
 
@@ -549,12 +1124,40 @@ int jffs2_do_create(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f,
 	jffs2_add_fd_to_list(c, fd, &dir_f->dents);
 
 	jffs2_complete_reservation(c);
-	mutex_unlock(&dir_f->sem);
+	jffs2_inode_unlock(dir_f);
 
 	return 0;
 }
 
 
+/* Mark the dirent for name in dir_f obsolete, instead of writing a
+   deletion dirent. Called with alloc_sem and dir_f's lock held */
+static void jffs2_obsolete_dirent(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f,
+				  const char *name, int namelen)
+{
+	uint32_t nhash = full_name_hash((const unsigned char *)name, namelen);
+	struct jffs2_full_dirent *fd;
+
+	for (fd = dir_f->dents; fd; fd = fd->next) {
+		if (fd->nhash == nhash &&
+		    !memcmp(fd->name, name, namelen) &&
+		    !fd->name[namelen]) {
+
+			jffs2_dbg(1, "Marking old dirent node (ino #%u) @%08x obsolete\n",
+				  fd->ino, ref_offset(fd->raw));
+			jffs2_mark_node_obsolete(c, fd->raw);
+			jffs2_obsd_add_fd(c, fd);
+			/* We don't want to remove it from the list immediately,
+			   because that screws up getdents()/seek() semantics even
+			   more than they're screwed already. Turn it into a
+			   node-less deletion dirent instead -- a placeholder */
+			fd->raw = NULL;
+			fd->ino = 0;
+			break;
+		}
+	}
+}
+
 int jffs2_do_unlink(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f,
 		    const char *name, int namelen, struct jffs2_inode_info *dead_f,
 		    uint32_t time)
@@ -578,7 +1181,7 @@ int jffs2_do_unlink(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f,
 			return ret;
 		}
 
-		mutex_lock(&dir_f->sem);
+		jffs2_inode_lock(dir_f);
 
 		/* Build a deletion node */
 		rd->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
@@ -601,40 +1204,20 @@ int jffs2_do_unlink(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f,
 
 		if (IS_ERR(fd)) {
 			jffs2_complete_reservation(c);
-			mutex_unlock(&dir_f->sem);
+			jffs2_inode_unlock(dir_f);
 			return PTR_ERR(fd);
 		}
 
 		/* File it. This will mark the old one obsolete. */
 		jffs2_add_fd_to_list(c, fd, &dir_f->dents);
-		mutex_unlock(&dir_f->sem);
+		jffs2_inode_unlock(dir_f);
 	} else {
-		uint32_t nhash = full_name_hash((const unsigned char *)name, namelen);
-
-		fd = dir_f->dents;
 		/* We don't actually want to reserve any space, but we do
 		   want to be holding the alloc_sem when we write to flash */
 		mutex_lock(&c->alloc_sem);
-		mutex_lock(&dir_f->sem);
-
-		for (fd = dir_f->dents; fd; fd = fd->next) {
-			if (fd->nhash == nhash &&
-			    !memcmp(fd->name, name, namelen) &&
-			    !fd->name[namelen]) {
-
-				jffs2_dbg(1, "Marking old dirent node (ino #%u) @%08x obsolete\n",
-					  fd->ino, ref_offset(fd->raw));
-				jffs2_mark_node_obsolete(c, fd->raw);
-				/* We don't want to remove it from the list immediately,
-				   because that screws up getdents()/seek() semantics even
-				   more than they're screwed already. Turn it into a
-				   node-less deletion dirent instead -- a placeholder */
-				fd->raw = NULL;
-				fd->ino = 0;
-				break;
-			}
-		}
-		mutex_unlock(&dir_f->sem);
+		jffs2_inode_lock(dir_f);
+		jffs2_obsolete_dirent(c, dir_f, name, namelen);
+		jffs2_inode_unlock(dir_f);
 	}
 
 	/* dead_f is NULL if this was a rename not a real unlink */
@@ -642,7 +1225,7 @@ int jffs2_do_unlink(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f,
 	   pointing to an inode which didn't exist. */
 	if (dead_f && dead_f->inocache) {
 
-		mutex_lock(&dead_f->sem);
+		jffs2_inode_lock(dead_f);
 
 		if (S_ISDIR(OFNI_EDONI_2SFFJ(dead_f)->i_mode)) {
 			while (dead_f->dents) {
@@ -660,15 +1243,17 @@ int jffs2_do_unlink(struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f,
 						  fd->name,
 						  dead_f->inocache->ino);
 				}
-				if (fd->raw)
+				if (fd->raw) {
 					jffs2_mark_node_obsolete(c, fd->raw);
+					jffs2_obsd_add_fd(c, fd);
+				}
 				jffs2_free_full_dirent(fd);
 			}
 			dead_f->inocache->pino_nlink = 0;
 		} else
 			dead_f->inocache->pino_nlink--;
 		/* NB: Caller must set inode nlink if appropriate */
-		mutex_unlock(&dead_f->sem);
+		jffs2_inode_unlock(dead_f);
 	}
 
 	jffs2_complete_reservation(c);
@@ -695,7 +1280,7 @@ int jffs2_do_link (struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f, uint
 		return ret;
 	}
 
-	mutex_lock(&dir_f->sem);
+	jffs2_inode_lock(dir_f);
 
 	/* Build a deletion node */
 	rd->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
@@ -720,7 +1305,7 @@ int jffs2_do_link (struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f, uint
 
 	if (IS_ERR(fd)) {
 		jffs2_complete_reservation(c);
-		mutex_unlock(&dir_f->sem);
+		jffs2_inode_unlock(dir_f);
 		return PTR_ERR(fd);
 	}
 
@@ -728,7 +1313,100 @@ int jffs2_do_link (struct jffs2_sb_info *c, struct jffs2_inode_info *dir_f, uint
 	jffs2_add_fd_to_list(c, fd, &dir_f->dents);
 
 	jffs2_complete_reservation(c);
-	mutex_unlock(&dir_f->sem);
+	jffs2_inode_unlock(dir_f);
 
 	return 0;
 }
+
+/* jffs2_do_rename - link ino into new_dir_f and unlink it from old_dir_f
+
+   Both dirents -- the new one, and the deletion dirent for the old name if
+   we have to write one -- are written together with a single reservation.
+   Returns -EAGAIN, having done nothing, if they won't both fit in the
+   current block or the write fails; the caller should then fall back to
+   jffs2_do_link() and jffs2_do_unlink(). */
+int jffs2_do_rename(struct jffs2_sb_info *c, struct jffs2_inode_info *old_dir_f,
+		    const char *old_name, int old_namelen,
+		    struct jffs2_inode_info *new_dir_f, uint32_t ino, uint8_t type,
+		    const char *new_name, int new_namelen, uint32_t time)
+{
+	/* As in jffs2_do_unlink() */
+	int nr = jffs2_can_mark_obsolete(c) ? 2 : 1;
+	struct jffs2_multi_node nodes[2];
+	struct jffs2_raw_dirent *rd[2] = { NULL, NULL };
+	struct jffs2_full_dirent *fd[2] = { NULL, NULL };
+	const char *names[2] = { new_name, old_name };
+	int namelens[2] = { new_namelen, old_namelen };
+	uint32_t alloclen, needed, sumsize;
+	int i, ret = -ENOMEM;
+
+	needed = PAD(sizeof(*rd[0]) + new_namelen);
+	sumsize = JFFS2_SUMMARY_DIRENT_SIZE(new_namelen);
+	if (nr == 2) {
+		needed += PAD(sizeof(*rd[1]) + old_namelen);
+		sumsize += JFFS2_SUMMARY_DIRENT_SIZE(old_namelen);
+	}
+
+	for (i = 0; i < nr; i++) {
+		rd[i] = jffs2_alloc_raw_dirent();
+		fd[i] = jffs2_alloc_full_dirent(namelens[i] + 1);
+		if (!rd[i] || !fd[i])
+			goto out_free;
+	}
+
+	ret = jffs2_reserve_space(c, sizeof(*rd[0]) + new_namelen, &alloclen,
+				  ALLOC_NORMAL, sumsize);
+	if (ret)
+		goto out_free;
+	if (alloclen < needed) {
+		ret = -EAGAIN;
+		goto out_complete;
+	}
+
+	jffs2_inode_lock(new_dir_f);
+	if (old_dir_f != new_dir_f)
+		jffs2_inode_lock(old_dir_f);
+
+	jffs2_fill_dirent(rd[0], new_dir_f, ino, type, new_name, new_namelen, time);
+	if (nr == 2)
+		jffs2_fill_dirent(rd[1], old_dir_f, 0, DT_UNKNOWN, old_name, old_namelen, time);
+
+	for (i = 0; i < nr; i++) {
+		nodes[i].hdr = rd[i];
+		nodes[i].hdrlen = sizeof(*rd[i]);
+		nodes[i].data = (const unsigned char *)names[i];
+		nodes[i].datalen = namelens[i];
+		nodes[i].state = dirent_node_state(rd[i]);
+		nodes[i].ic = (i ? old_dir_f : new_dir_f)->inocache;
+	}
+
+	ret = jffs2_write_nodes(c, nodes, nr);
+	if (!ret) {
+		/* File them. This will mark the old ones obsolete */
+		jffs2_fill_full_dirent(fd[0], rd[0], nodes[0].raw, new_name, new_namelen);
+		jffs2_add_fd_to_list(c, fd[0], &new_dir_f->dents);
+		fd[0] = NULL;
+		if (nr == 2) {
+			jffs2_fill_full_dirent(fd[1], rd[1], nodes[1].raw, old_name, old_namelen);
+			jffs2_add_fd_to_list(c, fd[1], &old_dir_f->dents);
+			fd[1] = NULL;
+		} else {
+			jffs2_obsolete_dirent(c, old_dir_f, old_name, old_namelen);
+		}
+	}
+
+	if (old_dir_f != new_dir_f)
+		jffs2_inode_unlock(old_dir_f);
+	jffs2_inode_unlock(new_dir_f);
+
+ out_complete:
+	jffs2_complete_reservation(c);
+ out_free:
+	for (i = 0; i < nr; i++) {
+		if (fd[i])
+			jffs2_free_full_dirent(fd[i]);
+		if (rd[i])
+			jffs2_free_raw_dirent(rd[i]);
+	}
+	return ret;
+}
@@ -13,78 +13,87 @@
 #include "mtd_dev.h"
 #include "nodelist.h"
 
+/* Stack buffer for the bytes which can't be written in place */
+#define WRITEV_STAGE_SIZE 256
+
+static int jffs2_writev_flush_stage(struct jffs2_sb_info *c, loff_t ofs,
+				    uint32_t *stage, size_t *pend, size_t *totlen)
+{
+	size_t len = PAD(*pend), thislen;
+	int ret;
+
+	/* Pad out to a word with 0xFF, which programs nothing */
+	(void)memset_s((unsigned char *)stage + *pend, WRITEV_STAGE_SIZE - *pend, 0xFF, len - *pend);
+	ret = jffs2_flash_direct_write(c, ofs, len, &thislen, (unsigned char *)stage);
+	if (thislen > *pend) // in case it was aligned up
+		thislen = *pend;
+	*totlen += thislen;
+	if (!ret && thislen != *pend)
+		ret = -EIO;
+	*pend = 0;
+	return ret;
+}
+
 int jffs2_flash_direct_writev(struct jffs2_sb_info *c, const struct kvec *vecs,
 			      unsigned long count, loff_t to, size_t *retlen)
 {
+	uint32_t stage[WRITEV_STAGE_SIZE / sizeof(uint32_t)];
+	size_t totlen = 0, pend = 0, thislen, len, n;
+	const unsigned char *p;
 	unsigned long i;
-	size_t totlen = 0, thislen;
 	int ret = 0;
 
+#ifndef CONFIG_JFFS2_FS_NOR_WCBUF
+	/* Otherwise jffs2_flash_writev() has done this already */
+	if (jffs2_sum_active()) {
+		ret = jffs2_sum_add_kvec(c, vecs, count, (uint32_t)to);
+		if (ret)
+			return ret;
+	}
+#endif
+
+	if (c->mtd_writev) {
+		ret = c->mtd_writev(c->mtd, vecs, count, to, &totlen);
+		goto writev_out;
+	}
+
+	// writes need to be aligned but the data we're passed may not be.
+	// Write whatever is word aligned at both ends straight from the
+	// caller's buffer, and gather the odd bytes in between (usually
+	// just the tail of a node) on the stack.
 	for (i = 0; i < count; i++) {
-		// writes need to be aligned but the data we're passed may not be
-		// Observation suggests most unaligned writes are small, so we
-		// optimize for that case.
-
-		if (((vecs[i].iov_len & (sizeof(int) - 1))) ||
-		(((unsigned long) vecs[i].iov_base & (sizeof(unsigned long) - 1)))) {
-			// are there iov's after this one? Or is it so much we'd need
-			// to do multiple writes anyway?
-			if ((i + 1) < count || vecs[i].iov_len > 256) {
-				// cop out and malloc
-				unsigned long j;
-				size_t sizetomalloc = 0, totvecsize = 0;
-				char *cbuf, *cbufptr;
-
-				for (j = i; j < count; j++)
-					totvecsize += vecs[j].iov_len;
-
-				// pad up in case unaligned
-				sizetomalloc = totvecsize + sizeof(int) - 1;
-				sizetomalloc &= ~(sizeof(int) - 1);
-				cbuf = (char *) malloc(sizetomalloc);
-				// malloc returns aligned memory
-				if (!cbuf) {
-					ret = -ENOMEM;
-					goto writev_out;
-				}
-				cbufptr = cbuf;
-				for (j = i; j < count; j++) {
-					(void)memcpy_s(cbufptr, vecs[j].iov_len, vecs[j].iov_base, vecs[j].iov_len);
-					cbufptr += vecs[j].iov_len;
+		p = vecs[i].iov_base;
+		len = vecs[i].iov_len;
+
+		while (len) {
+			if (!(pend & (sizeof(int) - 1)) && len >= sizeof(int) &&
+			    !((unsigned long)p & (sizeof(unsigned long) - 1))) {
+				if (pend) {
+					ret = jffs2_writev_flush_stage(c, to + totlen, stage, &pend, &totlen);
+					if (ret)
+						goto writev_out;
 				}
-				ret = jffs2_flash_write(c, to, sizetomalloc, &thislen,
-					(unsigned char *) cbuf);
-				if (thislen > totvecsize) // in case it was aligned up
-					thislen = totvecsize;
+				n = len & ~(sizeof(int) - 1);
+				ret = jffs2_flash_direct_write(c, to + totlen, n, &thislen, p);
 				totlen += thislen;
-				free(cbuf);
-				goto writev_out;
-			} else {
-				// otherwise optimize for the common case
-				int buf[256/sizeof(int)]; // int, so int aligned
-				size_t lentowrite;
-
-				lentowrite = vecs[i].iov_len;
-				// pad up in case its unaligned
-				lentowrite += sizeof(int) - 1;
-				lentowrite &= ~(sizeof(int) - 1);
-				ret = memcpy_s(buf, sizeof(buf), vecs[i].iov_base, vecs[i].iov_len);
-				if (ret != EOK)
+				if (ret || thislen != n)
 					goto writev_out;
-
-				ret = jffs2_flash_write(c, to, lentowrite, &thislen,
-					(unsigned char *) &buf[0]);
-				if (thislen > vecs[i].iov_len)
-					thislen = vecs[i].iov_len;
+			} else {
+				n = min_t(size_t, len, WRITEV_STAGE_SIZE - pend);
+				(void)memcpy_s((unsigned char *)stage + pend, WRITEV_STAGE_SIZE - pend, p, n);
+				pend += n;
+				if (pend == WRITEV_STAGE_SIZE) {
+					ret = jffs2_writev_flush_stage(c, to + totlen, stage, &pend, &totlen);
+					if (ret)
+						goto writev_out;
+				}
 			}
-		} else {
-				ret = jffs2_flash_write(c, to, vecs[i].iov_len, &thislen,
-					vecs[i].iov_base);
+			p += n;
+			len -= n;
 		}
-		totlen += thislen;
-		if (ret || thislen != vecs[i].iov_len) break;
-		to += vecs[i].iov_len;
 	}
+	if (pend)
+		ret = jffs2_writev_flush_stage(c, to + totlen, stage, &pend, &totlen);
 
 writev_out:
 	if (retlen) *retlen = totlen;
@@ -104,3 +113,280 @@ int jffs2_flash_direct_write(struct jffs2_sb_info *c, loff_t ofs, size_t len,
 	*retlen = 0;
 	return ret;
 }
+
+#ifdef CONFIG_JFFS2_FS_NOR_WCBUF
+
+/*
+ * NOR write-combining buffer.
+ *
+ * Nodes are written out sequentially through c->nextblock, and many of
+ * them are much smaller than a program page. Rather than issuing a flash
+ * program operation for each, we gather writes up in c->wcbuf and program
+ * a page at a time. Node writes of a page or more gain nothing from this
+ * and go straight to jffs2_flash_direct_writev(). The buffer is flushed
+ * when it fills a page, when a write lands anywhere other than at or just
+ * after its end (which is also what happens when we move on to a new
+ * eraseblock), before an erase, on fsync and umount, and by the GC thread
+ * once the data has been sitting for JFFS2_WCBUF_TIMEOUT_MS.
+ *
+ * Since a non-contiguous write always flushes first, data reaches the
+ * flash in exactly the order it was written. In particular the new copy
+ * of a node is on the medium before the old one is marked obsolete.
+ * Space accounting and summary collection don't care when the bytes are
+ * actually programmed, so neither is affected.
+ *
+ * Reads overlay whatever is still in the buffer, so callers never see
+ * the difference. If programming the buffer fails, the error goes back to
+ * whoever caused the flush, and the nodes in it are written off. Their
+ * inodes are flagged so that the next fsync() of each reports -EIO.
+ *
+ * The buffer is one program page of the device, as its driver gave it
+ * to jffs2_set_mtd_writesize(). If it can't be had, writes go straight
+ * to the flash.
+ *
+ * All of this is under c->wcbuf_sem, which is innermost apart from
+ * erase_completion_lock.
+ */
+
+#define WCBUF_PAGE(c, ofs) ((uint32_t)(ofs) & ~((c)->wcbuf_size - 1))
+
+/*
+ * The buffer couldn't be programmed, so the nodes in it never got to the
+ * flash, or not all of them did. They were counted as used when they went
+ * into the buffer, and whoever wrote them has long since been told that
+ * it worked. Write them off as dirty space, just as jffs2_write_nodes()
+ * does with a write which fails there and then; there's no point trying
+ * to mark them obsolete on the flash when programming is what failed.
+ * Reading them will fail the CRC check from now on, and the next mount
+ * won't find them at all, so flag their inodes for fsync() to own up.
+ */
+static void jffs2_wcbuf_write_off(struct jffs2_sb_info *c, uint32_t ofs, uint32_t len)
+{
+	struct jffs2_eraseblock *jeb = &c->blocks[ofs / c->sector_size];
+	struct jffs2_raw_node_ref *ref;
+	struct jffs2_inode_cache *ic;
+	uint32_t start, totlen;
+
+	spin_lock(&c->erase_completion_lock);
+	for (ref = jeb->first_node; ref && ref_offset(ref) < ofs + len; ref = ref_next(ref)) {
+		start = ref_offset(ref);
+		totlen = ref_totlen(c, jeb, ref);
+		if (ref_obsolete(ref) || start + totlen <= ofs)
+			continue;
+
+		if (ref_flags(ref) == REF_UNCHECKED) {
+			jeb->unchecked_size -= totlen;
+			c->unchecked_size -= totlen;
+		} else {
+			jeb->used_size -= totlen;
+			c->used_size -= totlen;
+		}
+		jeb->dirty_size += totlen;
+		c->dirty_size += totlen;
+		ref->flash_offset = start | REF_OBSOLETE;
+		c->wcbuf_lost++;
+
+		if (!ref->next_in_ino)
+			continue;
+		ic = jffs2_raw_ref_to_ic(ref);
+		if (ic->class == RAWNODE_CLASS_INODE_CACHE) {
+			spin_lock(&c->inocache_lock);
+			ic->flags |= INO_FLAGS_WRITE_ERR;
+			spin_unlock(&c->inocache_lock);
+		}
+	}
+	spin_unlock(&c->erase_completion_lock);
+}
+
+static int __jffs2_flush_wcbuf(struct jffs2_sb_info *c)
+{
+	unsigned char *wbuf = (unsigned char *)c->wcbuf;
+	size_t len, retlen;
+	int ret;
+
+	if (!c->wcbuf_len)
+		return 0;
+
+	/* Pad out to a word with 0xFF, which programs nothing */
+	len = PAD(c->wcbuf_len);
+	(void)memset_s(wbuf + c->wcbuf_len, c->wcbuf_size - c->wcbuf_len,
+		       0xFF, len - c->wcbuf_len);
+
+	ret = jffs2_flash_direct_write(c, c->wcbuf_ofs, len, &retlen, wbuf);
+	if (!ret && retlen < c->wcbuf_len)
+		ret = -EIO;
+	if (ret) {
+		pr_warn("Write-combining buffer flush at 0x%08x failed: %d\n",
+			c->wcbuf_ofs, ret);
+		jffs2_wcbuf_write_off(c, c->wcbuf_ofs, c->wcbuf_len);
+	}
+
+	c->wcbuf_programs++;
+	c->wcbuf_len = 0;
+	return ret;
+}
+
+static int jffs2_wcbuf_write(struct jffs2_sb_info *c, uint32_t ofs,
+			     uint32_t len, const unsigned char *buf)
+{
+	unsigned char *wbuf = (unsigned char *)c->wcbuf;
+	uint32_t end, n;
+	size_t retlen;
+	int ret;
+
+	while (len) {
+		end = c->wcbuf_ofs + c->wcbuf_len;
+		if (c->wcbuf_len && (ofs < end || WCBUF_PAGE(c, ofs) != WCBUF_PAGE(c, c->wcbuf_ofs))) {
+			ret = __jffs2_flush_wcbuf(c);
+			if (ret)
+				return ret;
+		}
+
+		if (!c->wcbuf_len) {
+			if ((ofs & 3) || (!(ofs & (c->wcbuf_size - 1)) && len >= c->wcbuf_size &&
+			    !((unsigned long)buf & (sizeof(int) - 1)))) {
+				/* Unaligned, or whole pages which can go out
+				   as they are */
+				n = (ofs & 3) ? len : (len & ~(c->wcbuf_size - 1));
+				ret = jffs2_flash_direct_write(c, ofs, n, &retlen, buf);
+				if (!ret && retlen != n)
+					ret = -EIO;
+				if (ret)
+					return ret;
+				ofs += n;
+				buf += n;
+				len -= n;
+				continue;
+			}
+			c->wcbuf_ofs = ofs;
+			c->wcbuf_stamp = jffs2_now_ns();
+		} else if (ofs > end) {
+			/* Padding between nodes, which is never written */
+			(void)memset_s(wbuf + c->wcbuf_len, c->wcbuf_size - c->wcbuf_len,
+				       0xFF, ofs - end);
+			c->wcbuf_len += ofs - end;
+		}
+
+		n = min_t(uint32_t, len, c->wcbuf_size - (ofs & (c->wcbuf_size - 1)));
+		(void)memcpy_s(wbuf + c->wcbuf_len, c->wcbuf_size - c->wcbuf_len, buf, n);
+		c->wcbuf_len += n;
+		ofs += n;
+		buf += n;
+		len -= n;
+
+		/* Filled the page */
+		if (!(ofs & (c->wcbuf_size - 1))) {
+			ret = __jffs2_flush_wcbuf(c);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+int jffs2_flash_write(struct jffs2_sb_info *c, loff_t ofs, size_t len,
+		      size_t *retlen, const u_char *buf)
+{
+	int ret;
+
+	if (!c->wcbuf)
+		return jffs2_flash_direct_write(c, ofs, len, retlen, buf);
+
+	mutex_lock(&c->wcbuf_sem);
+	c->wcbuf_writes++;
+	ret = jffs2_wcbuf_write(c, ofs, len, buf);
+	mutex_unlock(&c->wcbuf_sem);
+
+	*retlen = ret ? 0 : len;
+	return ret;
+}
+
+int jffs2_flash_writev(struct jffs2_sb_info *c, const struct kvec *vecs,
+		       unsigned long count, loff_t to, size_t *retlen, uint32_t ino)
+{
+	size_t totlen = 0;
+	unsigned long i;
+	int ret = 0;
+
+	for (i = 0; i < count; i++)
+		totlen += vecs[i].iov_len;
+
+	if (jffs2_sum_active()) {
+		ret = jffs2_sum_add_kvec(c, vecs, count, (uint32_t)to);
+		if (ret)
+			return ret;
+	}
+
+	mutex_lock(&c->wcbuf_sem);
+	if (!c->wcbuf || totlen >= c->wcbuf_size) {
+		/* Nothing to gain from combining; write it in place */
+		ret = __jffs2_flush_wcbuf(c);
+		if (!ret)
+			ret = jffs2_flash_direct_writev(c, vecs, count, to, retlen);
+		else if (retlen)
+			*retlen = 0;
+		mutex_unlock(&c->wcbuf_sem);
+		return ret;
+	}
+
+	c->wcbuf_writes++;
+	totlen = 0;
+	for (i = 0; i < count; i++) {
+		ret = jffs2_wcbuf_write(c, to + totlen, vecs[i].iov_len, vecs[i].iov_base);
+		if (ret)
+			break;
+		totlen += vecs[i].iov_len;
+	}
+	mutex_unlock(&c->wcbuf_sem);
+
+	if (retlen)
+		*retlen = totlen;
+	return ret;
+}
+
+int jffs2_flash_read(struct jffs2_sb_info *c, loff_t ofs, size_t len,
+		     size_t *retlen, char *buf)
+{
+	uint32_t start, end;
+	int ret;
+
+	mutex_lock(&c->wcbuf_sem);
+	start = max_t(uint32_t, ofs, c->wcbuf_ofs);
+	end = min_t(uint32_t, ofs + len, c->wcbuf_ofs + c->wcbuf_len);
+	if (!c->wcbuf_len || start >= end) {
+		mutex_unlock(&c->wcbuf_sem);
+		return jffs2_flash_direct_read(c, ofs, len, retlen, buf);
+	}
+
+	/* Some of it hasn't been programmed yet */
+	ret = jffs2_flash_direct_read(c, ofs, len, retlen, buf);
+	if (!ret)
+		(void)memcpy_s(buf + (start - ofs), len - (start - ofs),
+			       (unsigned char *)c->wcbuf + (start - c->wcbuf_ofs), end - start);
+	mutex_unlock(&c->wcbuf_sem);
+	return ret;
+}
+
+int jffs2_flush_wcbuf(struct jffs2_sb_info *c)
+{
+	int ret;
+
+	mutex_lock(&c->wcbuf_sem);
+	ret = __jffs2_flush_wcbuf(c);
+	mutex_unlock(&c->wcbuf_sem);
+	return ret;
+}
+
+int jffs2_flush_wcbuf_stale(struct jffs2_sb_info *c)
+{
+	int ret = 0;
+
+	mutex_lock(&c->wcbuf_sem);
+	if (c->wcbuf_len &&
+	    jffs2_now_ns() - c->wcbuf_stamp >= (uint64_t)JFFS2_WCBUF_TIMEOUT_MS * 1000000)
+		ret = __jffs2_flush_wcbuf(c);
+	mutex_unlock(&c->wcbuf_sem);
+	return ret;
+}
+
+#endif /* CONFIG_JFFS2_FS_NOR_WCBUF */
@@ -0,0 +1,656 @@
+#!/usr/bin/env python3
+
+"""Analyse a dump of a JFFS2 partition: how full and how dirty each
+eraseblock is, how fragmented each inode is, how well its data compressed,
+and what the garbage collector will have to move to get blocks back.
+
+The image is scanned node by node as jffs2_scan_eraseblock() does, then
+each inode is put together as readinode.c would, to find the nodes which
+newer ones have made obsolete but which are still taking up flash. Blocks
+are then filed onto the lists jffs2_scan_medium() would put them on, and
+jffs2_find_gc_block() is run against those lists to forecast the cost of
+reclaiming blocks."""
+
+# Licensed under the terms of the GNU GPL License version 2
+
+import bisect
+import json
+import random
+import struct
+import sys
+import zlib
+from optparse import OptionParser
+
+
+JFFS2_MAGIC_BITMASK = 0x1985
+JFFS2_SUM_MAGIC = 0x02851885
+JFFS2_NODE_ACCURATE = 0x2000
+JFFS2_COMPAT_MASK = 0xc000
+JFFS2_FEATURE_ROCOMPAT = 0x8000
+JFFS2_FEATURE_RWCOMPAT_COPY = 0x4000
+
+JFFS2_NODETYPE_DIRENT = 0xe001
+JFFS2_NODETYPE_INODE = 0xe002
+JFFS2_NODETYPE_CLEANMARKER = 0x2003
+JFFS2_NODETYPE_PADDING = 0x2004
+JFFS2_NODETYPE_SUMMARY = 0x2006
+
+RAW_INODE_SIZE = 68
+RAW_DIRENT_SIZE = 40
+CLEANMARKER_SIZE = 12
+JFFS2_MIN_DATA_LEN = 128
+
+COMPR_NAMES = {0: "none", 1: "zero", 2: "rtime", 3: "rubinmips", 4: "copy",
+               5: "dynrubin", 6: "zlib", 7: "lzo"}
+
+FILE_TYPES = {0o040000: "dir", 0o100000: "file", 0o120000: "symlink",
+              0o020000: "chr", 0o060000: "blk", 0o010000: "fifo", 0o140000: "sock"}
+
+
+def PAD(x):
+    return (x + 3) & ~3
+
+
+def crc32(data):
+    # fs/jffs2's crc32(0, ...): no inversion before or after
+    return ~zlib.crc32(data, 0xffffffff) & 0xffffffff
+
+
+class Node(object):
+    __slots__ = ("ofs", "block", "type", "totlen", "ino", "version", "pino", "name",
+                 "mode", "isize", "offset", "csize", "dsize", "compr", "live", "valid")
+
+    def __init__(self, ofs, block, ntype, totlen):
+        self.ofs = ofs
+        self.block = block
+        self.type = ntype
+        self.totlen = totlen
+        self.live = True
+        # Bytes of the node's data still in use, for a data node
+        self.valid = 0
+
+
+class Block(object):
+    def __init__(self, nr, offset):
+        self.nr = nr
+        self.offset = offset
+        self.nodes = []
+        self.cleanmarker = 0
+        self.summary = 0
+        self.flash_obsolete = 0
+        self.dirty = 0
+        self.free = 0
+        self.blank = False
+        self.unknown = 0
+
+    def live_bytes(self):
+        return sum(PAD(n.totlen) for n in self.nodes if n.live)
+
+    def used(self):
+        return self.cleanmarker + self.summary + self.live_bytes()
+
+
+class Image(object):
+    def __init__(self, data, erase_size, endian, use_summary):
+        self.data = data
+        self.es = erase_size
+        self.e = endian
+        self.use_summary = use_summary
+        self.blocks = []
+        self.inodes = {}
+        self.dirents = []
+        self.errors = []
+
+    def scan(self):
+        for nr in range(len(self.data) // self.es):
+            blk = Block(nr, nr * self.es)
+            self.scan_block(blk)
+            self.blocks.append(blk)
+
+    def has_summary(self, buf):
+        sofs, magic = struct.unpack_from(self.e + "II", buf, self.es - 8)
+        if magic != JFFS2_SUM_MAGIC or sofs >= self.es - 8:
+            return None
+        return sofs
+
+    def scan_block(self, blk):
+        e = self.e
+        buf = self.data[blk.offset:blk.offset + self.es]
+        sumofs = self.has_summary(buf) if self.use_summary else None
+        if buf.count(b"\xff") == len(buf):
+            blk.blank = True
+            blk.free = self.es
+            return
+        ofs = 0
+        end = self.es
+        while ofs < end:
+            word = buf[ofs:ofs + 4]
+            if word == b"\xff\xff\xff\xff":
+                stripped = len(buf[ofs:end].rstrip(b"\xff"))
+                if not stripped:
+                    blk.free = end - ofs
+                    break
+                # Erased space in the middle of the block is dirt
+                skip = len(buf[ofs:end]) - len(buf[ofs:end].lstrip(b"\xff"))
+                skip &= ~3
+                blk.dirty += skip
+                ofs += skip
+                continue
+            if end - ofs < 12:
+                blk.dirty += end - ofs
+                break
+            magic, ntype, totlen, hdr_crc = struct.unpack_from(e + "HHII", buf, ofs)
+            if magic != JFFS2_MAGIC_BITMASK:
+                blk.dirty += 4
+                ofs += 4
+                continue
+            crc = crc32(struct.pack(e + "HHI", magic, ntype | JFFS2_NODE_ACCURATE, totlen))
+            if crc != hdr_crc or totlen < 12 or ofs + totlen > self.es:
+                blk.dirty += 4
+                ofs += 4
+                continue
+            plen = min(PAD(totlen), self.es - ofs)
+            if not ntype & JFFS2_NODE_ACCURATE:
+                blk.dirty += plen
+                blk.flash_obsolete += 1
+                ofs += plen
+                continue
+            raw = buf[ofs:ofs + totlen]
+            if ntype == JFFS2_NODETYPE_INODE:
+                if not self.inode_node(blk, raw, ofs):
+                    blk.dirty += plen
+            elif ntype == JFFS2_NODETYPE_DIRENT:
+                if not self.dirent_node(blk, raw, ofs):
+                    blk.dirty += plen
+            elif ntype == JFFS2_NODETYPE_CLEANMARKER:
+                if totlen == CLEANMARKER_SIZE and ofs == 0:
+                    blk.cleanmarker = CLEANMARKER_SIZE
+                else:
+                    blk.dirty += PAD(CLEANMARKER_SIZE)
+                    plen = PAD(CLEANMARKER_SIZE)
+            elif ntype == JFFS2_NODETYPE_SUMMARY and ofs == sumofs:
+                # Read instead of the nodes at mount, and in use until
+                # the block is erased
+                blk.summary = plen
+            elif ntype == JFFS2_NODETYPE_PADDING or \
+                 ntype & JFFS2_COMPAT_MASK in (0, JFFS2_FEATURE_ROCOMPAT):
+                blk.dirty += plen
+            elif ntype & JFFS2_COMPAT_MASK == JFFS2_FEATURE_RWCOMPAT_COPY:
+                blk.unknown += plen
+            else:
+                self.errors.append("incompatible node type 0x%04x at 0x%08x, "
+                                   "the mount would fail" % (ntype, blk.offset + ofs))
+                blk.dirty += plen
+            ofs += plen
+
+    def inode_node(self, blk, raw, ofs):
+        e = self.e
+        if len(raw) < RAW_INODE_SIZE:
+            return False
+        f = struct.unpack_from(e + "IIIHHIIIIIIIBBHII", raw, 12)
+        (ino, version, mode, uid, gid, isize, atime, mtime, ctime,
+         offset, csize, dsize, compr, usercompr, flags, data_crc, node_crc) = f
+        if node_crc != crc32(raw[:RAW_INODE_SIZE - 8]) or \
+           RAW_INODE_SIZE + csize > len(raw) or \
+           data_crc != crc32(raw[RAW_INODE_SIZE:RAW_INODE_SIZE + csize]):
+            return False
+        n = Node(ofs, blk, JFFS2_NODETYPE_INODE, len(raw))
+        n.ino, n.version, n.mode, n.isize = ino, version, mode, isize
+        n.offset, n.csize, n.dsize, n.compr = offset, csize, dsize, compr
+        blk.nodes.append(n)
+        self.inodes.setdefault(ino, []).append(n)
+        return True
+
+    def dirent_node(self, blk, raw, ofs):
+        e = self.e
+        if len(raw) < RAW_DIRENT_SIZE:
+            return False
+        pino, version, ino, mctime, nsize, dtype, node_crc, name_crc = \
+            struct.unpack_from(e + "IIIIBBxxII", raw, 12)
+        name = raw[RAW_DIRENT_SIZE:RAW_DIRENT_SIZE + nsize]
+        if node_crc != crc32(raw[:RAW_DIRENT_SIZE - 8]) or len(name) != nsize or \
+           name_crc != crc32(name):
+            return False
+        n = Node(ofs, blk, JFFS2_NODETYPE_DIRENT, len(raw))
+        n.ino, n.version, n.pino, n.name = ino, version, pino, name
+        n.mode = dtype << 12
+        blk.nodes.append(n)
+        self.dirents.append(n)
+        return True
+
+    def resolve(self):
+        """Work out which nodes are still in use, as build.c and
+        readinode.c would"""
+        # The newest dirent for each name wins, older ones are obsolete
+        names = {}
+        for d in self.dirents:
+            key = (d.pino, d.name)
+            old = names.get(key)
+            if old is None or d.version > old.version:
+                if old is not None:
+                    old.live = False
+                names[key] = d
+            else:
+                d.live = False
+
+        # Anything not reachable from the root is deleted on mount
+        children = {}
+        for d in names.values():
+            children.setdefault(d.pino, []).append(d)
+        self.parent = {1: None}
+        todo = [1]
+        while todo:
+            ino = todo.pop()
+            for d in children.get(ino, []):
+                if d.ino and d.ino not in self.parent:
+                    self.parent[d.ino] = d
+                    todo.append(d.ino)
+        for d in names.values():
+            if d.pino not in self.parent:
+                d.live = False
+        self.deletion_dirents = sum(1 for d in names.values() if d.live and not d.ino)
+
+        self.frags = {}
+        for ino, nodes in self.inodes.items():
+            if ino not in self.parent:
+                for n in nodes:
+                    n.live = False
+                continue
+            self.frags[ino] = self.build_fragtree(nodes)
+
+    def build_fragtree(self, nodes):
+        """Newer data overlays older, as jffs2_add_full_dnode_to_inode()
+        does. Returns the inode's frags as (start, end, node) in order"""
+        nodes.sort(key=lambda n: n.version)
+        latest = nodes[-1]
+        frags = []
+        starts = []
+        for n in nodes:
+            n.live = n is latest
+            if not n.dsize:
+                continue
+            start, end = n.offset, n.offset + n.dsize
+            i = max(bisect.bisect_right(starts, start) - 1, 0)
+            if i < len(frags) and frags[i][1] <= start:
+                i += 1
+            j = i
+            while j < len(frags) and frags[j][0] < end:
+                j += 1
+            new = []
+            if i < j and frags[i][0] < start:
+                new.append((frags[i][0], start, frags[i][2]))
+            new.append((start, end, n))
+            if i < j and frags[j - 1][1] > end:
+                new.append((end, frags[j - 1][1], frags[j - 1][2]))
+            frags[i:j] = new
+            starts[i:j] = [f[0] for f in new]
+        # Truncated to the newest size
+        isize = latest.isize
+        frags = [(s, min(e, isize), n) for s, e, n in frags if s < isize]
+        for s, e, n in frags:
+            n.live = True
+            n.valid += e - s
+        return frags
+
+
+class Analysis(object):
+    def __init__(self, img, opts):
+        self.img = img
+        self.opts = opts
+
+    def classify(self):
+        """File the blocks as jffs2_scan_medium() would, as they stand
+        once the mount has obsoleted what it is going to. Returns the
+        lists, each with the block jffs2_find_gc_block() takes first at
+        its head"""
+        es = self.img.es
+        lists = {"free": [], "erase_pending": [], "clean": [], "dirty": [],
+                 "very_dirty": [], "blank": []}
+        nextblock = None
+        min_free = 2 * RAW_INODE_SIZE
+        isdirty = RAW_INODE_SIZE + JFFS2_MIN_DATA_LEN
+        for blk in self.img.blocks:
+            used = blk.used() + blk.unknown
+            blk.dirty = es - used - blk.free
+            blk.wasted = 0
+            if blk.blank:
+                blk.state = "blank"
+            elif used == blk.cleanmarker and blk.cleanmarker:
+                blk.state = "free" if not blk.dirty else "erase_pending"
+            elif not es - used > isdirty:
+                blk.wasted, blk.dirty = blk.dirty, 0
+                blk.state = "clean"
+            elif used:
+                blk.state = "partdirty"
+            else:
+                blk.state = "erase_pending"
+
+            if blk.state != "partdirty":
+                lists[blk.state].insert(0, blk)
+                continue
+            if blk.free > min_free and (nextblock is None or nextblock.free < blk.free):
+                if nextblock is not None:
+                    self.file_dirty(nextblock, lists)
+                nextblock = blk
+            else:
+                self.file_dirty(blk, lists)
+        if nextblock is not None:
+            nextblock.state = "nextblock"
+            nextblock.wasted += nextblock.dirty
+            nextblock.dirty = 0
+        self.nextblock = nextblock
+        return lists
+
+    def file_dirty(self, blk, lists):
+        # The rest of the block won't be written to until it's erased
+        blk.dirty += blk.free + blk.wasted
+        blk.free = blk.wasted = 0
+        blk.state = "very_dirty" if blk.dirty >= self.img.es // 2 else "dirty"
+        lists[blk.state].insert(0, blk)
+
+    def move_cost(self, blk):
+        """Bytes GC writes elsewhere to empty blk. Whole nodes are copied,
+        partly obsolete data nodes are rewritten with just their live data"""
+        cost = 0
+        for n in blk.nodes:
+            if not n.live:
+                continue
+            if n.type == JFFS2_NODETYPE_INODE and n.dsize and n.valid < n.dsize:
+                cost += PAD(RAW_INODE_SIZE + (n.csize * n.valid + n.dsize - 1) // n.dsize)
+            else:
+                cost += PAD(n.totlen)
+        return cost + blk.unknown
+
+    def forecast(self, lists, nr):
+        """Run jffs2_find_gc_block() nr times, with jiffies taken as
+        random, to see what reclaiming nr blocks costs"""
+        es = self.img.es
+        rng = random.Random(self.opts.seed)
+        runs = []
+        for t in range(self.opts.trials):
+            very_dirty = list(lists["very_dirty"])
+            dirty = list(lists["dirty"])
+            clean = list(lists["clean"])
+            moved = 0
+            picked = 0
+            for i in range(nr):
+                n = rng.randrange(128)
+                if n < 110 and very_dirty:
+                    blk = very_dirty.pop(0)
+                elif n < 126 and dirty:
+                    blk = dirty.pop(0)
+                elif clean:
+                    blk = clean.pop(0)
+                elif dirty:
+                    blk = dirty.pop(0)
+                elif very_dirty:
+                    blk = very_dirty.pop(0)
+                else:
+                    break
+                moved += self.move_cost(blk)
+                picked += 1
+            runs.append((moved, picked))
+
+        moved = sorted(r[0] for r in runs)
+        picked = min(r[1] for r in runs)
+        mean = sum(moved) / float(len(moved))
+        reclaimed = picked * es - mean
+        # What it would cost to reclaim the same blocks picking the
+        # cheapest every time
+        cands = lists["very_dirty"] + lists["dirty"] + lists["clean"]
+        best = sum(sorted(self.move_cost(b) for b in cands)[:picked])
+        return {
+            "blocks": nr,
+            "blocks_reclaimable": picked,
+            "erase_pending_blocks": len(lists["erase_pending"]),
+            "trials": self.opts.trials,
+            "moved_bytes_mean": int(mean),
+            "moved_bytes_p50": moved[len(moved) // 2],
+            "moved_bytes_p95": moved[min(len(moved) - 1, len(moved) * 95 // 100)],
+            "moved_bytes_max": moved[-1],
+            "moved_bytes_cheapest": best,
+            "reclaimed_bytes_mean": int(reclaimed),
+            "write_amplification": round(mean / reclaimed, 3) if reclaimed > 0 else None,
+        }
+
+    def path(self, ino):
+        parts = []
+        seen = set()
+        while ino != 1 and ino not in seen:
+            seen.add(ino)
+            d = self.img.parent.get(ino)
+            if d is None:
+                return None
+            parts.append(d.name.decode("utf-8", "replace"))
+            ino = d.pino
+        return "/" + "/".join(reversed(parts))
+
+    def run(self):
+        img = self.img
+        img.scan()
+        img.resolve()
+        lists = self.classify()
+        es = img.es
+
+        blocks = []
+        for blk in img.blocks:
+            nodes = len(blk.nodes)
+            dead = sum(1 for n in blk.nodes if not n.live)
+            blocks.append({
+                "block": blk.nr,
+                "offset": blk.offset,
+                "state": blk.state,
+                "used": blk.used() + blk.unknown,
+                "dirty": blk.dirty,
+                "wasted": blk.wasted,
+                "free": blk.free,
+                "nodes": nodes + blk.flash_obsolete,
+                "obsolete_nodes": dead + blk.flash_obsolete,
+                "summary": bool(blk.summary),
+                "gc_move_bytes": self.move_cost(blk),
+            })
+
+        inodes = []
+        compr = {}
+        for ino, nodes in sorted(img.inodes.items()):
+            latest = max(nodes, key=lambda n: n.version)
+            live = [n for n in nodes if n.live]
+            for n in nodes:
+                if not n.dsize:
+                    continue
+                c = compr.setdefault(COMPR_NAMES.get(n.compr, str(n.compr)),
+                                     {"nodes": 0, "dsize": 0, "csize": 0,
+                                      "live_nodes": 0, "live_dsize": 0, "live_csize": 0})
+                c["nodes"] += 1
+                c["dsize"] += n.dsize
+                c["csize"] += n.csize
+                if n.live:
+                    c["live_nodes"] += 1
+                    c["live_dsize"] += n.dsize
+                    c["live_csize"] += n.csize
+            frags = img.frags.get(ino, [])
+            holes = 0
+            pos = 0
+            for s, e, n in frags:
+                if s > pos:
+                    holes += 1
+                pos = e
+            inodes.append({
+                "ino": ino,
+                "path": self.path(ino),
+                "type": FILE_TYPES.get(latest.mode & 0o170000, "unknown"),
+                "isize": latest.isize,
+                "nodes": len(nodes),
+                "obsolete_nodes": len(nodes) - len(live),
+                "frags": len(frags),
+                "holes": holes,
+                "flash_bytes": sum(PAD(n.totlen) for n in nodes),
+                "live_bytes": sum(PAD(n.totlen) for n in live),
+            })
+        for c in compr.values():
+            c["ratio"] = round(c["csize"] / float(c["dsize"]), 4) if c["dsize"] else None
+
+        total_nodes = sum(b["nodes"] for b in blocks)
+        obsolete_nodes = sum(b["obsolete_nodes"] for b in blocks)
+        hist = [0] * 10
+        for b in blocks:
+            if b["state"] in ("blank", "free"):
+                continue
+            hist[min(9, (b["dirty"] + b["wasted"]) * 10 // es)] += 1
+
+        self.report = {
+            "image": {
+                "size": len(img.data),
+                "erase_size": es,
+                "endian": "little" if img.e == "<" else "big",
+                "blocks": len(img.blocks),
+                "used": sum(b["used"] for b in blocks),
+                "dirty": sum(b["dirty"] for b in blocks),
+                "wasted": sum(b["wasted"] for b in blocks),
+                "free": sum(b["free"] for b in blocks),
+                "nodes": total_nodes,
+                "obsolete_nodes": obsolete_nodes,
+                "obsolete_density": round(obsolete_nodes / float(total_nodes), 4)
+                if total_nodes else 0,
+                "deletion_dirents": img.deletion_dirents,
+                "blocks_with_summary": sum(1 for b in blocks if b["summary"]),
+                "nextblock": self.nextblock.nr if self.nextblock else None,
+                "lists": dict((k, len(v)) for k, v in lists.items()),
+                "dirty_histogram": hist,
+                "errors": img.errors,
+            },
+            "blocks": blocks,
+            "inodes": inodes,
+            "compression": compr,
+            "gc_forecast": self.forecast(lists, self.opts.gc_blocks),
+        }
+        return self.report
+
+
+def print_report(r, opts):
+    im = r["image"]
+    kib = lambda x: "%d KiB" % (x // 1024)
+    print("%s image, %d eraseblocks of %s, %s endian" %
+          (kib(im["size"]), im["blocks"], kib(im["erase_size"]), im["endian"]))
+    for e in im["errors"]:
+        print("error: %s" % e)
+    print("used %s, dirty %s, wasted %s, free %s" %
+          (kib(im["used"]), kib(im["dirty"]), kib(im["wasted"]), kib(im["free"])))
+    print("%d nodes, %d obsolete (%.1f%%), %d deletion dirents" %
+          (im["nodes"], im["obsolete_nodes"], 100 * im["obsolete_density"],
+           im["deletion_dirents"]))
+    print("%d of %d blocks have a summary" % (im["blocks_with_summary"], im["blocks"]))
+    print("lists: " + ", ".join("%s %d" % (k, v) for k, v in sorted(im["lists"].items())) +
+          (", nextblock %d" % im["nextblock"] if im["nextblock"] is not None else ""))
+    print("blocks by dirty+wasted share: " +
+          " ".join("%d0%%:%d" % (i, n) for i, n in enumerate(im["dirty_histogram"]) if n))
+
+    if opts.verbose:
+        print("\nblock  offset      state          used    dirty   wasted     free  nodes  obs  gc-move")
+        for b in r["blocks"]:
+            print("%5d  0x%08x  %-12s %7d  %7d  %7d  %7d  %5d  %3d  %7d%s" %
+                  (b["block"], b["offset"], b["state"], b["used"], b["dirty"], b["wasted"],
+                   b["free"], b["nodes"], b["obsolete_nodes"], b["gc_move_bytes"],
+                   "  S" if b["summary"] else ""))
+
+    if r["compression"]:
+        print("\ncompressor     nodes     data    flash  ratio   (live: nodes  ratio)")
+        for name, c in sorted(r["compression"].items()):
+            lr = c["live_csize"] / float(c["live_dsize"]) if c["live_dsize"] else 0
+            print("%-10s  %8d  %7s  %7s  %5.1f%%         %6d  %5.1f%%" %
+                  (name, c["nodes"], kib(c["dsize"]), kib(c["csize"]), 100 * c["ratio"],
+                   c["live_nodes"], 100 * lr))
+
+    worst = sorted(r["inodes"], key=lambda i: (-i["obsolete_nodes"], -i["frags"], i["ino"]))
+    worst = [i for i in worst if i["obsolete_nodes"] or i["frags"] > 1][:opts.top]
+    if worst:
+        print("\n   ino  nodes  obsolete  frags  holes    flash     live  path")
+        for i in worst:
+            print("%6d  %5d  %8d  %5d  %5d  %7d  %7d  %s" %
+                  (i["ino"], i["nodes"], i["obsolete_nodes"], i["frags"], i["holes"],
+                   i["flash_bytes"], i["live_bytes"], i["path"] or "(deleted)"))
+
+    g = r["gc_forecast"]
+    print("\nGC to reclaim %d blocks (%d possible, %d more waiting for erase):" %
+          (g["blocks"], g["blocks_reclaimable"], g["erase_pending_blocks"]))
+    print("  moves %s on average, %s at p95, %s at worst; %s picking the cheapest" %
+          (kib(g["moved_bytes_mean"]), kib(g["moved_bytes_p95"]), kib(g["moved_bytes_max"]),
+           kib(g["moved_bytes_cheapest"])))
+    if g["write_amplification"] is not None:
+        print("  reclaims %s, %.2f bytes moved per byte reclaimed" %
+              (kib(g["reclaimed_bytes_mean"]), g["write_amplification"]))
+
+
+def parse_size(s):
+    mult = {"k": 1024, "m": 1024 * 1024}
+    s = s.strip().lower()
+    if s and s[-1] in mult:
+        return int(s[:-1], 0) * mult[s[-1]]
+    return int(s, 0)
+
+
+def guess_endian(data):
+    for i in range(0, len(data) - 1, 4):
+        if data[i:i + 2] == b"\x85\x19":
+            return "<"
+        if data[i:i + 2] == b"\x19\x85":
+            return ">"
+    return "<"
+
+
+def parse_options():
+    usage = "%prog [options] IMAGE"
+    parser = OptionParser(usage=usage, description=__doc__)
+    parser.add_option("-e", "--eraseblock", dest="erase_size", default="64k",
+                      help="Eraseblock size [64k]")
+    parser.add_option("-l", "--little-endian", dest="endian", action="store_const",
+                      const="<", help="Little-endian image [guessed]")
+    parser.add_option("-b", "--big-endian", dest="endian", action="store_const",
+                      const=">", help="Big-endian image [guessed]")
+    parser.add_option("-S", "--no-summary", dest="summary", action="store_false",
+                      default=True, help="Model a mount without summary support")
+    parser.add_option("-n", "--gc-blocks", dest="gc_blocks", type="int", default=8,
+                      help="Forecast the cost of reclaiming this many blocks [8]")
+    parser.add_option("--trials", dest="trials", type="int", default=1000,
+                      help="Runs of the GC block picker to average over [1000]")
+    parser.add_option("--seed", dest="seed", type="int", default=0,
+                      help="Seed for the GC block picker's jiffies [0]")
+    parser.add_option("-t", "--top", dest="top", type="int", default=10,
+                      help="Show this many of the most fragmented inodes [10]")
+    parser.add_option("-v", "--verbose", dest="verbose", action="store_true",
+                      default=False, help="Show every eraseblock")
+    parser.add_option("-j", "--json", dest="json", default=None,
+                      help="Write the full report as JSON to this file, - for stdout")
+    (opts, args) = parser.parse_args()
+    if len(args) != 1:
+        parser.error("need exactly one image")
+    opts.erase_size = parse_size(opts.erase_size)
+    if opts.erase_size < 4096 or opts.erase_size & 3:
+        parser.error("eraseblock size too small or unaligned")
+    if opts.trials < 1 or opts.gc_blocks < 1:
+        parser.error("need at least one trial and one block")
+    return opts, args[0]
+
+
+def main():
+    opts, path = parse_options()
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) % opts.erase_size:
+        sys.stderr.write("%s: not a whole number of eraseblocks, ignoring the last %d bytes\n"
+                         % (path, len(data) % opts.erase_size))
+    endian = opts.endian or guess_endian(data)
+    report = Analysis(Image(data, opts.erase_size, endian, opts.summary), opts).run()
+    if opts.json == "-":
+        json.dump(report, sys.stdout, indent=1, sort_keys=True)
+        sys.stdout.write("\n")
+        return
+    if opts.json:
+        with open(opts.json, "w") as f:
+            json.dump(report, f, indent=1, sort_keys=True)
+            f.write("\n")
+    print_report(report, opts)
+
+
+if __name__ == "__main__":
+    main()
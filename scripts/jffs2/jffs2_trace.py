@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+
+"""Decode a JFFS2 event trace, as copied out by jffs2_get_trace(), into a
+timeline.
+
+The layout is struct jffs2_trace_hdr followed by struct jffs2_trace_ent
+slots, both in fs/jffs2/jffs2_fs_sb.h, in the target's byte order."""
+
+# Licensed under the terms of the GNU GPL License version 2
+
+import struct
+import sys
+from optparse import OptionParser
+
+
+TRACE_MAGIC = 0x4a325452
+TRACE_VERSION = 1
+
+HDR = "IHHII"
+ENT = "QIHHII"
+
+# JFFS2_TR_*: name, and what its two arguments are
+EVENTS = {
+    1: ("gc_block", "block", "dirty"),
+    2: ("gc_node", "node", "ino"),
+    3: ("erase", "block", "us"),
+    4: ("erase_fail", "block", "errno"),
+    5: ("nextblock", "block", "free_blocks"),
+    6: ("obsolete", "node", "len"),
+    7: ("reserve", "bytes", "us"),
+}
+
+# Arguments which are flash offsets, shown in hex
+OFFSETS = ("block", "node")
+
+
+def parse_options():
+    usage = "%prog [options] TRACEFILE"
+    parser = OptionParser(usage=usage, description=__doc__)
+    parser.add_option("-s", "--summary", dest="summary", action="store_true",
+                      default=False,
+                      help="Print event counts per task instead of the timeline")
+    parser.add_option("-e", "--event", dest="events", action="append",
+                      default=[],
+                      help="Only show this event (may be given more than once)")
+    parser.add_option("-g", "--gap", dest="gap", type="float", default=0,
+                      help="Mark gaps of more than this many ms between events")
+    (opts, args) = parser.parse_args()
+    if len(args) != 1:
+        parser.error("need exactly one trace file")
+    for name in opts.events:
+        if name not in [e[0] for e in EVENTS.values()]:
+            parser.error("unknown event '%s'" % name)
+    return opts, args[0]
+
+
+def read_trace(path):
+    """Return the events in the trace, oldest first, as tuples of
+    (seq, ns, task, event, a, b)."""
+    with open(path, "rb") as f:
+        data = f.read()
+
+    hdrsize = struct.calcsize("<" + HDR)
+    if len(data) < hdrsize:
+        sys.exit("%s: too short for a trace header" % path)
+    for order in ("<", ">"):
+        magic, version, entsize, nr, seq = struct.unpack_from(order + HDR, data)
+        if magic == TRACE_MAGIC:
+            break
+    else:
+        sys.exit("%s: not a jffs2 trace (bad magic)" % path)
+    if version != TRACE_VERSION:
+        sys.exit("%s: trace version %d, expected %d" % (path, version, TRACE_VERSION))
+    if entsize < struct.calcsize(order + ENT):
+        sys.exit("%s: entries of %d bytes are too small" % (path, entsize))
+    if len(data) < hdrsize + nr * entsize:
+        sys.exit("%s: truncated, %d entries expected" % (path, nr))
+
+    # Anything older than the last nr events has been overwritten, and a
+    # slot which doesn't hold the event its seq says was being written
+    events = []
+    oldest = seq - nr + 1 if seq > nr else 1
+    for i in range(nr):
+        ns, eseq, event, task, a, b = struct.unpack_from(order + ENT, data,
+                                                         hdrsize + i * entsize)
+        if oldest <= eseq <= seq and (eseq - 1) % nr == i:
+            events.append((eseq, ns, task, event, a, b))
+    events.sort()
+    return events, seq
+
+
+def fmt_arg(name, val):
+    if name in OFFSETS:
+        return "%s=0x%08x" % (name, val)
+    return "%s=%u" % (name, val)
+
+
+def timeline(events, opts):
+    if not events:
+        return
+    start = events[0][1]
+    last = start
+    for seq, ns, task, event, a, b in events:
+        name, aname, bname = EVENTS.get(event, ("event%d" % event, "a", "b"))
+        if opts.events and name not in opts.events:
+            continue
+        if opts.gap and (ns - last) / 1e6 > opts.gap:
+            print("%14s  --- %.3f ms idle ---" % ("", (ns - last) / 1e6))
+        last = ns
+        print("%14.6f  task %-4u %-11s %s %s" % ((ns - start) / 1e6, task, name,
+                                                 fmt_arg(aname, a), fmt_arg(bname, b)))
+
+
+def summary(events):
+    counts = {}
+    tasks = set()
+    for seq, ns, task, event, a, b in events:
+        name = EVENTS.get(event, ("event%d" % event,))[0]
+        counts[(task, name)] = counts.get((task, name), 0) + 1
+        tasks.add(task)
+    if events:
+        span = (events[-1][1] - events[0][1]) / 1e6
+        print("%d events over %.3f ms" % (len(events), span))
+    for task in sorted(tasks):
+        print("task %u:" % task)
+        for (t, name), n in sorted(counts.items()):
+            if t == task:
+                print("  %-11s %u" % (name, n))
+
+
+def main():
+    opts, path = parse_options()
+    events, seq = read_trace(path)
+    if seq > len(events):
+        print("# %d events logged, %d still in the ring" % (seq, len(events)))
+    if opts.summary:
+        summary(events)
+    else:
+        timeline(events, opts)
+
+
+if __name__ == "__main__":
+    main()
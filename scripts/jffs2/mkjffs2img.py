@@ -0,0 +1,434 @@
+#!/usr/bin/env python3
+
+"""Build a JFFS2 image of a directory, with a cleanmarker and a summary
+in every eraseblock, so that the first mount need not scan it node by
+node.
+
+File data is compressed in parallel, a page at a time as fs/jffs2 writes
+it, with the compressors (zlib at level 3, as compr_zlib.c, and rtime, as
+compr_rtime.c) tried in turn and the smallest result kept. Nodes are
+packed into eraseblocks in directory order, each block ending with a
+summary node as jffs2_sum_write_sumnode() writes it. The output depends
+only on the input tree and the options."""
+
+# Licensed under the terms of the GNU GPL License version 2
+
+import os
+import stat
+import struct
+import sys
+import zlib
+from multiprocessing import Pool
+from optparse import OptionParser
+
+
+PAGE_SIZE = 4096
+
+JFFS2_MAGIC_BITMASK = 0x1985
+JFFS2_SUM_MAGIC = 0x02851885
+JFFS2_NODETYPE_DIRENT = 0xe001
+JFFS2_NODETYPE_INODE = 0xe002
+JFFS2_NODETYPE_CLEANMARKER = 0x2003
+JFFS2_NODETYPE_SUMMARY = 0x2006
+
+JFFS2_COMPR_NONE = 0x00
+JFFS2_COMPR_RTIME = 0x02
+JFFS2_COMPR_ZLIB = 0x06
+
+RAW_INODE_SIZE = 68
+RAW_DIRENT_SIZE = 40
+CLEANMARKER_SIZE = 12
+RAW_SUMMARY_SIZE = 32
+SUM_MARKER_SIZE = 8
+SUM_INODE_SIZE = 18
+SUM_DIRENT_SIZE = 24
+
+COMPRESSORS = ("zlib", "rtime")
+
+
+def PAD(x):
+    return (x + 3) & ~3
+
+
+def crc32(data):
+    # fs/jffs2's crc32(0, ...): no inversion before or after
+    return ~zlib.crc32(data, 0xffffffff) & 0xffffffff
+
+
+def rtime_compress(data):
+    """compr_rtime.c's compressor. None if it doesn't make it smaller."""
+    positions = [0] * 256
+    out = bytearray()
+    pos = 0
+    n = len(data)
+    while pos < n and len(out) <= n - 2:
+        value = data[pos]
+        out.append(value)
+        pos += 1
+        backpos = positions[value]
+        positions[value] = pos
+        runlen = 0
+        while backpos < pos and pos < n and data[pos] == data[backpos] and runlen < 255:
+            pos += 1
+            backpos += 1
+            runlen += 1
+        out.append(runlen)
+    if len(out) >= pos or pos < n:
+        return None
+    return bytes(out)
+
+
+def zlib_compress(data):
+    # compr_zlib.c's deflateInit() level, and a plain zlib stream
+    out = zlib.compress(data, 3)
+    if len(out) >= len(data):
+        return None
+    return out
+
+
+def compress_page(job):
+    """Read and compress one page of a file. Runs in the worker pool."""
+    path, offset, length, comprs = job
+    with open(path, "rb") as f:
+        f.seek(offset)
+        data = f.read(length)
+    if len(data) != length:
+        raise IOError("%s changed while we were reading it" % path)
+    best = (JFFS2_COMPR_NONE, data)
+    for name in comprs:
+        if name == "zlib":
+            out, compr = zlib_compress(data), JFFS2_COMPR_ZLIB
+        else:
+            out, compr = rtime_compress(data), JFFS2_COMPR_RTIME
+        if out is not None and len(out) < len(best[1]):
+            best = (compr, out)
+    return best
+
+
+class Node(object):
+    """A node to go on the flash, and its summary entry"""
+
+    def __init__(self, raw, sum_fmt, sum_args, sum_tail=b""):
+        self.raw = raw
+        self.sum_fmt = sum_fmt
+        self.sum_args = sum_args
+        self.sum_tail = sum_tail
+
+    def sum_len(self):
+        return struct.calcsize("<" + self.sum_fmt) + len(self.sum_tail)
+
+    def sum_entry(self, e, ofs):
+        args = [a if a is not None else ofs for a in self.sum_args]
+        return struct.pack(e + self.sum_fmt, *args) + self.sum_tail
+
+
+class Image(object):
+    def __init__(self, opts):
+        self.e = opts.endian
+        self.erase_size = opts.erase_size
+        self.cleanmarkers = not opts.no_cleanmarkers
+        self.blocks = []
+        self.block = None
+        self.stats = {"nodes": 0, "inodes": 0, "dirents": 0,
+                      "data_in": 0, "data_out": 0}
+
+    def hdr_crc(self, nodetype, totlen):
+        return crc32(struct.pack(self.e + "HHI", JFFS2_MAGIC_BITMASK, nodetype, totlen))
+
+    def cleanmarker(self):
+        return struct.pack(self.e + "HHII", JFFS2_MAGIC_BITMASK,
+                           JFFS2_NODETYPE_CLEANMARKER, CLEANMARKER_SIZE,
+                           self.hdr_crc(JFFS2_NODETYPE_CLEANMARKER, CLEANMARKER_SIZE))
+
+    def new_block(self):
+        self.close_block()
+        self.block = {"data": bytearray(), "nodes": [], "sumlen": 0}
+        if self.cleanmarkers:
+            self.block["data"] += self.cleanmarker()
+
+    def summary_size(self, extra):
+        return RAW_SUMMARY_SIZE + self.block["sumlen"] + extra + SUM_MARKER_SIZE
+
+    def add(self, node):
+        need = PAD(len(node.raw))
+        if need + PAD(RAW_SUMMARY_SIZE + node.sum_len() + SUM_MARKER_SIZE) + \
+           (CLEANMARKER_SIZE if self.cleanmarkers else 0) > self.erase_size:
+            sys.exit("node of %d bytes won't fit in an eraseblock" % len(node.raw))
+        if self.block is None or \
+           PAD(len(self.block["data"])) + need + \
+           PAD(self.summary_size(node.sum_len())) > self.erase_size:
+            self.new_block()
+        data = self.block["data"]
+        data += b"\xff" * (PAD(len(data)) - len(data))
+        self.block["nodes"].append((node, len(data)))
+        self.block["sumlen"] += node.sum_len()
+        data += node.raw
+        self.stats["nodes"] += 1
+
+    def close_block(self):
+        """Fill the rest of the block with its summary, as
+        jffs2_sum_write_sumnode() would have."""
+        if self.block is None:
+            return
+        e = self.e
+        data = self.block["data"]
+        data += b"\xff" * (PAD(len(data)) - len(data))
+        sumofs = len(data)
+        entries = b"".join(n.sum_entry(e, ofs) for n, ofs in self.block["nodes"])
+        totlen = self.erase_size - sumofs
+        datasize = totlen - RAW_SUMMARY_SIZE
+        body = entries + b"\xff" * (datasize - len(entries) - SUM_MARKER_SIZE) + \
+            struct.pack(e + "II", sumofs, JFFS2_SUM_MAGIC)
+        head = struct.pack(e + "HHIIIII", JFFS2_MAGIC_BITMASK, JFFS2_NODETYPE_SUMMARY,
+                           totlen, self.hdr_crc(JFFS2_NODETYPE_SUMMARY, totlen),
+                           len(self.block["nodes"]),
+                           CLEANMARKER_SIZE if self.cleanmarkers else 0, 0)
+        head += struct.pack(e + "II", crc32(body), crc32(head))
+        data += head + body
+        assert len(data) == self.erase_size
+        self.blocks.append((bytes(data), sumofs, len(self.block["nodes"])))
+        self.block = None
+
+    def inode_node(self, ino, version, st, isize, offset=0, dsize=0,
+                   compr=JFFS2_COMPR_NONE, cdata=b""):
+        e = self.e
+        totlen = RAW_INODE_SIZE + len(cdata)
+        raw = struct.pack(e + "HHII", JFFS2_MAGIC_BITMASK, JFFS2_NODETYPE_INODE, totlen,
+                          self.hdr_crc(JFFS2_NODETYPE_INODE, totlen))
+        raw += struct.pack(e + "IIIHHIIIIIIIBBH", ino, version, st["mode"],
+                           st["uid"], st["gid"], isize, st["atime"], st["mtime"],
+                           st["ctime"], offset, len(cdata), dsize, compr, 0, 0)
+        raw += struct.pack(e + "II", crc32(cdata), crc32(raw))
+        self.stats["inodes"] += 1
+        self.stats["data_in"] += dsize
+        self.stats["data_out"] += len(cdata)
+        return Node(raw + cdata, "HIIII",
+                    (JFFS2_NODETYPE_INODE, ino, version, None, totlen))
+
+    def dirent_node(self, pino, version, ino, mctime, name, dtype):
+        e = self.e
+        totlen = RAW_DIRENT_SIZE + len(name)
+        raw = struct.pack(e + "HHII", JFFS2_MAGIC_BITMASK, JFFS2_NODETYPE_DIRENT, totlen,
+                          self.hdr_crc(JFFS2_NODETYPE_DIRENT, totlen))
+        raw += struct.pack(e + "IIIIBBxx", pino, version, ino, mctime, len(name), dtype)
+        raw += struct.pack(e + "II", crc32(raw), crc32(name))
+        self.stats["dirents"] += 1
+        return Node(raw + name, "HIIIIIBB",
+                    (JFFS2_NODETYPE_DIRENT, totlen, None, pino, version, ino,
+                     len(name), dtype), name)
+
+
+class Builder(object):
+    """Lays out the tree. Nodes are only put into eraseblocks once all
+    the file data has been compressed, so the first pass notes them in
+    order, with a range of self.pages standing in for each file's data"""
+
+    def __init__(self, opts):
+        self.opts = opts
+        self.img = Image(opts)
+        self.next_ino = 2
+        self.links = {}
+        self.versions = {}
+        self.order = []
+        self.pages = []
+
+    def attrs(self, st):
+        opts = self.opts
+        t = opts.timestamp
+        return {"mode": st.st_mode,
+                "uid": 0 if opts.squash else st.st_uid & 0xffff,
+                "gid": 0 if opts.squash else st.st_gid & 0xffff,
+                "atime": int(st.st_atime) if t is None else t,
+                "mtime": int(st.st_mtime) if t is None else t,
+                "ctime": int(st.st_ctime) if t is None else t}
+
+    def version(self, ino):
+        self.versions[ino] = self.versions.get(ino, 0) + 1
+        return self.versions[ino]
+
+    def walk(self, path, ino, st):
+        """Lay out the directory path, which is inode ino, depth first
+        in name order"""
+        img = self.img
+        self.order.append(img.inode_node(ino, self.version(ino), self.attrs(st), 0))
+        for name in sorted(os.listdir(path)):
+            child = os.path.join(path, name)
+            cst = os.lstat(child)
+            bname = name.encode("utf-8", "surrogateescape")
+            if len(bname) > 254:
+                sys.exit("%s: name too long" % child)
+            key = (cst.st_dev, cst.st_ino)
+            if stat.S_ISDIR(cst.st_mode) or key not in self.links:
+                cino = self.next_ino
+                self.next_ino += 1
+                if not stat.S_ISDIR(cst.st_mode) and cst.st_nlink > 1:
+                    self.links[key] = cino
+                if stat.S_ISDIR(cst.st_mode):
+                    self.walk(child, cino, cst)
+                elif not self.leaf(child, cino, cst):
+                    continue
+            else:
+                # Another link to a file already in the image
+                cino = self.links[key]
+            mctime = self.opts.timestamp
+            if mctime is None:
+                mctime = int(cst.st_mtime)
+            self.order.append(img.dirent_node(ino, self.version(ino), cino, mctime, bname,
+                                              stat.S_IFMT(cst.st_mode) >> 12))
+
+    def leaf(self, path, ino, st):
+        img = self.img
+        attrs = self.attrs(st)
+        if stat.S_ISREG(st.st_mode):
+            if not st.st_size:
+                self.order.append(img.inode_node(ino, self.version(ino), attrs, 0))
+                return True
+            first = len(self.pages)
+            for ofs in range(0, st.st_size, PAGE_SIZE):
+                n = min(PAGE_SIZE, st.st_size - ofs)
+                self.pages.append((path, ino, attrs, st.st_size, ofs, n))
+            self.order.append((first, len(self.pages)))
+        elif stat.S_ISLNK(st.st_mode):
+            target = os.readlink(path).encode("utf-8", "surrogateescape")
+            self.order.append(img.inode_node(ino, self.version(ino), attrs, len(target), 0,
+                                             len(target), JFFS2_COMPR_NONE, target))
+        elif stat.S_ISCHR(st.st_mode) or stat.S_ISBLK(st.st_mode):
+            major, minor = os.major(st.st_rdev), os.minor(st.st_rdev)
+            dev = struct.pack(self.opts.endian + "I",
+                              (minor & 0xff) | (major << 8) | ((minor & ~0xff) << 12))
+            self.order.append(img.inode_node(ino, self.version(ino), attrs, 0, 0, len(dev),
+                                             JFFS2_COMPR_NONE, dev))
+        elif stat.S_ISFIFO(st.st_mode) or stat.S_ISSOCK(st.st_mode):
+            self.order.append(img.inode_node(ino, self.version(ino), attrs, 0))
+        else:
+            sys.stderr.write("%s: skipping, unknown file type\n" % path)
+            return False
+        return True
+
+    def build(self, root):
+        st = os.stat(root)
+        if not stat.S_ISDIR(st.st_mode):
+            sys.exit("%s: not a directory" % root)
+        self.walk(root, 1, st)
+
+        jobs = [(p[0], p[4], p[5], self.opts.comprs) for p in self.pages]
+        if self.opts.jobs == 1 or len(jobs) < 2:
+            results = [compress_page(j) for j in jobs]
+        else:
+            pool = Pool(self.opts.jobs)
+            results = pool.map(compress_page, jobs, chunksize=16)
+            pool.close()
+            pool.join()
+
+        img = self.img
+        for item in self.order:
+            if isinstance(item, Node):
+                img.add(item)
+                continue
+            for i in range(*item):
+                path, ino, attrs, size, ofs, n = self.pages[i]
+                compr, cdata = results[i]
+                img.add(img.inode_node(ino, self.version(ino), attrs, size, ofs, n,
+                                       compr, cdata))
+        img.close_block()
+        return img
+
+
+def parse_size(s):
+    mult = {"k": 1024, "m": 1024 * 1024}
+    s = s.strip().lower()
+    if s and s[-1] in mult:
+        return int(s[:-1], 0) * mult[s[-1]]
+    return int(s, 0)
+
+
+def parse_options():
+    usage = "%prog [options] -r ROOTDIR -o IMAGE"
+    parser = OptionParser(usage=usage, description=__doc__)
+    parser.add_option("-r", "--root", dest="root", help="Directory to build the image of")
+    parser.add_option("-o", "--output", dest="output", help="Image file to write")
+    parser.add_option("-e", "--eraseblock", dest="erase_size", default="64k",
+                      help="Eraseblock size [64k]")
+    parser.add_option("-p", "--pad", dest="pad", default=None,
+                      help="Pad the image with erased blocks to this size")
+    parser.add_option("-l", "--little-endian", dest="endian", action="store_const",
+                      const="<", default="<", help="Little-endian image [default]")
+    parser.add_option("-b", "--big-endian", dest="endian", action="store_const",
+                      const=">", help="Big-endian image")
+    parser.add_option("-n", "--no-cleanmarkers", dest="no_cleanmarkers",
+                      action="store_true", default=False,
+                      help="Don't put a cleanmarker at the start of each block")
+    parser.add_option("-c", "--compressors", dest="comprs", default="zlib,rtime",
+                      help="Compressors to try, from %s, or none [zlib,rtime]" %
+                      ",".join(COMPRESSORS))
+    parser.add_option("-j", "--jobs", dest="jobs", type="int", default=os.cpu_count() or 1,
+                      help="Compress with this many processes [one per CPU]")
+    parser.add_option("-t", "--timestamp", dest="timestamp", type="int", default=None,
+                      help="Give every file this time instead of its own")
+    parser.add_option("-U", "--squash", dest="squash", action="store_true", default=False,
+                      help="Make everything owned by root")
+    parser.add_option("-q", "--quiet", dest="quiet", action="store_true", default=False,
+                      help="Don't report on the image")
+    (opts, args) = parser.parse_args()
+    if args or not opts.root or not opts.output:
+        parser.error("need -r and -o")
+    opts.erase_size = parse_size(opts.erase_size)
+    if opts.erase_size < 4096 or opts.erase_size & 3:
+        parser.error("eraseblock size too small or unaligned")
+    opts.pad = parse_size(opts.pad) if opts.pad else None
+    opts.comprs = tuple(c for c in opts.comprs.split(",") if c and c != "none")
+    for c in opts.comprs:
+        if c not in COMPRESSORS:
+            parser.error("unknown compressor '%s'" % c)
+    if opts.jobs < 1:
+        parser.error("need at least one job")
+    return opts
+
+
+def report(img, opts, nr_pad):
+    """What the image holds, and what mounting it will cost to scan"""
+    s = img.stats
+    nblocks = len(img.blocks)
+    used = sum(sumofs for data, sumofs, n in img.blocks)
+    sumread = sum(opts.erase_size - sumofs for data, sumofs, n in img.blocks)
+    print("%d eraseblocks of %d KiB, %d more padding" % (nblocks, opts.erase_size // 1024, nr_pad))
+    print("%d nodes: %d inode, %d dirent" % (s["nodes"], s["inodes"], s["dirents"]))
+    if s["data_in"]:
+        print("data: %d bytes compressed to %d (%.1f%%)" %
+              (s["data_in"], s["data_out"], 100.0 * s["data_out"] / s["data_in"]))
+    print("blocks are %.1f%% full of nodes" % (100.0 * used / max(nblocks * opts.erase_size, 1)))
+    # With a summary, jffs2_sum_scan_sumnode() reads the marker and then
+    # everything from the summary node to the end of the block
+    print("mount scan: %d KiB of summaries (%d bytes a block on average)" %
+          ((sumread + nblocks * SUM_MARKER_SIZE) // 1024,
+           (sumread // max(nblocks, 1)) + SUM_MARKER_SIZE))
+    print("            instead of %d KiB of nodes without them" % (used // 1024))
+
+
+def main():
+    opts = parse_options()
+    builder = Builder(opts)
+    img = builder.build(opts.root)
+    size = len(img.blocks) * opts.erase_size
+    nr_pad = 0
+    if opts.pad:
+        if opts.pad < size:
+            sys.exit("image is %d bytes, more than the %d to pad it to" % (size, opts.pad))
+        if opts.pad % opts.erase_size:
+            sys.exit("can only pad to a whole number of eraseblocks")
+        nr_pad = (opts.pad - size) // opts.erase_size
+    with open(opts.output, "wb") as f:
+        for data, sumofs, n in img.blocks:
+            f.write(data)
+        if nr_pad:
+            blank = b"\xff" * opts.erase_size
+            if not opts.no_cleanmarkers:
+                blank = img.cleanmarker() + blank[CLEANMARKER_SIZE:]
+            for i in range(nr_pad):
+                f.write(blank)
+    if not opts.quiet:
+        report(img, opts, nr_pad)
+
+
+if __name__ == "__main__":
+    main()